@@ -6,14 +6,26 @@ layout (location = 2) in vec3 vColor;
 
 layout (location = 0) out vec3 outColor;
 
-layout (push_constant) uniform constants
+struct ObjectData
 {
-	vec4 data;
-	mat4 render_matrix;
-} PushConstants;
+	mat4 modelViewProjection;
+};
+
+//Filled by the CPU every frame, indexed by object handle
+layout (std430, set = 0, binding = 0) readonly buffer ObjectBuffer
+{
+	ObjectData objects[];
+} objectBuffer;
+
+//Object handle of every instance. The first slots map each handle to itself for draws picking their object with firstInstance,
+//the instanced draws list their objects behind them.
+layout (std430, set = 0, binding = 1) readonly buffer InstanceBuffer
+{
+	uint objectIndices[];
+} instanceBuffer;
 
 void main()
 {
-	gl_Position = PushConstants.render_matrix * vec4(vPosition, 1.f);
+	gl_Position = objectBuffer.objects[instanceBuffer.objectIndices[gl_InstanceIndex]].modelViewProjection * vec4(vPosition, 1.f);
 	outColor = vColor;
 }
\ No newline at end of file
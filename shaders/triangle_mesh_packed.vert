@@ -0,0 +1,41 @@
+#version 450
+
+//Quantized positions in [0, 1] of the mesh bounds
+layout (location = 0) in vec4 vPosition;
+//Octahedral encoded normal, part of the vertex format but not read here: the color already holds it
+layout (location = 1) in vec2 vNormal;
+layout (location = 2) in vec4 vColor;
+
+layout (location = 0) out vec3 outColor;
+
+//Dequantization of the mesh, pushed once per mesh
+layout (push_constant) uniform constants
+{
+	vec4 positionOffset;
+	vec4 positionScale;
+} PushConstants;
+
+struct ObjectData
+{
+	mat4 modelViewProjection;
+};
+
+//Filled by the CPU every frame, indexed by object handle
+layout (std430, set = 0, binding = 0) readonly buffer ObjectBuffer
+{
+	ObjectData objects[];
+} objectBuffer;
+
+//Object handle of every instance. The first slots map each handle to itself for draws picking their object with firstInstance,
+//the instanced draws list their objects behind them.
+layout (std430, set = 0, binding = 1) readonly buffer InstanceBuffer
+{
+	uint objectIndices[];
+} instanceBuffer;
+
+void main()
+{
+	vec3 position = PushConstants.positionOffset.xyz + vPosition.xyz * PushConstants.positionScale.xyz;
+	gl_Position = objectBuffer.objects[instanceBuffer.objectIndices[gl_InstanceIndex]].modelViewProjection * vec4(position, 1.f);
+	outColor = vColor.rgb;
+}
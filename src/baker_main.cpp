@@ -0,0 +1,218 @@
+#include <vk_asset.h>
+#include <vk_obj.h>
+#include <vk_mesh_opt.h>
+#include <vk_lod.h>
+#include <vk_jobs.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <filesystem>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstring>
+
+namespace fs = std::filesystem;
+
+using vkasset::BakeKind;
+
+struct BakeJob
+{
+	fs::path input;
+	fs::path output;
+	BakeKind kind;
+};
+
+enum class BakeStatus
+{
+	Baked,
+	UpToDate,
+	Failed
+};
+
+struct BakeResult
+{
+	BakeStatus status;
+	uint64_t rawBytes;
+	uint64_t storedBytes;
+	double ms;
+};
+
+static BakeResult bake(const BakeJob& job, JobSystem& jobSystem, vkasset::AssetCompression compression, bool force)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	BakeResult result = { BakeStatus::Failed, 0, 0, 0.0 };
+
+	MappedFile input;
+	if (!input.open(job.input.string().c_str()))
+	{
+		std::cout << "Could not read " << job.input << std::endl;
+		return result;
+	}
+
+	uint64_t sourceHash = vkasset::hash_bytes(input.data(), input.size(), vkasset::get_bake_seed(job.kind, compression));
+
+	//Unchanged input since the last bake, nothing to do
+	if (!force)
+	{
+		MappedFile previous;
+		vkasset::AssetView view;
+		if (previous.open(job.output.string().c_str()) && vkasset::read_asset(previous, view) && view.header->sourceHash == sourceHash)
+		{
+			result.status = BakeStatus::UpToDate;
+			return result;
+		}
+	}
+
+	bool saved = false;
+	if (job.kind == BakeKind::Texture)
+	{
+		int width, height, channels;
+		stbi_uc* pixels = stbi_load_from_memory(input.data(), (int)input.size(), &width, &height, &channels, STBI_rgb_alpha);
+		if (pixels == nullptr)
+		{
+			std::cout << "Could not decode " << job.input << ": " << stbi_failure_reason() << std::endl;
+			return result;
+		}
+
+		saved = vkasset::save_texture(job.output.string().c_str(), pixels, (uint32_t)width, (uint32_t)height, compression, sourceHash);
+		result.rawBytes = (uint64_t)width * height * 4;
+
+		stbi_image_free(pixels);
+	}
+	else
+	{
+		//Same processing the engine does when it falls back to the OBJ
+		Mesh mesh;
+		if (!vkobj::load_obj(job.input.string().c_str(), mesh, jobSystem))
+			return result;
+
+		vkmeshopt::optimize_mesh(mesh, job.input.filename().string().c_str());
+		vklod::generate_lods(mesh, job.input.filename().string().c_str());
+
+		if (job.kind == BakeKind::PackedMesh)
+		{
+			mesh.pack_vertices();
+		}
+
+		saved = vkasset::save_mesh(job.output.string().c_str(), mesh, compression, sourceHash);
+	}
+
+	if (!saved)
+		return result;
+
+	//Report what actually landed on disk
+	MappedFile output;
+	vkasset::AssetView view;
+	if (output.open(job.output.string().c_str()) && vkasset::read_asset(output, view))
+	{
+		result.rawBytes = view.header->blobRawSize;
+		result.storedBytes = view.header->blobSize;
+	}
+
+	result.status = BakeStatus::Baked;
+	result.ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	return result;
+}
+
+int main(int argc, char* argv[])
+{
+	//Same relative location the engine loads assets from
+	fs::path assetDirectory = "../../assets";
+	vkasset::AssetCompression compression = vkasset::AssetCompression::LZ4;
+	bool force = false;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		//Rebake everything, even inputs that did not change
+		if (strcmp(argv[i], "--force") == 0)
+		{
+			force = true;
+		}
+		//Store blobs as they are, so the engine uploads straight from the mapping
+		else if (strcmp(argv[i], "--no-compress") == 0)
+		{
+			compression = vkasset::AssetCompression::None;
+		}
+		else
+		{
+			assetDirectory = argv[i];
+		}
+	}
+
+	std::error_code error;
+	if (!fs::is_directory(assetDirectory, error))
+	{
+		std::cout << "Usage: asset_baker [asset directory] [--force] [--no-compress]" << std::endl;
+		std::cout << assetDirectory << " is not a directory" << std::endl;
+		return 1;
+	}
+
+	//Output names match what the engine looks for next to the source
+	std::vector<BakeJob> jobs;
+	for (const fs::directory_entry& entry : fs::directory_iterator(assetDirectory))
+	{
+		if (!entry.is_regular_file())
+			continue;
+
+		const fs::path& path = entry.path();
+		std::string extension = path.extension().string();
+		fs::path stem = path.parent_path() / path.stem();
+
+		if (extension == ".obj")
+		{
+			jobs.push_back({ path, fs::path(stem.string() + ".mesh"), BakeKind::Mesh });
+			jobs.push_back({ path, fs::path(stem.string() + ".packed.mesh"), BakeKind::PackedMesh });
+		}
+		else if (extension == ".png")
+		{
+			jobs.push_back({ path, fs::path(stem.string() + ".tx"), BakeKind::Texture });
+		}
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	JobSystem jobSystem;
+	jobSystem.init();
+	uint32_t threadCount = jobSystem.get_thread_count();
+
+	std::vector<std::future<BakeResult>> results;
+	results.reserve(jobs.size());
+	for (const BakeJob& job : jobs)
+	{
+		results.push_back(jobSystem.submit([&job, &jobSystem, compression, force]() { return bake(job, jobSystem, compression, force); }));
+	}
+
+	uint32_t baked = 0, upToDate = 0, failed = 0;
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		BakeResult result = results[i].get();
+
+		if (result.status == BakeStatus::Baked)
+		{
+			baked++;
+			std::cout << "Baked " << jobs[i].output.filename().string() << ": " << result.rawBytes << " -> " << result.storedBytes
+				<< " bytes in " << result.ms << " ms" << std::endl;
+		}
+		else if (result.status == BakeStatus::UpToDate)
+		{
+			upToDate++;
+		}
+		else
+		{
+			failed++;
+			std::cout << "Failed " << jobs[i].input.filename().string() << std::endl;
+		}
+	}
+
+	jobSystem.shutdown();
+
+	double totalMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	std::cout << baked << " baked, " << upToDate << " up to date, " << failed << " failed in " << totalMs << " ms on "
+		<< threadCount << " threads" << std::endl;
+
+	return failed == 0 ? 0 : 1;
+}
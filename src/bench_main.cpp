@@ -0,0 +1,262 @@
+#include <vk_engine.h>
+#include <vk_trace.h>
+#include <vk_asset.h>
+
+#include <SDL.h>
+
+#include <vector>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+
+#include <glm/gtx/transform.hpp>
+
+struct Percentiles
+{
+	double p50;
+	double p95;
+	double p99;
+	double max;
+};
+
+//Nearest-rank percentiles, the samples get sorted in place
+static Percentiles compute_percentiles(std::vector<double>& samples)
+{
+	Percentiles result = {};
+	if (samples.empty())
+		return result;
+
+	std::sort(samples.begin(), samples.end());
+
+	auto rank = [&](double p) {
+		size_t index = (size_t)(p * (samples.size() - 1) + 0.5);
+		return samples[index];
+	};
+
+	result.p50 = rank(0.50);
+	result.p95 = rank(0.95);
+	result.p99 = rank(0.99);
+	result.max = samples.back();
+	return result;
+}
+
+static void write_percentiles(std::ofstream& file, const char* name, const Percentiles& p, bool last)
+{
+	file << "\t\"" << name << "\": { "
+		<< "\"p50\": " << p.p50 << ", "
+		<< "\"p95\": " << p.p95 << ", "
+		<< "\"p99\": " << p.p99 << ", "
+		<< "\"max\": " << p.max << " }"
+		<< (last ? "\n" : ",\n");
+}
+
+//Same pose for a given frame on every run: the camera dollies in and out while the model turns on two axes
+static FramePose scripted_pose(int frameNumber)
+{
+	float t = (float)frameNumber;
+
+	FramePose pose;
+	pose.camPos = { 0.f, 0.f, -2.5f + 0.5f * std::sin(t * 0.02f) };
+	pose.model = glm::rotate(glm::mat4{ 1.f }, glm::radians(t * 0.4f), glm::vec3(0.f, 1.f, 0.f))
+			   * glm::rotate(glm::mat4{ 1.f }, glm::radians(20.f * std::sin(t * 0.01f)), glm::vec3(1.f, 0.f, 0.f));
+	return pose;
+}
+
+int main(int argc, char* argv[])
+{
+	int frameCount = 1000;
+	int warmupFrames = 60;
+	const char* outputPath = "bench_results.json";
+	const char* tracePath = nullptr;
+
+	VulkanEngine engine;
+	//Benchmarks run on display-less machines unless asked otherwise
+	engine._headless = true;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+		{
+			frameCount = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+		{
+			warmupFrames = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc)
+		{
+			engine._framesInFlight = (uint32_t)atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+		{
+			outputPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+		{
+			tracePath = argv[++i];
+		}
+		else if (strcmp(argv[i], "--packed-vertices") == 0)
+		{
+			engine._packedVertices = true;
+		}
+		else if (strcmp(argv[i], "--meshlet-culling") == 0)
+		{
+			engine._meshletCulling = true;
+		}
+		else if (strcmp(argv[i], "--no-frustum-culling") == 0)
+		{
+			engine._frustumCulling = false;
+		}
+		else if (strcmp(argv[i], "--flat-culling") == 0)
+		{
+			engine._hierarchicalCulling = false;
+		}
+		else if (strcmp(argv[i], "--gpu-culling") == 0)
+		{
+			engine._gpuCulling = true;
+		}
+		else if (strcmp(argv[i], "--occlusion-culling") == 0)
+		{
+			engine._occlusionCulling = true;
+		}
+		else if (strcmp(argv[i], "--lod-error") == 0 && i + 1 < argc)
+		{
+			engine._lodPixelError = (float)atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--windowed") == 0)
+		{
+			engine._headless = false;
+		}
+		//Copy every frame back to the host and checksum it, the readback cost shows up in the timings
+		else if (strcmp(argv[i], "--readback") == 0)
+		{
+			engine._readbackFrames = true;
+		}
+	}
+
+	//Same scripted frames give the same pixels, the checksum of the last one tells runs with different settings apart
+	int readbackCount = 0;
+	int lastReadbackFrame = -1;
+	uint64_t lastReadbackChecksum = 0;
+	engine._onFrameReadback = [&](int frameNumber, const uint8_t* pixels, VkExtent2D extent) {
+		readbackCount++;
+		lastReadbackFrame = frameNumber;
+		lastReadbackChecksum = vkasset::hash_bytes(pixels, (size_t)extent.width * extent.height * 4);
+	};
+
+	if (engine._readbackFrames && !engine._headless)
+	{
+		std::cout << "--readback only works headless, ignoring it" << std::endl;
+		engine._readbackFrames = false;
+	}
+
+	engine._scriptedPath = scripted_pose;
+
+	vktrace::set_enabled(tracePath != nullptr);
+
+	engine.init();
+
+	std::vector<double> recordMs, submitMs, fenceWaitMs, gpuFrameMs, cullMs;
+	recordMs.reserve(frameCount);
+	submitMs.reserve(frameCount);
+	fenceWaitMs.reserve(frameCount);
+	gpuFrameMs.reserve(frameCount);
+	cullMs.reserve(frameCount);
+
+	int lastGpuFrame = -1;
+
+	//Let pipelines, caches and the driver settle before measuring
+	for (int i = 0; i < warmupFrames + frameCount; ++i)
+	{
+		if (!engine._headless)
+		{
+			//Keep the window responsive, input is ignored
+			SDL_PumpEvents();
+		}
+
+		engine.draw();
+
+		if (i < warmupFrames)
+			continue;
+
+		recordMs.push_back(engine._lastFrameStats.recordMs);
+		submitMs.push_back(engine._lastFrameStats.submitMs);
+		fenceWaitMs.push_back(engine._lastFrameStats.fenceWaitMs);
+		cullMs.push_back(engine._lastCullStats.cullMs);
+
+		//GPU timings land a few frames late, only count measured frames once
+		int resolvedFrame = engine._gpuProfiler.get_resolved_frame();
+		if (resolvedFrame >= warmupFrames && resolvedFrame != lastGpuFrame)
+		{
+			lastGpuFrame = resolvedFrame;
+			for (const GpuScopeTiming& timing : engine._gpuProfiler.get_timings())
+			{
+				if (timing.depth == 0)
+				{
+					gpuFrameMs.push_back(timing.ms);
+				}
+			}
+		}
+	}
+
+	//Counts of the last frame, the scripted camera only dollies so they barely change
+	DrawStats drawStats = engine._lastDrawStats;
+	CullStats cullStats = engine._lastCullStats;
+
+	engine.cleanup();
+
+	if (tracePath)
+	{
+		vktrace::write_chrome_json(tracePath);
+	}
+
+	std::ofstream file(outputPath);
+	if (!file.is_open())
+	{
+		std::cout << "Could not write benchmark results to " << outputPath << std::endl;
+		return 1;
+	}
+
+	file << "{\n";
+	file << "\t\"frames\": " << frameCount << ",\n";
+	file << "\t\"warmupFrames\": " << warmupFrames << ",\n";
+	file << "\t\"framesInFlight\": " << engine._framesInFlight << ",\n";
+	file << "\t\"headless\": " << (engine._headless ? "true" : "false") << ",\n";
+	file << "\t\"packedVertices\": " << (engine._packedVertices ? "true" : "false") << ",\n";
+	file << "\t\"meshletCulling\": " << (engine._meshletCulling ? "true" : "false") << ",\n";
+	file << "\t\"lodPixelError\": " << engine._lodPixelError << ",\n";
+	file << "\t\"drawStats\": { "
+		<< "\"draws\": " << drawStats.draws << ", "
+		<< "\"instances\": " << drawStats.instances << ", "
+		<< "\"pipelineBinds\": " << drawStats.pipelineBinds << ", "
+		<< "\"descriptorSetBinds\": " << drawStats.descriptorSetBinds << ", "
+		<< "\"vertexBufferBinds\": " << drawStats.vertexBufferBinds << ", "
+		<< "\"indexBufferBinds\": " << drawStats.indexBufferBinds << ", "
+		<< "\"skippedBinds\": " << drawStats.skippedBinds << " },\n";
+	file << "\t\"frustumCulling\": " << (engine._frustumCulling ? "true" : "false") << ",\n";
+	file << "\t\"hierarchicalCulling\": " << (engine._hierarchicalCulling ? "true" : "false") << ",\n";
+	file << "\t\"gpuCulling\": " << (engine._gpuCulling ? "true" : "false") << ",\n";
+	file << "\t\"occlusionCulling\": " << (engine._occlusionCulling ? "true" : "false") << ",\n";
+	file << "\t\"visibleObjects\": " << cullStats.visible << ",\n";
+	file << "\t\"culledObjects\": " << cullStats.culled << ",\n";
+	if (engine._readbackFrames)
+	{
+		//Hex in a string, JSON numbers can't hold 64 bits exactly
+		file << "\t\"readbackFrames\": " << readbackCount << ",\n";
+		file << "\t\"lastReadbackFrame\": " << lastReadbackFrame << ",\n";
+		file << "\t\"lastReadbackChecksum\": \"" << std::hex << lastReadbackChecksum << std::dec << "\",\n";
+	}
+	write_percentiles(file, "cullMs", compute_percentiles(cullMs), false);
+	write_percentiles(file, "cpuRecordMs", compute_percentiles(recordMs), false);
+	write_percentiles(file, "submitMs", compute_percentiles(submitMs), false);
+	write_percentiles(file, "fenceWaitMs", compute_percentiles(fenceWaitMs), false);
+	write_percentiles(file, "gpuFrameMs", compute_percentiles(gpuFrameMs), true);
+	file << "}\n";
+
+	std::cout << "Benchmark results written to " << outputPath << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,166 @@
+#include <vk_bvh.h>
+#include <vk_culling.h>
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#include <glm/gtx/transform.hpp>
+
+template<typename F>
+static double best_ms(int runs, F&& kernel)
+{
+	double best = 1e30;
+	for (int run = 0; run < runs; ++run)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		kernel();
+		best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+	}
+	return best;
+}
+
+//Plain per-box test of every plane, what the tree has to agree with
+static bool box_visible(const Frustum& frustum, const AABB& box)
+{
+	glm::vec3 center = (box.min + box.max) * 0.5f;
+	glm::vec3 extent = (box.max - box.min) * 0.5f;
+	for (const glm::vec4& plane : frustum.planes)
+	{
+		float distance = glm::dot(glm::vec3(plane), center) + plane.w;
+		float reach = glm::dot(glm::abs(glm::vec3(plane)), extent);
+		if (distance < -reach)
+			return false;
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	size_t objectCount = 1000000;
+	int runs = 20;
+	float movingFraction = 0.1f;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--objects") == 0 && i + 1 < argc)
+		{
+			objectCount = (size_t)std::max(atoi(argv[++i]), 1);
+		}
+		else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+		{
+			runs = std::max(atoi(argv[++i]), 1);
+		}
+		//Share of the objects nudged before every run of the move test
+		else if (strcmp(argv[i], "--moving") == 0 && i + 1 < argc)
+		{
+			movingFraction = std::clamp((float)atof(argv[++i]), 0.f, 1.f);
+		}
+	}
+
+	//Unit cubes scattered through a volume far larger than the view, the same on every run
+	std::mt19937 random(1234);
+	float worldSize = std::cbrt((float)objectCount) * 4.f;
+	std::uniform_real_distribution<float> position(-worldSize, worldSize);
+	std::uniform_real_distribution<float> nudge(-0.2f, 0.2f);
+
+	const glm::vec3 cubeMin{ -0.5f };
+	const glm::vec3 cubeMax{ 0.5f };
+	std::vector<glm::mat4> transforms(objectCount);
+	std::vector<AABB> boxes(objectCount);
+	SphereArray spheres;
+	spheres.resize(objectCount);
+	for (size_t i = 0; i < objectCount; ++i)
+	{
+		transforms[i] = glm::translate(glm::vec3(position(random), position(random), position(random)));
+		boxes[i] = vkcull::transform_aabb(transforms[i], cubeMin, cubeMax);
+		spheres.set(i, vkcull::transform_sphere(transforms[i], glm::vec4(0.f, 0.f, 0.f, std::sqrt(0.75f))));
+	}
+
+	std::vector<uint32_t> handles(objectCount);
+	for (size_t i = 0; i < objectCount; ++i)
+	{
+		handles[i] = (uint32_t)i;
+	}
+
+	//One tree built object by object in creation order, the one measured below built in bulk
+	DynamicAabbTree incrementalTree;
+	double incrementalBuildMs = best_ms(1, [&]() {
+		for (size_t i = 0; i < objectCount; ++i)
+		{
+			incrementalTree.create_proxy(boxes[i], handles[i]);
+		}
+	});
+
+	DynamicAabbTree tree;
+	std::vector<int32_t> proxies(objectCount);
+	double buildMs = best_ms(1, [&]() { tree.create_proxies(boxes.data(), handles.data(), objectCount, proxies.data()); });
+
+	glm::mat4 projection = glm::perspective(glm::radians(70.f), 1700.f / 900.f, 0.1f, worldSize * 0.5f);
+	projection[1][1] *= -1;
+	Frustum frustum = vkcull::extract_frustum(projection * glm::translate(glm::vec3(0.f, 0.f, worldSize * 0.5f)));
+
+	std::vector<uint32_t> flatVisible(spheres.centerX.size());
+	std::vector<uint32_t> treeVisible;
+	uint32_t flatCount = 0;
+
+	double flatMs = best_ms(runs, [&]() { flatCount = vkcull::cull_spheres(frustum, spheres, flatVisible.data()); });
+	double incrementalTreeMs = best_ms(runs, [&]() { treeVisible.clear(); incrementalTree.cull(frustum, treeVisible); });
+	double treeMs = best_ms(runs, [&]() { treeVisible.clear(); tree.cull(frustum, treeVisible); });
+
+	//Moves small enough to stay near their old spot, most are refits rather than reinsertions
+	size_t movingCount = (size_t)(objectCount * movingFraction);
+	std::vector<size_t> moving(movingCount);
+	double moveMs = 0.0;
+	size_t refitted = 0;
+	for (int run = 0; run < runs; ++run)
+	{
+		for (size_t& i : moving)
+		{
+			i = random() % objectCount;
+			transforms[i] = glm::translate(transforms[i], glm::vec3(nudge(random), nudge(random), nudge(random)));
+			boxes[i] = vkcull::transform_aabb(transforms[i], cubeMin, cubeMax);
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+		for (size_t i : moving)
+		{
+			refitted += tree.move_proxy(proxies[i], boxes[i]) ? 1 : 0;
+		}
+		moveMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / runs;
+	}
+
+	//After the moves the tree must still return exactly the boxes a brute force test keeps, fat margins aside
+	treeVisible.clear();
+	tree.cull(frustum, treeVisible);
+	std::sort(treeVisible.begin(), treeVisible.end());
+
+	size_t missing = 0;
+	for (size_t i = 0; i < objectCount; ++i)
+	{
+		if (box_visible(frustum, boxes[i]) && !std::binary_search(treeVisible.begin(), treeVisible.end(), (uint32_t)i))
+		{
+			missing++;
+		}
+	}
+
+	std::cout << objectCount << " objects, best of " << runs << " runs, tree height " << tree.get_height() << std::endl;
+	std::cout << "tree build:     " << incrementalBuildMs << " ms one by one, " << buildMs << " ms in bulk" << std::endl;
+	std::cout << "flat SSE cull:  " << flatMs << " ms, " << flatCount << " visible" << std::endl;
+	std::cout << "tree cull:      " << incrementalTreeMs << " ms one by one (" << flatMs / incrementalTreeMs << "x), "
+		<< treeMs << " ms in bulk (" << flatMs / treeMs << "x)" << std::endl;
+	std::cout << "tree move:      " << moveMs << " ms for " << movingCount << " objects, " << refitted / runs << " left their fat box" << std::endl;
+	std::cout << "tree visible:   " << treeVisible.size() << ", " << missing << " visible boxes missing" << std::endl;
+
+	if (missing != 0)
+	{
+		std::cout << "tree culled visible boxes" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -1,11 +1,76 @@
 #include <vk_engine.h>
+#include <vk_trace.h>
 #include <crtdbg.h>
+#include <cstring>
+#include <cstdlib>
 
 int main(int argc, char* argv[])
 {
 	_CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
 
 	VulkanEngine engine;
+	const char* tracePath = nullptr;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		//Depth of the frames-in-flight ring, clamped by the engine
+		if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc)
+		{
+			engine._framesInFlight = (uint32_t)atoi(argv[++i]);
+		}
+		//Render offscreen without SDL, for display-less machines
+		else if (strcmp(argv[i], "--headless") == 0)
+		{
+			engine._headless = true;
+		}
+		//Stop after a fixed number of frames
+		else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+		{
+			engine._frameLimit = atoi(argv[++i]);
+		}
+		//Upload meshes in the compact quantized vertex format
+		else if (strcmp(argv[i], "--packed-vertices") == 0)
+		{
+			engine._packedVertices = true;
+		}
+		//Cull meshlets on the GPU and draw the survivors indirectly
+		else if (strcmp(argv[i], "--meshlet-culling") == 0)
+		{
+			engine._meshletCulling = true;
+		}
+		//Draw every scene object, even those outside the view
+		else if (strcmp(argv[i], "--no-frustum-culling") == 0)
+		{
+			engine._frustumCulling = false;
+		}
+		//Test every bounding sphere with SSE instead of walking the box tree
+		else if (strcmp(argv[i], "--flat-culling") == 0)
+		{
+			engine._hierarchicalCulling = false;
+		}
+		//Cull and pick levels of detail in a compute pass, then draw each batch with one indirect call
+		else if (strcmp(argv[i], "--gpu-culling") == 0)
+		{
+			engine._gpuCulling = true;
+		}
+		//Also skip objects hidden behind what was visible last frame, implies --gpu-culling
+		else if (strcmp(argv[i], "--occlusion-culling") == 0)
+		{
+			engine._occlusionCulling = true;
+		}
+		//Pixel error allowed before a coarser level of detail kicks in, 0 keeps the full mesh
+		else if (strcmp(argv[i], "--lod-error") == 0 && i + 1 < argc)
+		{
+			engine._lodPixelError = (float)atof(argv[++i]);
+		}
+		//Record CPU zones and write them as a Chrome trace on exit
+		else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+		{
+			tracePath = argv[++i];
+		}
+	}
+
+	vktrace::set_enabled(tracePath != nullptr);
 
 	engine.init();
 	
@@ -13,5 +78,10 @@ int main(int argc, char* argv[])
 
 	engine.cleanup();
 
+	if (tracePath)
+	{
+		vktrace::write_chrome_json(tracePath);
+	}
+
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,116 @@
+#include <vk_obj.h>
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+struct LoaderTimings
+{
+	double best;
+	double average;
+};
+
+template<typename F>
+static LoaderTimings time_loader(int runs, Mesh& outMesh, F&& load)
+{
+	LoaderTimings timings = { 1e30, 0.0 };
+	for (int run = 0; run < runs; ++run)
+	{
+		Mesh mesh;
+		auto start = std::chrono::high_resolution_clock::now();
+		if (!load(mesh))
+		{
+			timings.best = -1.0;
+			return timings;
+		}
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		timings.best = std::min(timings.best, ms);
+		timings.average += ms / runs;
+
+		outMesh._vertices = std::move(mesh._vertices);
+		outMesh._indices = std::move(mesh._indices);
+	}
+	return timings;
+}
+
+//Both loaders must produce the same triangles, vertex numbering may differ where tinyobj merges equal values
+static size_t count_mismatched_corners(const Mesh& a, const Mesh& b)
+{
+	if (a._indices.size() != b._indices.size())
+		return std::max(a._indices.size(), b._indices.size());
+
+	size_t mismatches = 0;
+	for (size_t i = 0; i < a._indices.size(); ++i)
+	{
+		if (!(a._vertices[a._indices[i]] == b._vertices[b._indices[i]]))
+		{
+			mismatches++;
+		}
+	}
+	return mismatches;
+}
+
+int main(int argc, char* argv[])
+{
+	const char* path = "../../assets/monkey_smooth.obj";
+	int runs = 5;
+	uint32_t threadCount = 0;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+		{
+			runs = std::max(atoi(argv[++i]), 1);
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			threadCount = (uint32_t)std::max(atoi(argv[++i]), 0);
+		}
+		else
+		{
+			path = argv[i];
+		}
+	}
+
+	JobSystem jobSystem;
+	jobSystem.init(threadCount);
+
+	Mesh reference;
+	LoaderTimings tinyobjTimings = time_loader(runs, reference, [&](Mesh& mesh) { return mesh.load_from_obj(path); });
+
+	Mesh parallel;
+	vkobj::ObjLoadStats stats = {};
+	LoaderTimings parallelTimings = time_loader(runs, parallel, [&](Mesh& mesh) { return vkobj::load_obj(path, mesh, jobSystem, &stats); });
+
+	uint32_t workers = jobSystem.get_thread_count();
+	jobSystem.shutdown();
+
+	if (tinyobjTimings.best < 0.0 || parallelTimings.best < 0.0)
+	{
+		std::cout << "Could not load " << path << std::endl;
+		return 1;
+	}
+
+	double megabytes = stats.fileSize / (1024.0 * 1024.0);
+	std::cout << std::endl << path << ": " << megabytes << " MB, " << stats.cornerCount << " corners, best of " << runs << " runs" << std::endl;
+	std::cout << "tinyobjloader: " << tinyobjTimings.best << " ms (avg " << tinyobjTimings.average << " ms), "
+		<< megabytes / (tinyobjTimings.best / 1000.0) << " MB/s" << std::endl;
+	std::cout << "vkobj:         " << parallelTimings.best << " ms (avg " << parallelTimings.average << " ms), "
+		<< megabytes / (parallelTimings.best / 1000.0) << " MB/s on " << workers + 1 << " threads, " << stats.chunkCount << " chunks" << std::endl;
+	std::cout << "               last run: parse " << stats.parseMs << " ms, merge " << stats.mergeMs << " ms" << std::endl;
+	std::cout << "speedup:       " << tinyobjTimings.best / parallelTimings.best << "x" << std::endl;
+
+	size_t mismatches = count_mismatched_corners(reference, parallel);
+	if (mismatches != 0)
+	{
+		std::cout << mismatches << " corners differ from tinyobjloader" << std::endl;
+		return 1;
+	}
+
+	std::cout << "output matches tinyobjloader" << std::endl;
+	return 0;
+}
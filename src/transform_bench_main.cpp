@@ -0,0 +1,129 @@
+#include <vk_transform.h>
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#include <glm/gtx/transform.hpp>
+
+struct KernelTimings
+{
+	double best;
+	double average;
+};
+
+template<typename F>
+static KernelTimings time_kernel(int runs, F&& kernel)
+{
+	KernelTimings timings = { 1e30, 0.0 };
+	for (int run = 0; run < runs; ++run)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		kernel();
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		timings.best = std::min(timings.best, ms);
+		timings.average += ms / runs;
+	}
+	return timings;
+}
+
+//Largest element difference, relative to the element size so far away objects don't dominate
+static float max_relative_error(const std::vector<glm::mat4>& a, const std::vector<glm::mat4>& b)
+{
+	float maxError = 0.f;
+	for (size_t i = 0; i < a.size(); ++i)
+	{
+		const float* x = &a[i][0][0];
+		const float* y = &b[i][0][0];
+		for (int e = 0; e < 16; ++e)
+		{
+			maxError = std::max(maxError, std::abs(x[e] - y[e]) / std::max(std::abs(x[e]), 1.f));
+		}
+	}
+	return maxError;
+}
+
+static void print_timings(const char* name, const KernelTimings& timings, size_t objectCount, double reference)
+{
+	std::cout << name << timings.best << " ms (avg " << timings.average << " ms), "
+		<< objectCount / (timings.best * 1000.0) << " M objects/s, " << reference / timings.best << "x" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	size_t objectCount = 100000;
+	int runs = 50;
+	uint32_t threadCount = 0;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--objects") == 0 && i + 1 < argc)
+		{
+			objectCount = (size_t)std::max(atoi(argv[++i]), 1);
+		}
+		else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+		{
+			runs = std::max(atoi(argv[++i]), 1);
+		}
+		else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+		{
+			threadCount = (uint32_t)std::max(atoi(argv[++i]), 0);
+		}
+	}
+
+	//Scattered objects with random rotation and scale, the same on every run
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> unit(-1.f, 1.f);
+
+	std::vector<glm::mat4> models(objectCount);
+	TransformArray transforms;
+	for (size_t i = 0; i < objectCount; ++i)
+	{
+		glm::vec3 axis = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) + glm::vec3(0.f, 0.f, 2.f));
+		models[i] = glm::translate(glm::vec3(unit(random), unit(random), unit(random)) * 100.f)
+			* glm::rotate(unit(random) * 3.14f, axis)
+			* glm::scale(glm::vec3(1.f + unit(random) * 0.5f));
+		transforms.add(models[i]);
+	}
+
+	glm::mat4 projection = glm::perspective(glm::radians(70.f), 1700.f / 900.f, 0.1f, 200.f);
+	projection[1][1] *= -1;
+	glm::mat4 viewProjection = projection * glm::translate(glm::vec3(0.f, 0.f, -150.f));
+
+	JobSystem jobSystem;
+	jobSystem.init(threadCount);
+
+	std::vector<glm::mat4> scalarOut(objectCount);
+	std::vector<glm::mat4> sseOut(objectCount);
+	std::vector<glm::mat4> jobsOut(objectCount);
+
+	KernelTimings scalarTimings = time_kernel(runs, [&]() { vktransform::compute_mvp_scalar(viewProjection, models.data(), objectCount, scalarOut.data()); });
+	KernelTimings sseTimings = time_kernel(runs, [&]() { vktransform::compute_mvp(viewProjection, transforms, sseOut.data()); });
+	KernelTimings jobsTimings = time_kernel(runs, [&]() { vktransform::compute_mvp(viewProjection, transforms, jobsOut.data(), &jobSystem); });
+
+	uint32_t workers = jobSystem.get_thread_count();
+	jobSystem.shutdown();
+
+	std::cout << objectCount << " objects, best of " << runs << " runs, " << workers + 1 << " threads for MT" << std::endl;
+	print_timings("glm scalar:  ", scalarTimings, objectCount, scalarTimings.best);
+	print_timings("SoA SSE:     ", sseTimings, objectCount, scalarTimings.best);
+	print_timings("SoA SSE MT:  ", jobsTimings, objectCount, scalarTimings.best);
+
+	float sseError = max_relative_error(scalarOut, sseOut);
+	float jobsError = max_relative_error(scalarOut, jobsOut);
+	std::cout << "max relative difference to glm: " << sseError << " (SSE), " << jobsError << " (SSE MT)" << std::endl;
+
+	//Same products, only the summation order may differ
+	if (sseError > 1e-5f || jobsError > 1e-5f)
+	{
+		std::cout << "SoA results differ from glm" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,503 @@
+#include "vk_asset.h"
+
+#include "vk_lz4.h"
+#include "vk_lod.h"
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <cstdlib>
+
+#include <glm/common.hpp>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+bool MappedFile::open(const char* path)
+{
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == nullptr)
+	{
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	_file = file;
+	_mapping = mapping;
+	_data = (const uint8_t*)data;
+	_size = (size_t)fileSize.QuadPart;
+#else
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	void* data = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+	{
+		::close(fd);
+		return false;
+	}
+
+	//The whole file is read front to back right away
+	madvise(data, (size_t)fileStat.st_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+	_fd = fd;
+	_data = (const uint8_t*)data;
+	_size = (size_t)fileStat.st_size;
+#endif
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (_data == nullptr)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(_data);
+	CloseHandle((HANDLE)_mapping);
+	CloseHandle((HANDLE)_file);
+	_mapping = nullptr;
+	_file = nullptr;
+#else
+	munmap((void*)_data, _size);
+	::close(_fd);
+	_fd = -1;
+#endif
+
+	_data = nullptr;
+	_size = 0;
+}
+
+namespace {
+
+	uint64_t align_up(uint64_t value)
+	{
+		return (value + vkasset::ASSET_ALIGNMENT - 1) & ~(vkasset::ASSET_ALIGNMENT - 1);
+	}
+
+	uint32_t get_vertex_stride(VertexFormat vertexFormat)
+	{
+		return vertexFormat == VertexFormat::Packed ? sizeof(PackedVertex) : sizeof(Vertex);
+	}
+
+	//Lookups in the flat JSON objects written below: numbers, arrays of numbers and strings, no nesting
+	const char* json_find_value(const std::string& json, const char* key)
+	{
+		std::string quoted = std::string("\"") + key + "\"";
+		size_t position = json.find(quoted);
+		if (position == std::string::npos)
+			return nullptr;
+
+		const char* c = json.c_str() + position + quoted.size();
+		while (*c == ' ' || *c == '\t' || *c == '\n' || *c == '\r')
+			++c;
+		if (*c != ':')
+			return nullptr;
+		++c;
+		while (*c == ' ' || *c == '\t' || *c == '\n' || *c == '\r')
+			++c;
+		return c;
+	}
+
+	bool json_read_numbers(const std::string& json, const char* key, double* outValues, int count)
+	{
+		const char* c = json_find_value(json, key);
+		if (c == nullptr)
+			return false;
+
+		bool isArray = *c == '[';
+		if (isArray != (count > 1))
+			return false;
+		if (isArray)
+			++c;
+
+		for (int i = 0; i < count; ++i)
+		{
+			char* end;
+			outValues[i] = strtod(c, &end);
+			if (end == c)
+				return false;
+
+			c = end;
+			while (*c == ' ' || *c == ',' || *c == '\n')
+				++c;
+		}
+		return true;
+	}
+
+	template<typename T>
+	bool json_read(const std::string& json, const char* key, T& outValue)
+	{
+		double value;
+		if (!json_read_numbers(json, key, &value, 1))
+			return false;
+		outValue = (T)value;
+		return true;
+	}
+
+	bool json_read_vec3(const std::string& json, const char* key, float* outValues)
+	{
+		double values[3];
+		if (!json_read_numbers(json, key, values, 3))
+			return false;
+		for (int i = 0; i < 3; ++i)
+		{
+			outValues[i] = (float)values[i];
+		}
+		return true;
+	}
+
+	bool json_read_string(const std::string& json, const char* key, std::string& outValue)
+	{
+		const char* c = json_find_value(json, key);
+		if (c == nullptr || *c != '"')
+			return false;
+
+		const char* end = strchr(c + 1, '"');
+		if (end == nullptr)
+			return false;
+
+		outValue.assign(c + 1, end);
+		return true;
+	}
+
+	void json_write_vec3(std::ostringstream& json, const char* key, const float* values)
+	{
+		json << "\t\"" << key << "\": [" << values[0] << ", " << values[1] << ", " << values[2] << "],\n";
+	}
+}
+
+namespace vkasset {
+
+	uint64_t hash_bytes(const void* data, size_t size, uint64_t seed)
+	{
+		constexpr uint64_t MULTIPLIER = 0x9E3779B97F4A7C15ull;
+
+		const uint8_t* bytes = (const uint8_t*)data;
+		uint64_t hash = seed ^ (size * MULTIPLIER);
+
+		//8 bytes per step, multiply and fold the high bits back so every input bit reaches every output bit
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8)
+		{
+			uint64_t word;
+			memcpy(&word, bytes + i, sizeof(word));
+			hash = (hash ^ word) * MULTIPLIER;
+			hash ^= hash >> 29;
+		}
+		for (; i < size; ++i)
+		{
+			hash = (hash ^ bytes[i]) * MULTIPLIER;
+			hash ^= hash >> 29;
+		}
+
+		hash ^= hash >> 32;
+		hash *= MULTIPLIER;
+		hash ^= hash >> 29;
+		return hash;
+	}
+
+	uint64_t get_bake_seed(BakeKind kind, AssetCompression compression)
+	{
+		//Mesh and packed mesh bakes of the same OBJ must not share a hash
+		return (BAKER_VERSION << 32) | ((uint64_t)kind << 8) | (uint64_t)compression;
+	}
+
+	bool save_asset(const char* path, const char type[4], const std::string& json, const void* blob, size_t blobSize, AssetCompression compression, uint64_t sourceHash)
+	{
+		std::vector<uint8_t> compressed;
+		const void* storedBlob = blob;
+		size_t storedSize = blobSize;
+
+		if (compression == AssetCompression::LZ4)
+		{
+			compressed.resize(vklz4::compress_bound(blobSize));
+			storedSize = vklz4::compress((const uint8_t*)blob, blobSize, compressed.data(), compressed.size());
+			storedBlob = compressed.data();
+		}
+
+		AssetFileHeader header = {};
+		header.magic = ASSET_MAGIC;
+		header.version = ASSET_VERSION;
+		memcpy(header.type, type, sizeof(header.type));
+		header.compression = compression;
+		header.sourceHash = sourceHash;
+		header.jsonOffset = sizeof(AssetFileHeader);
+		header.jsonSize = json.size();
+		header.blobOffset = align_up(header.jsonOffset + header.jsonSize);
+		header.blobSize = storedSize;
+		header.blobRawSize = blobSize;
+
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			std::cout << "Could not write asset " << path << std::endl;
+			return false;
+		}
+
+		const char padding[ASSET_ALIGNMENT] = {};
+
+		file.write((const char*)&header, sizeof(header));
+		file.write(json.data(), json.size());
+		file.write(padding, header.blobOffset - (header.jsonOffset + header.jsonSize));
+		file.write((const char*)storedBlob, storedSize);
+
+		return file.good();
+	}
+
+	bool read_asset(const MappedFile& file, AssetView& outView)
+	{
+		if (file.size() < sizeof(AssetFileHeader))
+			return false;
+
+		const AssetFileHeader* header = (const AssetFileHeader*)file.data();
+		if (header->magic != ASSET_MAGIC || header->version != ASSET_VERSION)
+			return false;
+
+		if (header->compression != AssetCompression::None && header->compression != AssetCompression::LZ4)
+			return false;
+
+		if (header->compression == AssetCompression::None && header->blobSize != header->blobRawSize)
+			return false;
+
+		//Written this way so corrupted sizes can't overflow past the check
+		uint64_t fileSize = file.size();
+		if (header->jsonOffset > fileSize || header->jsonSize > fileSize - header->jsonOffset
+			|| header->blobOffset > fileSize || header->blobSize > fileSize - header->blobOffset)
+			return false;
+
+		outView.header = header;
+		outView.json = (const char*)file.data() + header->jsonOffset;
+		outView.blob = file.data() + header->blobOffset;
+		return true;
+	}
+
+	bool unpack_blob(const AssetView& view, void* dst)
+	{
+		if (view.header->compression == AssetCompression::LZ4)
+		{
+			return vklz4::decompress(view.blob, view.header->blobSize, (uint8_t*)dst, view.header->blobRawSize);
+		}
+
+		memcpy(dst, view.blob, view.header->blobRawSize);
+		return true;
+	}
+
+	bool save_mesh(const char* path, const Mesh& mesh, AssetCompression compression, uint64_t sourceHash)
+	{
+		bool packed = mesh._vertexFormat == VertexFormat::Packed;
+
+		MeshInfo info = {};
+		info.vertexFormat = mesh._vertexFormat;
+		info.vertexCount = (uint32_t)(packed ? mesh._packedVertices.size() : mesh._vertices.size());
+		info.indexCount = (uint32_t)mesh._indices.size();
+		//Same rule as upload_mesh, 0xFFFF stays free for primitive restart
+		info.indexSize = info.vertexCount < 0xFFFF ? sizeof(uint16_t) : sizeof(uint32_t);
+		info.vertexDataSize = (uint64_t)info.vertexCount * get_vertex_stride(info.vertexFormat);
+		info.indexDataOffset = align_up(info.vertexDataSize);
+		info.indexDataSize = (uint64_t)info.indexCount * info.indexSize;
+
+		//Bounds come from Mesh::compute_bounds, run when the mesh was loaded
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			info.boundsMin[axis] = mesh._boundsMin[axis];
+			info.boundsMax[axis] = mesh._boundsMax[axis];
+			info.positionOffset[axis] = mesh._positionOffset[axis];
+			info.positionScale[axis] = mesh._positionScale[axis];
+		}
+		for (int i = 0; i < 4; ++i)
+		{
+			info.boundingSphere[i] = mesh._boundingSphere[i];
+		}
+
+		std::vector<uint8_t> blob(info.indexDataOffset + info.indexDataSize, 0);
+		memcpy(blob.data(), packed ? (const void*)mesh._packedVertices.data() : (const void*)mesh._vertices.data(), info.vertexDataSize);
+
+		if (info.indexSize == sizeof(uint16_t))
+		{
+			uint16_t* indices16 = (uint16_t*)(blob.data() + info.indexDataOffset);
+			for (size_t i = 0; i < mesh._indices.size(); ++i)
+			{
+				indices16[i] = (uint16_t)mesh._indices[i];
+			}
+		}
+		else
+		{
+			memcpy(blob.data() + info.indexDataOffset, mesh._indices.data(), info.indexDataSize);
+		}
+
+		//9 significant digits bring every float back bit exact
+		std::ostringstream json;
+		json << std::setprecision(9);
+		json << "{\n";
+		json << "\t\"vertexFormat\": \"" << (packed ? "packed" : "full") << "\",\n";
+		json << "\t\"vertexCount\": " << info.vertexCount << ",\n";
+		json << "\t\"indexCount\": " << info.indexCount << ",\n";
+		json << "\t\"indexSize\": " << info.indexSize << ",\n";
+		json << "\t\"vertexDataSize\": " << info.vertexDataSize << ",\n";
+		json << "\t\"indexDataOffset\": " << info.indexDataOffset << ",\n";
+		json << "\t\"indexDataSize\": " << info.indexDataSize << ",\n";
+		json_write_vec3(json, "boundsMin", info.boundsMin);
+		json_write_vec3(json, "boundsMax", info.boundsMax);
+		json << "\t\"boundingSphere\": [" << info.boundingSphere[0] << ", " << info.boundingSphere[1] << ", " << info.boundingSphere[2] << ", " << info.boundingSphere[3] << "],\n";
+		json_write_vec3(json, "positionOffset", info.positionOffset);
+		json_write_vec3(json, "positionScale", info.positionScale);
+
+		//First index, index count and error of each level, one after the other
+		std::vector<MeshLod> lods = mesh._lods;
+		if (lods.empty())
+		{
+			lods.push_back(MeshLod{ 0, info.indexCount, 0.f });
+		}
+		json << "\t\"lodCount\": " << lods.size() << ",\n";
+		json << "\t\"lods\": [";
+		for (size_t i = 0; i < lods.size(); ++i)
+		{
+			json << (i == 0 ? "" : ", ") << lods[i].firstIndex << ", " << lods[i].indexCount << ", " << lods[i].error;
+		}
+		json << "]\n";
+		json << "}\n";
+
+		return save_asset(path, "MESH", json.str(), blob.data(), blob.size(), compression, sourceHash);
+	}
+
+	bool read_mesh_info(const AssetView& view, MeshInfo& outInfo)
+	{
+		if (memcmp(view.header->type, "MESH", 4) != 0)
+			return false;
+
+		std::string json(view.json, view.header->jsonSize);
+
+		std::string vertexFormat;
+		bool valid = json_read_string(json, "vertexFormat", vertexFormat)
+			&& json_read(json, "vertexCount", outInfo.vertexCount)
+			&& json_read(json, "indexCount", outInfo.indexCount)
+			&& json_read(json, "indexSize", outInfo.indexSize)
+			&& json_read(json, "vertexDataSize", outInfo.vertexDataSize)
+			&& json_read(json, "indexDataOffset", outInfo.indexDataOffset)
+			&& json_read(json, "indexDataSize", outInfo.indexDataSize)
+			&& json_read_vec3(json, "boundsMin", outInfo.boundsMin)
+			&& json_read_vec3(json, "boundsMax", outInfo.boundsMax)
+			&& json_read_vec3(json, "positionOffset", outInfo.positionOffset)
+			&& json_read_vec3(json, "positionScale", outInfo.positionScale);
+
+		if (!valid || (vertexFormat != "full" && vertexFormat != "packed"))
+			return false;
+
+		outInfo.vertexFormat = vertexFormat == "packed" ? VertexFormat::Packed : VertexFormat::Full;
+
+		double sphere[4];
+		if (!json_read_numbers(json, "boundingSphere", sphere, 4))
+			return false;
+
+		for (int i = 0; i < 4; ++i)
+		{
+			outInfo.boundingSphere[i] = (float)sphere[i];
+		}
+
+		outInfo.lods.clear();
+		uint32_t lodCount = 0;
+		//Draws and the culling pass only hold MAX_LODS levels per mesh
+		if (!json_read(json, "lodCount", lodCount) || lodCount == 0 || lodCount > vklod::MAX_LODS)
+			return false;
+
+		std::vector<double> values(lodCount * 3);
+		if (!json_read_numbers(json, "lods", values.data(), (int)values.size()))
+			return false;
+
+		for (uint32_t i = 0; i < lodCount; ++i)
+		{
+			MeshLod lod;
+			lod.firstIndex = (uint32_t)values[i * 3 + 0];
+			lod.indexCount = (uint32_t)values[i * 3 + 1];
+			lod.error = (float)values[i * 3 + 2];
+			if (lod.firstIndex > outInfo.indexCount || lod.indexCount > outInfo.indexCount - lod.firstIndex)
+				return false;
+			outInfo.lods.push_back(lod);
+		}
+
+		//The described layout has to fit what the blob unpacks to
+		uint64_t rawSize = view.header->blobRawSize;
+		return (outInfo.indexSize == sizeof(uint16_t) || outInfo.indexSize == sizeof(uint32_t))
+			&& outInfo.vertexDataSize == (uint64_t)outInfo.vertexCount * get_vertex_stride(outInfo.vertexFormat)
+			&& outInfo.indexDataSize == (uint64_t)outInfo.indexCount * outInfo.indexSize
+			&& outInfo.vertexDataSize <= rawSize
+			&& outInfo.indexDataOffset <= rawSize && outInfo.indexDataSize <= rawSize - outInfo.indexDataOffset;
+	}
+
+	bool save_texture(const char* path, const void* pixels, uint32_t width, uint32_t height, AssetCompression compression, uint64_t sourceHash)
+	{
+		TextureInfo info = {};
+		info.width = width;
+		info.height = height;
+		info.dataSize = (uint64_t)width * height * 4;
+
+		std::ostringstream json;
+		json << "{\n";
+		json << "\t\"format\": \"RGBA8\",\n";
+		json << "\t\"width\": " << info.width << ",\n";
+		json << "\t\"height\": " << info.height << ",\n";
+		json << "\t\"dataSize\": " << info.dataSize << "\n";
+		json << "}\n";
+
+		return save_asset(path, "TEXI", json.str(), pixels, info.dataSize, compression, sourceHash);
+	}
+
+	bool read_texture_info(const AssetView& view, TextureInfo& outInfo)
+	{
+		if (memcmp(view.header->type, "TEXI", 4) != 0)
+			return false;
+
+		std::string json(view.json, view.header->jsonSize);
+
+		std::string format;
+		bool valid = json_read_string(json, "format", format)
+			&& json_read(json, "width", outInfo.width)
+			&& json_read(json, "height", outInfo.height)
+			&& json_read(json, "dataSize", outInfo.dataSize);
+
+		return valid && format == "RGBA8"
+			&& outInfo.dataSize == (uint64_t)outInfo.width * outInfo.height * 4
+			&& outInfo.dataSize == view.header->blobRawSize;
+	}
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <vk_mesh.h>
+#include <string>
+
+//Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile() { close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const char* path);
+	void close();
+
+	const uint8_t* data() const { return _data; }
+	size_t size() const { return _size; }
+
+private:
+	const uint8_t* _data{ nullptr };
+	size_t _size{ 0 };
+#ifdef _WIN32
+	void* _file{ nullptr };
+	void* _mapping{ nullptr };
+#else
+	int _fd{ -1 };
+#endif
+};
+
+namespace vkasset {
+
+	constexpr uint32_t ASSET_MAGIC = 0x53414B56; //"VKAS"
+	constexpr uint32_t ASSET_VERSION = 4;
+	//Sections start on this boundary so uncompressed blobs can be copied as they are
+	constexpr uint64_t ASSET_ALIGNMENT = 16;
+
+	enum class AssetCompression : uint32_t
+	{
+		None,
+		LZ4
+	};
+
+	//Baked asset file: this header, a JSON metadata object, then one binary blob.
+	//The JSON says what the blob holds, the blob is exactly what the GPU reads once decompressed.
+	struct AssetFileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		//"MESH" or "TEXI"
+		char type[4];
+		AssetCompression compression;
+		//Hash of the source the asset was baked from, 0 when it was not baked offline
+		uint64_t sourceHash;
+
+		uint64_t jsonOffset;
+		uint64_t jsonSize;
+		uint64_t blobOffset;
+		//Stored size, compressed or not
+		uint64_t blobSize;
+		uint64_t blobRawSize;
+	};
+
+	//Points into a mapped asset, valid as long as the mapping is
+	struct AssetView
+	{
+		const AssetFileHeader* header;
+		const char* json;
+		const uint8_t* blob;
+	};
+
+	struct MeshInfo
+	{
+		VertexFormat vertexFormat;
+		uint32_t vertexCount;
+		uint32_t indexCount;
+		//2 or 4 bytes
+		uint32_t indexSize;
+		//Vertices start the raw blob, indices follow at indexDataOffset
+		uint64_t vertexDataSize;
+		uint64_t indexDataOffset;
+		uint64_t indexDataSize;
+		float boundsMin[3];
+		float boundsMax[3];
+		//xyz center, w radius
+		float boundingSphere[4];
+		//Dequantization of packed positions, see Mesh::get_dequantization_matrix
+		float positionOffset[3];
+		float positionScale[3];
+		//Index ranges of the detail levels, at least one. Meshes without generated levels get a single one over every index
+		std::vector<MeshLod> lods;
+	};
+
+	//Tightly packed RGBA8 pixels
+	struct TextureInfo
+	{
+		uint32_t width;
+		uint32_t height;
+		uint64_t dataSize;
+	};
+
+	//Bump when the baked output changes for the same input, it invalidates every earlier bake
+	constexpr uint64_t BAKER_VERSION = 3;
+
+	enum class BakeKind : uint32_t
+	{
+		Mesh,
+		PackedMesh,
+		Texture
+	};
+
+	//Fast 64 bit hash for change detection, not meant to be cryptographic
+	uint64_t hash_bytes(const void* data, size_t size, uint64_t seed = 0);
+
+	//Seed of the sourceHash of a bake, so that loaders can check a bake against its source exactly like asset_baker does
+	uint64_t get_bake_seed(BakeKind kind, AssetCompression compression);
+
+	bool save_asset(const char* path, const char type[4], const std::string& json, const void* blob, size_t blobSize, AssetCompression compression, uint64_t sourceHash);
+
+	//Checks the header and the section ranges against the file before handing out pointers
+	bool read_asset(const MappedFile& file, AssetView& outView);
+
+	//Writes the raw blob to dst, which holds header->blobRawSize bytes
+	bool unpack_blob(const AssetView& view, void* dst);
+
+	//Writes the mesh in its current vertex format, indices are narrowed to 16 bit when possible
+	bool save_mesh(const char* path, const Mesh& mesh, AssetCompression compression, uint64_t sourceHash);
+	bool read_mesh_info(const AssetView& view, MeshInfo& outInfo);
+
+	bool save_texture(const char* path, const void* pixels, uint32_t width, uint32_t height, AssetCompression compression, uint64_t sourceHash);
+	bool read_texture_info(const AssetView& view, TextureInfo& outInfo);
+}
@@ -0,0 +1,444 @@
+#include "vk_bvh.h"
+#include "vk_trace.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include <glm/common.hpp>
+
+namespace {
+
+	//Half the surface area, the insertion cost only compares them
+	float area(const AABB& box)
+	{
+		glm::vec3 size = box.max - box.min;
+		return size.x * size.y + size.y * size.z + size.z * size.x;
+	}
+
+	bool contains(const AABB& outer, const AABB& inner)
+	{
+		return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.min.z <= inner.min.z
+			&& inner.max.x <= outer.max.x && inner.max.y <= outer.max.y && inner.max.z <= outer.max.z;
+	}
+
+	//Spreads the low 10 bits of x three bits apart
+	uint32_t spread_bits(uint32_t x)
+	{
+		x &= 0x3FF;
+		x = (x | (x << 16)) & 0x030000FF;
+		x = (x | (x << 8)) & 0x0300F00F;
+		x = (x | (x << 4)) & 0x030C30C3;
+		x = (x | (x << 2)) & 0x09249249;
+		return x;
+	}
+
+	AABB grow(const AABB& box, float margin)
+	{
+		return AABB{ box.min - glm::vec3(margin), box.max + glm::vec3(margin) };
+	}
+}
+
+int32_t DynamicAabbTree::allocate_node()
+{
+	if (_freeList == NULL_NODE)
+	{
+		_nodes.emplace_back();
+		_nodes.back().parent = NULL_NODE;
+		_freeList = (int32_t)_nodes.size() - 1;
+	}
+
+	int32_t node = _freeList;
+	_freeList = _nodes[node].parent;
+
+	_nodes[node].parent = NULL_NODE;
+	_nodes[node].child1 = NULL_NODE;
+	_nodes[node].child2 = NULL_NODE;
+	_nodes[node].height = 0;
+	_nodes[node].userData = 0;
+	return node;
+}
+
+void DynamicAabbTree::free_node(int32_t node)
+{
+	_nodes[node].parent = _freeList;
+	_nodes[node].height = -1;
+	_freeList = node;
+}
+
+int32_t DynamicAabbTree::create_proxy(const AABB& box, uint32_t userData)
+{
+	int32_t proxy = allocate_node();
+	_nodes[proxy].box = grow(box, _margin);
+	_nodes[proxy].userData = userData;
+
+	insert_leaf(proxy);
+	_proxyCount++;
+	return proxy;
+}
+
+void DynamicAabbTree::create_proxies(const AABB* boxes, const uint32_t* userData, size_t count, int32_t* outProxies)
+{
+	VK_TRACE_ZONE("DynamicAabbTree::create_proxies");
+
+	if (count == 0)
+		return;
+
+	AABB bounds = boxes[0];
+	for (size_t i = 1; i < count; ++i)
+	{
+		bounds = vkbvh::merge(bounds, boxes[i]);
+	}
+	glm::vec3 scale = 1023.f / glm::max(bounds.max - bounds.min, glm::vec3(1e-6f));
+
+	//Box centers quantized to 10 bits per axis
+	std::vector<std::pair<uint32_t, uint32_t>> order(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		glm::vec3 cell = ((boxes[i].min + boxes[i].max) * 0.5f - bounds.min) * scale;
+		order[i] = { spread_bits((uint32_t)cell.x) | (spread_bits((uint32_t)cell.y) << 1) | (spread_bits((uint32_t)cell.z) << 2), (uint32_t)i };
+	}
+	std::sort(order.begin(), order.end());
+
+	_nodes.reserve(_nodes.size() + 2 * count);
+	for (const auto& entry : order)
+	{
+		outProxies[entry.second] = create_proxy(boxes[entry.second], userData[entry.second]);
+	}
+}
+
+void DynamicAabbTree::destroy_proxy(int32_t proxy)
+{
+	assert(_nodes[proxy].is_leaf());
+
+	remove_leaf(proxy);
+	free_node(proxy);
+	_proxyCount--;
+}
+
+bool DynamicAabbTree::move_proxy(int32_t proxy, const AABB& box)
+{
+	assert(_nodes[proxy].is_leaf());
+
+	AABB& fatBox = _nodes[proxy].box;
+	if (contains(fatBox, box))
+		return false;
+
+	//Far moves would leave long thin ancestors behind, a fresh insertion finds a better sibling
+	bool reinsert = !vkbvh::overlaps(fatBox, box);
+	fatBox = grow(box, _margin);
+
+	if (reinsert)
+	{
+		remove_leaf(proxy);
+		insert_leaf(proxy);
+	}
+	else
+	{
+		//The topology stays, ancestors only grow until one already holds the new box.
+		//They never shrink here, a little looseness is cheaper than walking to the root every move.
+		const AABB& newBox = _nodes[proxy].box;
+		for (int32_t node = _nodes[proxy].parent; node != NULL_NODE && !contains(_nodes[node].box, newBox); node = _nodes[node].parent)
+		{
+			_nodes[node].box = vkbvh::merge(_nodes[node].box, newBox);
+		}
+	}
+	return true;
+}
+
+void DynamicAabbTree::insert_leaf(int32_t leaf)
+{
+	if (_root == NULL_NODE)
+	{
+		_root = leaf;
+		_nodes[leaf].parent = NULL_NODE;
+		return;
+	}
+
+	//Walk down towards the sibling that grows the total surface area the least
+	AABB leafBox = _nodes[leaf].box;
+	int32_t index = _root;
+	while (!_nodes[index].is_leaf())
+	{
+		const Node& node = _nodes[index];
+
+		float nodeArea = area(node.box);
+		float combinedArea = area(vkbvh::merge(node.box, leafBox));
+
+		//Pairing with this node makes a new parent, descending grows this node's box for every level below
+		float cost = 2.f * combinedArea;
+		float inheritanceCost = 2.f * (combinedArea - nodeArea);
+
+		auto descend_cost = [&](int32_t child) {
+			const AABB& childBox = _nodes[child].box;
+			float merged = area(vkbvh::merge(childBox, leafBox));
+			return _nodes[child].is_leaf() ? merged + inheritanceCost : merged - area(childBox) + inheritanceCost;
+		};
+		float cost1 = descend_cost(node.child1);
+		float cost2 = descend_cost(node.child2);
+
+		if (cost < cost1 && cost < cost2)
+			break;
+
+		index = cost1 < cost2 ? node.child1 : node.child2;
+	}
+
+	int32_t sibling = index;
+	int32_t oldParent = _nodes[sibling].parent;
+	int32_t newParent = allocate_node();
+	_nodes[newParent].parent = oldParent;
+	_nodes[newParent].box = vkbvh::merge(leafBox, _nodes[sibling].box);
+	_nodes[newParent].height = _nodes[sibling].height + 1;
+	_nodes[newParent].child1 = sibling;
+	_nodes[newParent].child2 = leaf;
+	_nodes[sibling].parent = newParent;
+	_nodes[leaf].parent = newParent;
+
+	if (oldParent == NULL_NODE)
+	{
+		_root = newParent;
+	}
+	else if (_nodes[oldParent].child1 == sibling)
+	{
+		_nodes[oldParent].child1 = newParent;
+	}
+	else
+	{
+		_nodes[oldParent].child2 = newParent;
+	}
+
+	fix_upwards(newParent);
+}
+
+void DynamicAabbTree::remove_leaf(int32_t leaf)
+{
+	if (leaf == _root)
+	{
+		_root = NULL_NODE;
+		return;
+	}
+
+	//The parent goes away and the sibling takes its place
+	int32_t parent = _nodes[leaf].parent;
+	int32_t grandParent = _nodes[parent].parent;
+	int32_t sibling = _nodes[parent].child1 == leaf ? _nodes[parent].child2 : _nodes[parent].child1;
+
+	free_node(parent);
+	_nodes[leaf].parent = NULL_NODE;
+
+	if (grandParent == NULL_NODE)
+	{
+		_root = sibling;
+		_nodes[sibling].parent = NULL_NODE;
+		return;
+	}
+
+	if (_nodes[grandParent].child1 == parent)
+	{
+		_nodes[grandParent].child1 = sibling;
+	}
+	else
+	{
+		_nodes[grandParent].child2 = sibling;
+	}
+	_nodes[sibling].parent = grandParent;
+
+	fix_upwards(grandParent);
+}
+
+void DynamicAabbTree::fix_upwards(int32_t node)
+{
+	while (node != NULL_NODE)
+	{
+		node = balance(node);
+
+		Node& current = _nodes[node];
+		const Node& child1 = _nodes[current.child1];
+		const Node& child2 = _nodes[current.child2];
+		current.height = 1 + std::max(child1.height, child2.height);
+		current.box = vkbvh::merge(child1.box, child2.box);
+
+		node = current.parent;
+	}
+}
+
+int32_t DynamicAabbTree::balance(int32_t iA)
+{
+	Node& A = _nodes[iA];
+	if (A.is_leaf() || A.height < 2)
+		return iA;
+
+	int32_t iB = A.child1;
+	int32_t iC = A.child2;
+	Node& B = _nodes[iB];
+	Node& C = _nodes[iC];
+
+	int32_t heightDifference = C.height - B.height;
+
+	//Rotate C up: A takes C's shorter child, C takes A's place
+	if (heightDifference > 1)
+	{
+		int32_t iF = C.child1;
+		int32_t iG = C.child2;
+		Node& F = _nodes[iF];
+		Node& G = _nodes[iG];
+
+		C.child1 = iA;
+		C.parent = A.parent;
+		A.parent = iC;
+
+		if (C.parent == NULL_NODE)
+		{
+			_root = iC;
+		}
+		else if (_nodes[C.parent].child1 == iA)
+		{
+			_nodes[C.parent].child1 = iC;
+		}
+		else
+		{
+			_nodes[C.parent].child2 = iC;
+		}
+
+		if (F.height > G.height)
+		{
+			C.child2 = iF;
+			A.child2 = iG;
+			G.parent = iA;
+			A.box = vkbvh::merge(B.box, G.box);
+			C.box = vkbvh::merge(A.box, F.box);
+			A.height = 1 + std::max(B.height, G.height);
+			C.height = 1 + std::max(A.height, F.height);
+		}
+		else
+		{
+			C.child2 = iG;
+			A.child2 = iF;
+			F.parent = iA;
+			A.box = vkbvh::merge(B.box, F.box);
+			C.box = vkbvh::merge(A.box, G.box);
+			A.height = 1 + std::max(B.height, F.height);
+			C.height = 1 + std::max(A.height, G.height);
+		}
+		return iC;
+	}
+
+	//Rotate B up, the mirror case
+	if (heightDifference < -1)
+	{
+		int32_t iD = B.child1;
+		int32_t iE = B.child2;
+		Node& D = _nodes[iD];
+		Node& E = _nodes[iE];
+
+		B.child1 = iA;
+		B.parent = A.parent;
+		A.parent = iB;
+
+		if (B.parent == NULL_NODE)
+		{
+			_root = iB;
+		}
+		else if (_nodes[B.parent].child1 == iA)
+		{
+			_nodes[B.parent].child1 = iB;
+		}
+		else
+		{
+			_nodes[B.parent].child2 = iB;
+		}
+
+		if (D.height > E.height)
+		{
+			B.child2 = iD;
+			A.child1 = iE;
+			E.parent = iA;
+			A.box = vkbvh::merge(C.box, E.box);
+			B.box = vkbvh::merge(A.box, D.box);
+			A.height = 1 + std::max(C.height, E.height);
+			B.height = 1 + std::max(A.height, D.height);
+		}
+		else
+		{
+			B.child2 = iE;
+			A.child1 = iD;
+			D.parent = iA;
+			A.box = vkbvh::merge(C.box, D.box);
+			B.box = vkbvh::merge(A.box, E.box);
+			A.height = 1 + std::max(C.height, D.height);
+			B.height = 1 + std::max(A.height, E.height);
+		}
+		return iB;
+	}
+
+	return iA;
+}
+
+uint32_t DynamicAabbTree::cull(const Frustum& frustum, std::vector<uint32_t>& outUserData) const
+{
+	VK_TRACE_ZONE("DynamicAabbTree::cull");
+
+	size_t firstOutput = outUserData.size();
+	if (_root == NULL_NODE)
+		return 0;
+
+	//Each entry carries the planes its parent still straddled
+	struct Entry
+	{
+		int32_t node;
+		uint32_t planeMask;
+	};
+	std::vector<Entry> stack;
+	stack.reserve(64);
+	stack.push_back({ _root, 0x3F });
+
+	while (!stack.empty())
+	{
+		Entry entry = stack.back();
+		stack.pop_back();
+		const Node& node = _nodes[entry.node];
+
+		uint32_t planeMask = entry.planeMask;
+		if (planeMask != 0)
+		{
+			glm::vec3 center = (node.box.min + node.box.max) * 0.5f;
+			glm::vec3 extent = (node.box.max - node.box.min) * 0.5f;
+
+			bool outside = false;
+			for (uint32_t p = 0; p < 6; ++p)
+			{
+				if ((planeMask & (1u << p)) == 0)
+					continue;
+
+				//Signed distance of the center against how far the box reaches along the normal
+				const glm::vec4& plane = frustum.planes[p];
+				float distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+				float reach = std::abs(plane.x) * extent.x + std::abs(plane.y) * extent.y + std::abs(plane.z) * extent.z;
+
+				if (distance < -reach)
+				{
+					outside = true;
+					break;
+				}
+				if (distance >= reach)
+				{
+					planeMask &= ~(1u << p);
+				}
+			}
+			if (outside)
+				continue;
+		}
+
+		if (node.is_leaf())
+		{
+			outUserData.push_back(node.userData);
+		}
+		else
+		{
+			stack.push_back({ node.child1, planeMask });
+			stack.push_back({ node.child2, planeMask });
+		}
+	}
+
+	return (uint32_t)(outUserData.size() - firstOutput);
+}
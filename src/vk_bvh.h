@@ -0,0 +1,169 @@
+#pragma once
+
+#include <vk_culling.h>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <glm/vec3.hpp>
+#include <glm/common.hpp>
+
+//Dynamic bounding volume hierarchy over fat boxes, kept balanced with AVL rotations as leaves come and go.
+//Proxies are node indices, they stay valid until destroyed.
+class DynamicAabbTree
+{
+public:
+	static constexpr int32_t NULL_NODE = -1;
+
+	//Leaf boxes are grown by this much on every side, small moves stay inside and cost nothing
+	float _margin{ 0.1f };
+
+	int32_t create_proxy(const AABB& box, uint32_t userData);
+	//Same as creating them one by one, but inserted along a Morton curve: nodes close in space end up close in memory
+	//and each insertion descends next to the previous one. outProxies[i] belongs to boxes[i].
+	void create_proxies(const AABB* boxes, const uint32_t* userData, size_t count, int32_t* outProxies);
+	void destroy_proxy(int32_t proxy);
+
+	//Grows the ancestors when the box left its fat box, or reinserts the leaf when it moved clear of it.
+	//Returns false when the fat box still held it and nothing changed.
+	bool move_proxy(int32_t proxy, const AABB& box);
+
+	uint32_t get_user_data(int32_t proxy) const { return _nodes[proxy].userData; }
+	const AABB& get_fat_aabb(int32_t proxy) const { return _nodes[proxy].box; }
+
+	//Appends the user data of every leaf touching the frustum and returns how many were added.
+	//Planes a node is fully inside of are not tested again below it, fully inside subtrees are taken whole.
+	uint32_t cull(const Frustum& frustum, std::vector<uint32_t>& outUserData) const;
+
+	//Calls callback(userData) for every leaf overlapping the box
+	template<typename F>
+	void query_box(const AABB& box, F&& callback) const;
+
+	//Calls callback(userData, entryDistance) for every leaf box the ray enters before maxDistance.
+	//The callback returns the new maxDistance: the entry distance to keep only closer hits, 0 to stop.
+	template<typename F>
+	void query_ray(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, F&& callback) const;
+
+	int32_t get_height() const { return _root == NULL_NODE ? 0 : _nodes[_root].height; }
+	size_t get_proxy_count() const { return _proxyCount; }
+
+private:
+	struct Node
+	{
+		AABB box;
+		//Parent while in the tree, next free node once released
+		int32_t parent;
+		int32_t child1;
+		int32_t child2;
+		//Leaves are 0, free nodes -1
+		int32_t height;
+		uint32_t userData;
+
+		bool is_leaf() const { return child1 == NULL_NODE; }
+	};
+
+	int32_t allocate_node();
+	void free_node(int32_t node);
+
+	void insert_leaf(int32_t leaf);
+	void remove_leaf(int32_t leaf);
+	//Recomputes boxes and heights from node up to the root, rotating where the heights drifted apart
+	void fix_upwards(int32_t node);
+	int32_t balance(int32_t node);
+
+	std::vector<Node> _nodes;
+	int32_t _root{ NULL_NODE };
+	int32_t _freeList{ NULL_NODE };
+	size_t _proxyCount{ 0 };
+};
+
+namespace vkbvh {
+
+	inline AABB merge(const AABB& a, const AABB& b)
+	{
+		return AABB{ glm::min(a.min, b.min), glm::max(a.max, b.max) };
+	}
+
+	inline bool overlaps(const AABB& a, const AABB& b)
+	{
+		return a.min.x <= b.max.x && a.min.y <= b.max.y && a.min.z <= b.max.z
+			&& b.min.x <= a.max.x && b.min.y <= a.max.y && b.min.z <= a.max.z;
+	}
+
+	//Slab test, the entry distance goes to outDistance (0 when the origin is inside)
+	inline bool intersect_ray(const AABB& box, const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance, float& outDistance)
+	{
+		glm::vec3 t0 = (box.min - origin) * inverseDirection;
+		glm::vec3 t1 = (box.max - origin) * inverseDirection;
+		glm::vec3 slabEnter = glm::min(t0, t1);
+		glm::vec3 slabExit = glm::max(t0, t1);
+
+		float enter = std::max(std::max(slabEnter.x, slabEnter.y), std::max(slabEnter.z, 0.f));
+		float exit = std::min(std::min(slabExit.x, slabExit.y), std::min(slabExit.z, maxDistance));
+		outDistance = enter;
+		return enter <= exit;
+	}
+}
+
+template<typename F>
+void DynamicAabbTree::query_box(const AABB& box, F&& callback) const
+{
+	if (_root == NULL_NODE)
+		return;
+
+	std::vector<int32_t> stack;
+	stack.reserve(64);
+	stack.push_back(_root);
+	while (!stack.empty())
+	{
+		const Node& node = _nodes[stack.back()];
+		stack.pop_back();
+
+		if (!vkbvh::overlaps(node.box, box))
+			continue;
+
+		if (node.is_leaf())
+		{
+			callback(node.userData);
+		}
+		else
+		{
+			stack.push_back(node.child1);
+			stack.push_back(node.child2);
+		}
+	}
+}
+
+template<typename F>
+void DynamicAabbTree::query_ray(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, F&& callback) const
+{
+	if (_root == NULL_NODE)
+		return;
+
+	//Infinite components for axis aligned rays are fine, the slabs come out as +-inf
+	glm::vec3 inverseDirection = 1.f / direction;
+
+	std::vector<int32_t> stack;
+	stack.reserve(64);
+	stack.push_back(_root);
+	while (!stack.empty())
+	{
+		const Node& node = _nodes[stack.back()];
+		stack.pop_back();
+
+		float distance;
+		if (!vkbvh::intersect_ray(node.box, origin, inverseDirection, maxDistance, distance))
+			continue;
+
+		if (node.is_leaf())
+		{
+			maxDistance = callback(node.userData, distance);
+			if (maxDistance <= 0.f)
+				return;
+		}
+		else
+		{
+			stack.push_back(node.child1);
+			stack.push_back(node.child2);
+		}
+	}
+}
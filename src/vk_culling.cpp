@@ -0,0 +1,121 @@
+#include "vk_culling.h"
+#include "vk_trace.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <xmmintrin.h>
+
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/matrix.hpp>
+
+void SphereArray::resize(size_t sphereCount)
+{
+	count = sphereCount;
+
+	//Padding lanes have a hugely negative radius, no plane test can pass them
+	size_t padded = (sphereCount + 3) & ~(size_t)3;
+	centerX.resize(padded, 0.f);
+	centerY.resize(padded, 0.f);
+	centerZ.resize(padded, 0.f);
+	radius.resize(padded, -FLT_MAX);
+	std::fill(radius.begin() + sphereCount, radius.end(), -FLT_MAX);
+}
+
+void SphereArray::set(size_t index, const glm::vec4& sphere)
+{
+	centerX[index] = sphere.x;
+	centerY[index] = sphere.y;
+	centerZ[index] = sphere.z;
+	radius[index] = sphere.w;
+}
+
+namespace vkcull {
+
+	Frustum extract_frustum(const glm::mat4& matrix)
+	{
+		Frustum frustum;
+
+		glm::mat4 m = glm::transpose(matrix);
+		frustum.planes[0] = m[3] + m[0];
+		frustum.planes[1] = m[3] - m[0];
+		frustum.planes[2] = m[3] + m[1];
+		frustum.planes[3] = m[3] - m[1];
+		frustum.planes[4] = m[2];
+		frustum.planes[5] = m[3] - m[2];
+
+		for (glm::vec4& plane : frustum.planes)
+		{
+			plane /= glm::length(glm::vec3(plane));
+		}
+		return frustum;
+	}
+
+	glm::vec4 transform_sphere(const glm::mat4& transform, const glm::vec4& sphere)
+	{
+		glm::vec3 center = glm::vec3(transform * glm::vec4(glm::vec3(sphere), 1.f));
+		float scale = std::max({ glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2])) });
+		return glm::vec4(center, sphere.w * scale);
+	}
+
+	AABB transform_aabb(const glm::mat4& transform, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+	{
+		glm::vec3 center = glm::vec3(transform * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.f));
+		glm::vec3 extent = (boundsMax - boundsMin) * 0.5f;
+
+		//Each world axis extent is the mesh extents projected on that row of the rotation-scale part
+		glm::vec3 worldExtent = glm::abs(glm::vec3(transform[0])) * extent.x
+			+ glm::abs(glm::vec3(transform[1])) * extent.y
+			+ glm::abs(glm::vec3(transform[2])) * extent.z;
+
+		return AABB{ center - worldExtent, center + worldExtent };
+	}
+
+	uint32_t cull_spheres(const Frustum& frustum, const SphereArray& spheres, uint32_t* outVisible)
+	{
+		VK_TRACE_ZONE("vkcull::cull_spheres");
+
+		__m128 planeX[6];
+		__m128 planeY[6];
+		__m128 planeZ[6];
+		__m128 planeW[6];
+		for (int p = 0; p < 6; ++p)
+		{
+			planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+			planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+			planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+			planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+		}
+
+		const __m128 signBit = _mm_set1_ps(-0.f);
+
+		uint32_t visibleCount = 0;
+		for (size_t i = 0; i < spheres.count; i += 4)
+		{
+			__m128 x = _mm_loadu_ps(&spheres.centerX[i]);
+			__m128 y = _mm_loadu_ps(&spheres.centerY[i]);
+			__m128 z = _mm_loadu_ps(&spheres.centerZ[i]);
+			__m128 negativeRadius = _mm_xor_ps(_mm_loadu_ps(&spheres.radius[i]), signBit);
+
+			//Visible unless the center lies further than the radius behind some plane
+			__m128 inside = _mm_cmpgt_ps(
+				_mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[0], x), _mm_mul_ps(planeY[0], y)), _mm_add_ps(_mm_mul_ps(planeZ[0], z), planeW[0])),
+				negativeRadius);
+			for (int p = 1; p < 6; ++p)
+			{
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y)), _mm_add_ps(_mm_mul_ps(planeZ[p], z), planeW[p]));
+				inside = _mm_and_ps(inside, _mm_cmpgt_ps(distance, negativeRadius));
+			}
+
+			//Branchless compaction: every lane is written, only visible ones advance the output
+			int mask = _mm_movemask_ps(inside);
+			for (uint32_t lane = 0; lane < 4; ++lane)
+			{
+				outVisible[visibleCount] = (uint32_t)i + lane;
+				visibleCount += (mask >> lane) & 1;
+			}
+		}
+
+		return visibleCount;
+	}
+}
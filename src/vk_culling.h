@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+
+//Normalized planes, xyz normal pointing inside, w distance: left, right, bottom, top, near, far
+struct Frustum
+{
+	glm::vec4 planes[6];
+};
+
+//Axis aligned box, min and max corners
+struct AABB
+{
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+//Bounding spheres as a structure of arrays, padded to a multiple of four with spheres that are never visible
+struct SphereArray
+{
+	std::vector<float> centerX;
+	std::vector<float> centerY;
+	std::vector<float> centerZ;
+	std::vector<float> radius;
+	size_t count{ 0 };
+
+	void resize(size_t sphereCount);
+	void set(size_t index, const glm::vec4& sphere);
+};
+
+//What the culling stage did in one frame
+struct CullStats
+{
+	uint32_t visible{ 0 };
+	uint32_t culled{ 0 };
+	double cullMs{ 0.0 };
+};
+
+namespace vkcull {
+
+	//Planes straight from the clip matrix rows (Gribb/Hartmann), with Vulkan's 0..w depth range.
+	//They come out in whatever space the matrix takes as input.
+	Frustum extract_frustum(const glm::mat4& matrix);
+
+	//Bounding sphere of a mesh sphere moved by transform, the radius grows with the largest axis scale
+	glm::vec4 transform_sphere(const glm::mat4& transform, const glm::vec4& sphere);
+
+	//Box around a mesh space box moved by transform (Arvo), exact for the rotated corners
+	AABB transform_aabb(const glm::mat4& transform, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+	//Writes the index of every sphere touching the frustum to outVisible and returns how many there are.
+	//outVisible needs room for the padded count (centerX.size()). Four spheres are tested against all six planes per SSE iteration.
+	uint32_t cull_spheres(const Frustum& frustum, const SphereArray& spheres, uint32_t* outVisible);
+}
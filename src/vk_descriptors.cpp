@@ -0,0 +1,108 @@
+#include "vk_descriptors.h"
+#include "vk_trace.h"
+
+void DescriptorAllocator::init(VkDevice device, uint32_t setsPerPool, const DescriptorPoolSizes& poolSizes)
+{
+	_device = device;
+	_setsPerPool = setsPerPool;
+	_poolSizes = poolSizes;
+}
+
+void DescriptorAllocator::cleanup()
+{
+	if (_currentPool != VK_NULL_HANDLE)
+	{
+		_usedPools.push_back(_currentPool);
+		_currentPool = VK_NULL_HANDLE;
+	}
+
+	for (VkDescriptorPool pool : _usedPools)
+	{
+		vkDestroyDescriptorPool(_device, pool, nullptr);
+	}
+	for (VkDescriptorPool pool : _freePools)
+	{
+		vkDestroyDescriptorPool(_device, pool, nullptr);
+	}
+	_usedPools.clear();
+	_freePools.clear();
+}
+
+VkDescriptorSet DescriptorAllocator::allocate(VkDescriptorSetLayout layout)
+{
+	if (_currentPool == VK_NULL_HANDLE)
+	{
+		_currentPool = grab_pool();
+	}
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = _currentPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &layout;
+
+	VkDescriptorSet set;
+	VkResult result = vkAllocateDescriptorSets(_device, &allocInfo, &set);
+
+	//Pools don't say ahead of time whether a set still fits, a full one is retired and the set goes into the next
+	if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL)
+	{
+		_usedPools.push_back(_currentPool);
+		_currentPool = grab_pool();
+		allocInfo.descriptorPool = _currentPool;
+
+		result = vkAllocateDescriptorSets(_device, &allocInfo, &set);
+	}
+
+	//A set that doesn't fit an empty pool never will
+	VK_CHECK(result);
+	return set;
+}
+
+void DescriptorAllocator::reset_pools()
+{
+	if (_currentPool != VK_NULL_HANDLE)
+	{
+		_usedPools.push_back(_currentPool);
+		_currentPool = VK_NULL_HANDLE;
+	}
+
+	//Resetting a pool frees all its sets at once, far cheaper than freeing them one by one
+	for (VkDescriptorPool pool : _usedPools)
+	{
+		VK_CHECK(vkResetDescriptorPool(_device, pool, 0));
+		_freePools.push_back(pool);
+	}
+	_usedPools.clear();
+}
+
+VkDescriptorPool DescriptorAllocator::grab_pool()
+{
+	if (!_freePools.empty())
+	{
+		VkDescriptorPool pool = _freePools.back();
+		_freePools.pop_back();
+		return pool;
+	}
+
+	VK_TRACE_ZONE("DescriptorAllocator::grab_pool");
+
+	std::vector<VkDescriptorPoolSize> sizes;
+	sizes.reserve(_poolSizes.sizes.size());
+	for (const auto& size : _poolSizes.sizes)
+	{
+		sizes.push_back({ size.first, (uint32_t)(size.second * _setsPerPool) });
+	}
+
+	//No FREE_DESCRIPTOR_SET flag, sets only go away with the whole pool
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.flags = 0;
+	poolInfo.maxSets = _setsPerPool;
+	poolInfo.poolSizeCount = (uint32_t)sizes.size();
+	poolInfo.pPoolSizes = sizes.data();
+
+	VkDescriptorPool pool;
+	VK_CHECK(vkCreateDescriptorPool(_device, &poolInfo, nullptr, &pool));
+	return pool;
+}
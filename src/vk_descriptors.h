@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vk_types.h>
+#include <vector>
+#include <utility>
+
+//Descriptors of each type a pool holds, per set it holds
+struct DescriptorPoolSizes
+{
+	std::vector<std::pair<VkDescriptorType, float>> sizes = {
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 8.f },
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2.f },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2.f },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.f }
+	};
+};
+
+//Hands out descriptor sets from a list of pools, a new pool is created or recycled whenever the current one runs out.
+//Sets are never freed one by one: reset_pools() recycles every pool at once, for sets that live a single frame.
+class DescriptorAllocator
+{
+public:
+	void init(VkDevice device, uint32_t setsPerPool = 64, const DescriptorPoolSizes& poolSizes = DescriptorPoolSizes{});
+	void cleanup();
+
+	//Almost always a single vkAllocateDescriptorSets, the retry in a fresh pool only happens once the current one is full
+	VkDescriptorSet allocate(VkDescriptorSetLayout layout);
+
+	//Every set handed out so far becomes invalid, only call once the GPU is done with them
+	void reset_pools();
+
+private:
+	VkDescriptorPool grab_pool();
+
+	VkDevice _device{ VK_NULL_HANDLE };
+	uint32_t _setsPerPool{ 0 };
+	DescriptorPoolSizes _poolSizes;
+
+	VkDescriptorPool _currentPool{ VK_NULL_HANDLE };
+	//Full pools, recycled by reset_pools()
+	std::vector<VkDescriptorPool> _usedPools;
+	//Empty pools waiting to be grabbed
+	std::vector<VkDescriptorPool> _freePools;
+};
@@ -5,9 +5,18 @@
 
 #include <vk_types.h>
 #include <vk_initializers.h>
+#include <vk_trace.h>
+#include <vk_mesh_opt.h>
+#include <vk_asset.h>
+#include <vk_obj.h>
+#include <vk_lod.h>
+#include <vk_transform.h>
 
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 
 //Simplify initialization setup
 #include "VkBootstrap.h"
@@ -17,26 +26,31 @@
 
 #include <glm/gtx/transform.hpp>
 
-#define VK_CHECK(x) \
-	do \
-	{ \
-		VkResult err = x; \
-		if (err) \
-		{ \
-			std::cout << "Detected Vulkan error: " << err << std::endl; \
-			abort(); \
-		} \
-	} \
-	while(0) \
+//Vertical field of view of every projection the engine builds
+constexpr float CAMERA_FOV = 70.f;
 
 void VulkanEngine::init()
 {
-	// We initialize SDL and create a window with it. 
-	SDL_Init(SDL_INIT_VIDEO);
+	VK_TRACE_ZONE("init");
 
-	SDL_WindowFlags window_flags = (SDL_WindowFlags)(SDL_WINDOW_VULKAN);
+	//Headless boxes have no display at all, so SDL video must not even be initialized
+	if (!_headless)
+	{
+		// We initialize SDL and create a window with it. 
+		SDL_Init(SDL_INIT_VIDEO);
+
+		SDL_WindowFlags window_flags = (SDL_WindowFlags)(SDL_WINDOW_VULKAN);
 	
-	_window = SDL_CreateWindow("Vulkan Engine", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, _windowExtent.width, _windowExtent.height, window_flags);
+		_window = SDL_CreateWindow("Vulkan Engine", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, _windowExtent.width, _windowExtent.height, window_flags);
+	}
+
+	//Less than 2 frames would serialize CPU and GPU again
+	_framesInFlight = std::clamp(_framesInFlight, 2u, MAX_FRAMES_IN_FLIGHT);
+
+	//Both phases are object culling dispatches
+	_gpuCulling = _gpuCulling || _occlusionCulling;
+
+	_jobs.init();
 
 	init_vulkan();
 	init_swapchain();
@@ -44,8 +58,22 @@ void VulkanEngine::init()
 	init_default_renderpass();
 	init_framebuffers();
 	init_sync_structures();
+	init_pipeline_cache();
+	init_descriptors();
 	init_pipelines();
 	load_meshes();
+	init_scene();
+
+	if (_gpuCulling)
+	{
+		init_depth_pyramid();
+		init_object_culling();
+	}
+
+	if (_meshletCulling)
+	{
+		init_meshlet_culling();
+	}
 
 	//everything went fine
 	_isInitialized = true;
@@ -67,7 +95,20 @@ void VulkanEngine::cleanup()
 			vkDestroyImageView(_device, _swapchainImageViews[i], nullptr);
 		}*/
 
-		vkWaitForFences(_device, 1, &_renderFence, true, 1000000000);
+		//Make sure the GPU is done with every frame of the ring
+		for (uint32_t i = 0; i < _framesInFlight; ++i)
+		{
+			vkWaitForFences(_device, 1, &_frames[i]._renderFence, true, 1000000000);
+		}
+
+		//Hand out the frames still waiting in the ring, oldest first
+		for (uint32_t i = 0; i < _framesInFlight; ++i)
+		{
+			flush_readback(_frames[(_frameNumber + i) % _framesInFlight]);
+		}
+
+		//Before the deletion queue destroys the cache
+		save_pipeline_cache();
 
 		_mainDeletionQueue.flush();
 
@@ -76,22 +117,75 @@ void VulkanEngine::cleanup()
 		vkDestroySurfaceKHR(_instance, _surface, nullptr);
 		vkb::destroy_debug_utils_messenger(_instance, _debug_messenger);
 		vkDestroyInstance(_instance, nullptr);
-		SDL_DestroyWindow(_window);
+
+		if (_window)
+		{
+			SDL_DestroyWindow(_window);
+		}
 	}
+
+	_jobs.shutdown();
+}
+
+FrameData& VulkanEngine::get_current_frame()
+{
+	return _frames[_frameNumber % _framesInFlight];
+}
+
+float VulkanEngine::get_projection_scale() const
+{
+	//Viewport height over 2 * tan(fovy / 2), turns an error at unit distance into pixels
+	return _windowExtent.height / (2.f * tanf(glm::radians(CAMERA_FOV) * 0.5f));
 }
 
 void VulkanEngine::draw()
 {
-	//Wait GPU to finish last frame. Timeout in nanoseconds.
-	VK_CHECK(vkWaitForFences(_device, 1, &_renderFence, true, 1000000000u));
-	VK_CHECK(vkResetFences(_device, 1, &_renderFence));
+	VK_TRACE_ZONE("draw");
+
+	FrameData& frame = get_current_frame();
+
+	auto fenceStart = std::chrono::high_resolution_clock::now();
+
+	{
+		VK_TRACE_ZONE("draw: wait fence");
+
+		//Wait GPU to finish the last frame that used this slot of the ring. Timeout in nanoseconds.
+		VK_CHECK(vkWaitForFences(_device, 1, &frame._renderFence, true, 1000000000u));
+		VK_CHECK(vkResetFences(_device, 1, &frame._renderFence));
+	}
+
+	//Staging space of uploads that finished meanwhile goes back to the ring, the ones still running are not waited on
+	_uploader.retire();
+
+	//Whatever this slot's last frame allocated is no longer in use, the sets are written again from scratch
+	frame._frameDescriptors.reset_pools();
+	write_frame_descriptors(frame);
+
+	auto recordStart = std::chrono::high_resolution_clock::now();
+
+	//The GPU is done with the last frame of this slot, its pixels can be handed out
+	{
+		VK_TRACE_ZONE("draw: flush readback");
+		flush_readback(frame);
+	}
 
 	//Request
 	uint32_t swapchainImageIndex;
-	VK_CHECK(vkAcquireNextImageKHR(_device, _swapchain, 1000000000u, _presentSemaphore, nullptr, &swapchainImageIndex));
+	if (_headless)
+	{
+		//Offscreen targets belong to the ring, there is nothing to acquire
+		swapchainImageIndex = _frameNumber % _framesInFlight;
+	}
+	else
+	{
+		VK_TRACE_ZONE("draw: acquire");
+		VK_CHECK(vkAcquireNextImageKHR(_device, _swapchain, 1000000000u, frame._presentSemaphore, nullptr, &swapchainImageIndex));
+	}
+
+	VkCommandBuffer cmd = frame._mainCommandBuffer;
 
 	//Reset to use it again later
-	VK_CHECK(vkResetCommandBuffer(_mainCommandBuffer, 0));
+	VK_CHECK(vkResetCommandBuffer(cmd, 0));
 
 
 	//Begin the command buffer recording. We will use this command buffer exactly once, so we want to let Vulkan know that
@@ -102,13 +196,59 @@ void VulkanEngine::draw()
 	cmdBeginInfo.pInheritanceInfo = nullptr;
 	cmdBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
-	VK_CHECK(vkBeginCommandBuffer(_mainCommandBuffer, &cmdBeginInfo));
+	VK_CHECK(vkBeginCommandBuffer(cmd, &cmdBeginInfo));
 	{
+		VK_TRACE_ZONE("draw: record");
+
+		//Reads back the timings this slot recorded last time, then resets its queries
+		_gpuProfiler.begin_frame(cmd, _frameNumber % _framesInFlight, _frameNumber);
+
+		ScopedGpuZone frameZone(_gpuProfiler, cmd, "frame");
+
+		FramePose pose;
+		if (_scriptedPath)
+		{
+			pose = _scriptedPath(_frameNumber);
+		}
+		else
+		{
+			pose.camPos = { 0.f, 0.f, -2.f };
+			pose.model = glm::rotate(glm::mat4{ 1.f }, glm::radians(_frameNumber * 0.4f), glm::vec3(0.f, 1.f, 0.f));
+		}
+
+		glm::mat4 view = glm::translate(glm::mat4(1.f), pose.camPos);
+
+		glm::mat4 projection = glm::perspective(glm::radians(CAMERA_FOV), 1700.f / 900.f, 0.1f, 200.f);
+		projection[1][1] *= -1;
+
+		_scene.set_transform(_heroObject, pose.model);
+
+		//With occlusion culling the main pass only draws what was visible last frame
+		CullPhase firstPhase = _occlusionCulling ? CullPhase::Early : CullPhase::All;
+
+		//Compute work can't be recorded inside a render pass
+		if (_gpuCulling)
+		{
+			cull_objects(cmd, frame, projection * view, -pose.camPos, firstPhase);
+		}
+		//Only the object culling pass keeps a copy of the transforms to update
+		_scene.clear_moved_objects();
+
+		if (_meshletCulling)
+		{
+			cull_meshlets(cmd, frame, projection, view, pose.model);
+		}
 
 		VkClearValue clearValue;
 		float flash = abs(sin(_frameNumber / 120.f));
 		clearValue.color = { {0.f, 0.f, flash, 1.f} };
 
+		//Clear depth at 1 (the far plane)
+		VkClearValue depthClear;
+		depthClear.depthStencil.depth = 1.f;
+
+		VkClearValue clearValues[] = { clearValue, depthClear };
+
 		//Start main renderpass
 		VkRenderPassBeginInfo rpInfo = {};
 		rpInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -121,33 +261,35 @@ void VulkanEngine::draw()
 		rpInfo.framebuffer = _framebuffers[swapchainImageIndex];
 
 		//Connect clear values
-		rpInfo.clearValueCount = 1;
-		rpInfo.pClearValues = &clearValue;
+		rpInfo.clearValueCount = 2;
+		rpInfo.pClearValues = &clearValues[0];
+
 
+		uint32_t passScope = _gpuProfiler.begin_scope(cmd, "main pass");
 
-		vkCmdBeginRenderPass(_mainCommandBuffer, &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
+		vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
 		{
 			/*if (_selectedShader == 0)
 			{
-				vkCmdBindPipeline(_mainCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _trianglePipeline);
+				vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _trianglePipeline);
 			}
 			else
 			{
-				vkCmdBindPipeline(_mainCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _redTrianglePipeline);
+				vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _redTrianglePipeline);
 			}
-			vkCmdDraw(_mainCommandBuffer, 3, 1, 0, 0);*/
+			vkCmdDraw(cmd, 3, 1, 0, 0);*/
 
 			//Rotating triangle
-			/*vkCmdBindPipeline(_mainCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _meshPipeline);
+			/*vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _meshPipeline);
 
 			//bind the mesh vertex buffer with offset 0
 			VkDeviceSize offset = 0;
-			vkCmdBindVertexBuffers(_mainCommandBuffer, 0, 1, &_triangleMesh._vertexBuffer._buffer, &offset);
+			vkCmdBindVertexBuffers(cmd, 0, 1, &_triangleMesh._vertexBuffer._buffer, &offset);
 
 			glm::vec3 camPos = { 0.f, 0.f, -2.f };
 			glm::mat4 view = glm::translate(glm::mat4(1.f), camPos);
 
-			glm::mat4 projection = glm::perspective(glm::radians(70.f), 1700.f / 900.f, 0.1f, 200.f);
+			glm::mat4 projection = glm::perspective(glm::radians(CAMERA_FOV), 1700.f / 900.f, 0.1f, 200.f);
 			projection[1][1] *= -1;
 
 			glm::mat4 model = glm::rotate(glm::mat4{ 1.f }, glm::radians(_frameNumber * 0.4f), glm::vec3(0.f, 1.f, 0.f));
@@ -158,33 +300,89 @@ void VulkanEngine::draw()
 			constants.render_matrix = mesh_matrix;
 
 			//upload the matrix to the GPU via push constants
-			vkCmdPushConstants(_mainCommandBuffer, _meshPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);*/
+			vkCmdPushConstants(cmd, _meshPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);*/
 
-			vkCmdBindPipeline(_mainCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, _meshPipeline);
-			VkDeviceSize offset = 0;
-			vkCmdBindVertexBuffers(_mainCommandBuffer, 0, 1, &_monkeyMesh._vertexBuffer._buffer, &offset);
+			ScopedGpuZone objectsZone(_gpuProfiler, cmd, "objects");
 
-			glm::vec3 camPos = { 0.f, 0.f, -2.f };
-			glm::mat4 view = glm::translate(glm::mat4(1.f), camPos);
+			//Camera sits at -camPos
+			if (_gpuCulling)
+			{
+				draw_batches(cmd, frame, firstPhase);
+			}
+			else
+			{
+				draw_objects(cmd, frame, projection, view, -pose.camPos);
+			}
+		}
+		vkCmdEndRenderPass(cmd);
 
-			glm::mat4 projection = glm::perspective(glm::radians(70.f), 1700.f / 900.f, 0.1f, 200.f);
-			projection[1][1] *= -1;
+		_gpuProfiler.end_scope(cmd, passScope);
 
-			glm::mat4 model = glm::rotate(glm::mat4{ 1.f }, glm::radians(_frameNumber * 0.4f), glm::vec3(0.f, 1.f, 0.f));
+		//Everything the early pass missed is tested against its depth, then drawn on top of it
+		if (_occlusionCulling)
+		{
+			build_depth_pyramid(cmd);
+			cull_objects(cmd, frame, projection * view, -pose.camPos, CullPhase::Late);
 
-			glm::mat4 mesh_matrix = projection * view * model;
+			rpInfo.renderPass = _occlusionRenderPass;
+			rpInfo.clearValueCount = 0;
+			rpInfo.pClearValues = nullptr;
 
-			MeshPushConstants constants;
-			constants.render_matrix = mesh_matrix;
-			vkCmdPushConstants(_mainCommandBuffer, _meshPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+			uint32_t latePassScope = _gpuProfiler.begin_scope(cmd, "late pass");
+
+			vkCmdBeginRenderPass(cmd, &rpInfo, VK_SUBPASS_CONTENTS_INLINE);
+			draw_batches(cmd, frame, CullPhase::Late);
+			vkCmdEndRenderPass(cmd);
 
-			vkCmdDraw(_mainCommandBuffer, _monkeyMesh._vertices.size(), 1, 0, 0);
+			_gpuProfiler.end_scope(cmd, latePassScope);
 		}
-		vkCmdEndRenderPass(_mainCommandBuffer);
 
+		if (_headless && _readbackFrames)
+		{
+			//The render pass already moved the image to TRANSFER_SRC, only wait for the color writes
+			VkImageMemoryBarrier imageBarrier = {};
+			imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			imageBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+			imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			imageBarrier.image = _swapchainImages[swapchainImageIndex];
+			imageBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+
+			VkBufferImageCopy copyRegion = {};
+			copyRegion.bufferOffset = 0;
+			//0 means tightly packed
+			copyRegion.bufferRowLength = 0;
+			copyRegion.bufferImageHeight = 0;
+			copyRegion.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+			copyRegion.imageExtent = { _windowExtent.width, _windowExtent.height, 1 };
+
+			vkCmdCopyImageToBuffer(cmd, _swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, frame._readbackBuffer._buffer, 1, &copyRegion);
+
+			//Make the copy visible to the host once the fence signals
+			VkBufferMemoryBarrier bufferBarrier = {};
+			bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+			bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			bufferBarrier.buffer = frame._readbackBuffer._buffer;
+			bufferBarrier.offset = 0;
+			bufferBarrier.size = VK_WHOLE_SIZE;
+
+			vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+
+			frame._readbackFrame = _frameNumber;
+		}
 	}
 	//Finalize the command buffer (we can no longer add commands, but it can now be executed)
-	VK_CHECK(vkEndCommandBuffer(_mainCommandBuffer));
+	VK_CHECK(vkEndCommandBuffer(cmd));
+
+	auto submitStart = std::chrono::high_resolution_clock::now();
 
 
 	VkSubmitInfo submit = {};
@@ -195,42 +393,67 @@ void VulkanEngine::draw()
 
 	submit.pWaitDstStageMask = &waitStage;
 
-	submit.waitSemaphoreCount = 1;
-	submit.pWaitSemaphores = &_presentSemaphore;
+	//Headless frames have no image to wait for and nobody to present them
+	submit.waitSemaphoreCount = _headless ? 0 : 1;
+	submit.pWaitSemaphores = &frame._presentSemaphore;
 
-	submit.signalSemaphoreCount = 1;
-	submit.pSignalSemaphores = &_renderSemaphore;
+	submit.signalSemaphoreCount = _headless ? 0 : 1;
+	submit.pSignalSemaphores = &frame._renderSemaphore;
 
 	submit.commandBufferCount = 1;
-	submit.pCommandBuffers = &_mainCommandBuffer;
+	submit.pCommandBuffers = &cmd;
 
 	//submit command buffer to the queue and execute it.
-	//_renderFence will now block until the graphic commands finish execution
-	VK_CHECK(vkQueueSubmit(_graphicsQueue, 1, &submit, _renderFence));
+	//_renderFence of this frame will now block until the graphic commands finish execution
+	{
+		VK_TRACE_ZONE("draw: submit");
+		VK_CHECK(vkQueueSubmit(_graphicsQueue, 1, &submit, frame._renderFence));
+	}
+
+	if (!_headless)
+	{
+		VK_TRACE_ZONE("draw: present");
+
+		// this will put the image we just rendered into the visible window.
+		// we want to wait on the _renderSemaphore for that,
+		// as it's necessary that drawing commands have finished before the image is displayed to the user.
+		VkPresentInfoKHR presentInfo = {};
+		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+		presentInfo.pNext = nullptr;
 
+		presentInfo.pSwapchains = &_swapchain;
+		presentInfo.swapchainCount = 1;
 
-	// this will put the image we just rendered into the visible window.
-	// we want to wait on the _renderSemaphore for that,
-	// as it's necessary that drawing commands have finished before the image is displayed to the user.
-	VkPresentInfoKHR presentInfo = {};
-	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-	presentInfo.pNext = nullptr;
+		presentInfo.pWaitSemaphores = &frame._renderSemaphore;
+		presentInfo.waitSemaphoreCount = 1;
 
-	presentInfo.pSwapchains = &_swapchain;
-	presentInfo.swapchainCount = 1;
+		presentInfo.pImageIndices = &swapchainImageIndex;
 
-	presentInfo.pWaitSemaphores = &_renderSemaphore;
-	presentInfo.waitSemaphoreCount = 1;
+		VK_CHECK(vkQueuePresentKHR(_graphicsQueue, &presentInfo));
+	}
 
-	presentInfo.pImageIndices = &swapchainImageIndex;
+	auto submitEnd = std::chrono::high_resolution_clock::now();
 
-	VK_CHECK(vkQueuePresentKHR(_graphicsQueue, &presentInfo));
+	using ms = std::chrono::duration<double, std::milli>;
+	_lastFrameStats.fenceWaitMs = ms(recordStart - fenceStart).count();
+	_lastFrameStats.recordMs = ms(submitStart - recordStart).count();
+	_lastFrameStats.submitMs = ms(submitEnd - submitStart).count();
 
 	++_frameNumber;
 }
 
 void VulkanEngine::run()
 {
+	if (_headless)
+	{
+		//No window means no events, just render until the frame limit
+		while (_frameLimit == 0 || _frameNumber < _frameLimit)
+		{
+			draw();
+		}
+		return;
+	}
+
 	SDL_Event e;
 	bool bQuit = false;
 
@@ -238,35 +461,47 @@ void VulkanEngine::run()
 	while (!bQuit)
 	{
 		//Handle events on queue
-		while (SDL_PollEvent(&e) != 0)
 		{
-			//close the window when user alt-f4s or clicks the X button			
-			if (e.type == SDL_QUIT || e.key.keysym.sym == SDLK_ESCAPE)
+			VK_TRACE_ZONE("run: poll events");
+			while (SDL_PollEvent(&e) != 0)
 			{
-				bQuit = true;
-			}
-			else if (e.type == SDL_KEYDOWN)
-			{
-				if (e.key.keysym.sym == SDLK_SPACE)
+				//close the window when user alt-f4s or clicks the X button			
+				if (e.type == SDL_QUIT || e.key.keysym.sym == SDLK_ESCAPE)
+				{
+					bQuit = true;
+				}
+				else if (e.type == SDL_KEYDOWN)
 				{
-					_selectedShader += 1;
-					_selectedShader %= _totalShader;
+					if (e.key.keysym.sym == SDLK_SPACE)
+					{
+						_selectedShader += 1;
+						_selectedShader %= _totalShader;
+					}
 				}
 			}
 		}
 
 		draw();
+
+		if (_frameLimit != 0 && _frameNumber >= _frameLimit)
+		{
+			bQuit = true;
+		}
 	}
 }
 
 void VulkanEngine::init_vulkan()
 {
+	VK_TRACE_ZONE("init_vulkan");
+
 	vkb::InstanceBuilder builder;
 
 	vkb::detail::Result<vkb::Instance> inst_ret = builder.set_app_name("Vulkan")
 							                             .request_validation_layers(true)
 						                                 .require_api_version(1, 1, 0)
 						                                 .use_default_debug_messenger()
+						                                 //Skip the surface extensions when there is no window
+						                                 .set_headless(_headless)
 						                                 .build();
 
 
@@ -275,15 +510,31 @@ void VulkanEngine::init_vulkan()
 	_instance        = vkb_inst.instance;
 	_debug_messenger = vkb_inst.debug_messenger;
 
-	//Take the surface screen of the window
-	SDL_Vulkan_CreateSurface(_window, _instance, &_surface);
-
 	//Select the GPU with condition
 	vkb::PhysicalDeviceSelector selector{ vkb_inst };
-	vkb::PhysicalDevice physicalDevice = selector.set_minimum_version(1, 1)
-												 .set_surface(_surface)
-												 .select()
-												 .value();
+	selector.set_minimum_version(1, 1);
+
+	//A headless instance does not require presentation support, which lets software ICDs like lavapipe be picked
+	if (!_headless)
+	{
+		//Take the surface screen of the window
+		SDL_Vulkan_CreateSurface(_window, _instance, &_surface);
+		selector.set_surface(_surface);
+	}
+
+	//Indirect draws pick their object with firstInstance, and object culling records a whole batch per call
+	VkPhysicalDeviceFeatures requiredFeatures = {};
+	requiredFeatures.drawIndirectFirstInstance = _gpuCulling || _meshletCulling;
+	requiredFeatures.multiDrawIndirect = _gpuCulling;
+	selector.set_required_features(requiredFeatures);
+
+	//Core in 1.2 only, without it culled commands stay in the batch as empty instances
+	if (_gpuCulling)
+	{
+		selector.add_desired_extension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	}
+
+	vkb::PhysicalDevice physicalDevice = selector.select().value();
 
 	vkb::DeviceBuilder deviceBuilder{ physicalDevice };
 	vkb::Device vkbDevice = deviceBuilder.build().value();
@@ -292,6 +543,28 @@ void VulkanEngine::init_vulkan()
 	_device    = vkbDevice.device;
 	_chosenGPU = physicalDevice.physical_device;
 
+	if (_gpuCulling)
+	{
+		//Desired extensions are enabled whenever the device has them
+		uint32_t extensionCount = 0;
+		vkEnumerateDeviceExtensionProperties(_chosenGPU, nullptr, &extensionCount, nullptr);
+		std::vector<VkExtensionProperties> extensions(extensionCount);
+		vkEnumerateDeviceExtensionProperties(_chosenGPU, nullptr, &extensionCount, extensions.data());
+
+		for (const VkExtensionProperties& extension : extensions)
+		{
+			if (strcmp(extension.extensionName, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) == 0)
+			{
+				_vkCmdDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(_device, "vkCmdDrawIndexedIndirectCountKHR");
+			}
+		}
+
+		if (_vkCmdDrawIndexedIndirectCount == nullptr)
+		{
+			std::cout << "No VK_KHR_draw_indirect_count, culled objects are drawn as empty instances" << std::endl;
+		}
+	}
+
 	_graphicsQueue = vkbDevice.get_queue(vkb::QueueType::graphics).value();
 	_graphicsQueueFamily = vkbDevice.get_queue_index(vkb::QueueType::graphics).value();
 
@@ -305,24 +578,33 @@ void VulkanEngine::init_vulkan()
 
 void VulkanEngine::init_swapchain()
 {
-	vkb::SwapchainBuilder swapchainBuilder{ _chosenGPU, _device, _surface };
+	VK_TRACE_ZONE("init_swapchain");
+
+	if (_headless)
+	{
+		init_offscreen_targets();
+	}
+	else
+	{
+		vkb::SwapchainBuilder swapchainBuilder{ _chosenGPU, _device, _surface };
 
-	vkb::Swapchain vkbSwapchain = swapchainBuilder.use_default_format_selection()
-												  //VSync mode forced by GPU
-		                                          .set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
-											      .set_desired_extent(_windowExtent.width, _windowExtent.height)
-												  .build()
-												  .value();
+		vkb::Swapchain vkbSwapchain = swapchainBuilder.use_default_format_selection()
+													  //VSync mode forced by GPU
+			                                          .set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
+												      .set_desired_extent(_windowExtent.width, _windowExtent.height)
+													  .build()
+													  .value();
 
-	_swapchain            = vkbSwapchain.swapchain;
-	_swapchainImages      = vkbSwapchain.get_images().value();
-	_swapchainImageViews  = vkbSwapchain.get_image_views().value();
-	_swapchainImageFormat = vkbSwapchain.image_format;
+		_swapchain            = vkbSwapchain.swapchain;
+		_swapchainImages      = vkbSwapchain.get_images().value();
+		_swapchainImageViews  = vkbSwapchain.get_image_views().value();
+		_swapchainImageFormat = vkbSwapchain.image_format;
 
-	_mainDeletionQueue.push_function(
-		[=]() {
-			vkDestroySwapchainKHR(_device, _swapchain, nullptr); 
-		});
+		_mainDeletionQueue.push_function(
+			[=]() {
+				vkDestroySwapchainKHR(_device, _swapchain, nullptr); 
+			});
+	}
 
 
 	//depth image size will match the window
@@ -331,8 +613,9 @@ void VulkanEngine::init_swapchain()
 	//hardcoding the depth format to 32 bit float
 	_depthFormat = VK_FORMAT_D32_SFLOAT;
 
-	//the depth image will be an image with the format we selected and Depth Attachment usage flag
-	VkImageCreateInfo dimg_info = vkinit::image_create_info(_depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, depthImageExtent);
+	//the depth image will be an image with the format we selected and Depth Attachment usage flag, sampled to build the depth pyramid
+	VkImageUsageFlags depthUsage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | (_occlusionCulling ? VK_IMAGE_USAGE_SAMPLED_BIT : 0);
+	VkImageCreateInfo dimg_info = vkinit::image_create_info(_depthFormat, depthUsage, depthImageExtent);
 
 	//for the depth image, we want to allocate it from GPU local memory
 	VmaAllocationCreateInfo dimg_allocinfo = {};
@@ -357,17 +640,111 @@ void VulkanEngine::init_swapchain()
 		});
 }
 
+void VulkanEngine::init_offscreen_targets()
+{
+	//Fixed format so readback consumers always get RGBA8
+	_swapchainImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+
+	VkExtent3D imageExtent = { _windowExtent.width, _windowExtent.height, 1 };
+
+	//One color target per frame in flight, the framebuffers are then built exactly like for a swapchain
+	VkImageCreateInfo img_info = vkinit::image_create_info(_swapchainImageFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, imageExtent);
+
+	VmaAllocationCreateInfo img_allocinfo = {};
+	img_allocinfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+	_offscreenImages.resize(_framesInFlight);
+	_swapchainImages.resize(_framesInFlight);
+	_swapchainImageViews.resize(_framesInFlight);
+
+	for (uint32_t i = 0; i < _framesInFlight; ++i)
+	{
+		VK_CHECK(vmaCreateImage(_allocator, &img_info, &img_allocinfo, &_offscreenImages[i]._image, &_offscreenImages[i]._allocation, nullptr));
+
+		VkImageViewCreateInfo view_info = vkinit::imageview_create_info(_swapchainImageFormat, _offscreenImages[i]._image, VK_IMAGE_ASPECT_COLOR_BIT);
+		VK_CHECK(vkCreateImageView(_device, &view_info, nullptr, &_swapchainImageViews[i]));
+
+		_swapchainImages[i] = _offscreenImages[i]._image;
+
+		//The image views are destroyed alongside the framebuffers
+		_mainDeletionQueue.push_function(
+			[=]() {
+				vmaDestroyImage(_allocator, _offscreenImages[i]._image, _offscreenImages[i]._allocation);
+			});
+
+		if (_readbackFrames)
+		{
+			VkBufferCreateInfo bufferInfo = {};
+			bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+			bufferInfo.size = _windowExtent.width * _windowExtent.height * 4;
+			bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+			VmaAllocationCreateInfo vmaallocInfo = {};
+			vmaallocInfo.usage = VMA_MEMORY_USAGE_GPU_TO_CPU;
+
+			VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaallocInfo, &_frames[i]._readbackBuffer._buffer, &_frames[i]._readbackBuffer._allocation, nullptr));
+
+			_mainDeletionQueue.push_function(
+				[=]() {
+					vmaDestroyBuffer(_allocator, _frames[i]._readbackBuffer._buffer, _frames[i]._readbackBuffer._allocation);
+				});
+		}
+	}
+}
+
+void VulkanEngine::flush_readback(FrameData& frame)
+{
+	if (frame._readbackFrame < 0)
+		return;
+
+	if (_onFrameReadback)
+	{
+		void* data;
+		vmaMapMemory(_allocator, frame._readbackBuffer._allocation, &data);
+
+		//GPU_TO_CPU memory is not guaranteed to be coherent
+		vmaInvalidateAllocation(_allocator, frame._readbackBuffer._allocation, 0, VK_WHOLE_SIZE);
+
+		_onFrameReadback(frame._readbackFrame, (const uint8_t*)data, _windowExtent);
+
+		vmaUnmapMemory(_allocator, frame._readbackBuffer._allocation);
+	}
+
+	frame._readbackFrame = -1;
+}
+
 void VulkanEngine::init_commands()
 {
 	VkCommandPoolCreateInfo commandPoolInfo = vkinit::command_pool_create_info(_graphicsQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
-	VK_CHECK(vkCreateCommandPool(_device, &commandPoolInfo, nullptr, &_commandPool));
 
-	VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::command_buffer_allocate_info(_commandPool, 1);
-	VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &_mainCommandBuffer));
+	//Each frame of the ring records into its own pool, so resetting one never touches a buffer still in flight
+	for (uint32_t i = 0; i < _framesInFlight; ++i)
+	{
+		VK_CHECK(vkCreateCommandPool(_device, &commandPoolInfo, nullptr, &_frames[i]._commandPool));
+
+		VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::command_buffer_allocate_info(_frames[i]._commandPool, 1);
+		VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &_frames[i]._mainCommandBuffer));
+
+		_mainDeletionQueue.push_function(
+			[=]() {
+				vkDestroyCommandPool(_device, _frames[i]._commandPool, nullptr);
+			});
+	}
+
+	//Timestamp queries are recorded in the same command buffers, one query pool per frame in flight
+	_gpuProfiler.init(_device, _chosenGPU, _graphicsQueueFamily, _framesInFlight);
 
 	_mainDeletionQueue.push_function(
 		[=]() {
-			vkDestroyCommandPool(_device, _commandPool, nullptr);
+			_gpuProfiler.cleanup();
+		});
+
+	//Mesh data reaches GPU_ONLY buffers through its own staging ring and command buffers
+	_uploader.init(_device, _allocator, _graphicsQueue, _graphicsQueueFamily);
+
+	_mainDeletionQueue.push_function(
+		[=]() {
+			_uploader.cleanup();
 		});
 }
 
@@ -385,7 +762,11 @@ void VulkanEngine::init_default_renderpass()
 
 	color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 
-	color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	//Offscreen targets are never presented, leave them ready to be copied back to the host
+	VkImageLayout presentLayout = _headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+	//With occlusion culling the late pass draws on top and does the final transition
+	color_attachment.finalLayout = _occlusionCulling ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : presentLayout;
 
 
 	VkAttachmentReference color_attachment_ref = {};
@@ -393,20 +774,60 @@ void VulkanEngine::init_default_renderpass()
 	color_attachment_ref.attachment = 0;
 	color_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+	VkAttachmentDescription depth_attachment = {};
+	depth_attachment.flags = 0;
+	depth_attachment.format = _depthFormat;
+	depth_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	depth_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depth_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depth_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	depth_attachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentReference depth_attachment_ref = {};
+	depth_attachment_ref.attachment = 1;
+	depth_attachment_ref.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
 	//we are going to create 1 subpass, which is the minimum you can do
 	VkSubpassDescription subpass = {};
 	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
 	subpass.colorAttachmentCount = 1;
 	subpass.pColorAttachments = &color_attachment_ref;
-
+	subpass.pDepthStencilAttachment = &depth_attachment_ref;
+
+	VkAttachmentDescription attachments[2] = { color_attachment, depth_attachment };
+
+	//Wait for the image to be acquired before writing colors into it
+	VkSubpassDependency color_dependency = {};
+	color_dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+	color_dependency.dstSubpass = 0;
+	color_dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	color_dependency.srcAccessMask = 0;
+	color_dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	color_dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+	//The depth image is shared by every frame in flight, so the previous frame must be done with it before it gets cleared
+	VkSubpassDependency depth_dependency = {};
+	depth_dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+	depth_dependency.dstSubpass = 0;
+	depth_dependency.srcStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	depth_dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	depth_dependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	depth_dependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	VkSubpassDependency dependencies[2] = { color_dependency, depth_dependency };
 
 	VkRenderPassCreateInfo render_pass_info = {};
 	render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
 
-	render_pass_info.attachmentCount = 1;
-	render_pass_info.pAttachments = &color_attachment;
+	//2 attachments from said array
+	render_pass_info.attachmentCount = 2;
+	render_pass_info.pAttachments = &attachments[0];
 	render_pass_info.subpassCount = 1;
 	render_pass_info.pSubpasses = &subpass;
+	render_pass_info.dependencyCount = 2;
+	render_pass_info.pDependencies = &dependencies[0];
 
 	VK_CHECK(vkCreateRenderPass(_device, &render_pass_info, nullptr, &_renderPass));
 
@@ -415,40 +836,29 @@ void VulkanEngine::init_default_renderpass()
 			vkDestroyRenderPass(_device, _renderPass, nullptr);
 		});
 
-	{
-		VkAttachmentDescription depth_attachment = {};
-		depth_attachment.flags = 0;
-		depth_attachment.format = _depthFormat;
-		depth_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
-		depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-		depth_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-		depth_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-		depth_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		depth_attachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-		VkAttachmentReference depth_attachment_ref = {};
-		depth_attachment_ref.attachment = 1;
-		depth_attachment_ref.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	if (!_occlusionCulling)
+		return;
 
-		VkSubpassDescription subpass = {};
-		subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-		subpass.colorAttachmentCount = 1;
-		subpass.pColorAttachments = &color_attachment_ref;
-		subpass.pDepthStencilAttachment = &depth_attachment_ref;
+	//Compatible with _renderPass, so the same framebuffers and pipelines work with it. Keeps what the early pass drew.
+	attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	attachments[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	attachments[0].finalLayout = presentLayout;
 
-		VkAttachmentDescription attachments[2] = { color_attachment, depth_attachment };
+	attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachments[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
-		VkRenderPassCreateInfo render_pass_info = {};
-		render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-		//2 attachments from said array
-		render_pass_info.attachmentCount = 2;
-		render_pass_info.pAttachments = &attachments[0];
-		render_pass_info.subpassCount = 1;
-		render_pass_info.pSubpasses = &subpass;
+	//The early pass's color writes must land first, depth is handed back by the pyramid build's barrier
+	dependencies[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dependencies[1].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
+	VK_CHECK(vkCreateRenderPass(_device, &render_pass_info, nullptr, &_occlusionRenderPass));
 
-	}
+	_mainDeletionQueue.push_function(
+		[=]() {
+			vkDestroyRenderPass(_device, _occlusionRenderPass, nullptr);
+		});
 }
 
 void VulkanEngine::init_framebuffers()
@@ -459,7 +869,7 @@ void VulkanEngine::init_framebuffers()
 	fb_info.pNext = nullptr;
 
 	fb_info.renderPass = _renderPass;
-	fb_info.attachmentCount = 1;
+	fb_info.attachmentCount = 2;
 	fb_info.width = _windowExtent.width;
 	fb_info.height = _windowExtent.height;
 	fb_info.layers = 1;
@@ -469,7 +879,9 @@ void VulkanEngine::init_framebuffers()
 
 	for (int i = 0; i < swapchain_imageCount; ++i)
 	{
-		fb_info.pAttachments = &_swapchainImageViews[i];
+		//The depth image is shared by all the framebuffers
+		VkImageView attachments[2] = { _swapchainImageViews[i], _depthImageView };
+		fb_info.pAttachments = &attachments[0];
 		VK_CHECK(vkCreateFramebuffer(_device, &fb_info, nullptr, &_framebuffers[i]));
 
 		_mainDeletionQueue.push_function(
@@ -486,84 +898,375 @@ void VulkanEngine::init_sync_structures()
 	//We can wait on it before using it on a GPU command (for the first frame)
 	VkFenceCreateInfo fenceCreateInfo = vkinit::fence_create_info(VK_FENCE_CREATE_SIGNALED_BIT);
 
-	VK_CHECK(vkCreateFence(_device, &fenceCreateInfo, nullptr, &_renderFence));
-
-	_mainDeletionQueue.push_function(
-		[=]() {
-			vkDestroyFence(_device, _renderFence, nullptr);
-		});
-
 	//No flags needed
 	VkSemaphoreCreateInfo semaphoreCreateInfo = vkinit::semaphore_create_info();
 
-	VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_presentSemaphore));
-	VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_renderSemaphore));
+	for (uint32_t i = 0; i < _framesInFlight; ++i)
+	{
+		VK_CHECK(vkCreateFence(_device, &fenceCreateInfo, nullptr, &_frames[i]._renderFence));
 
-	_mainDeletionQueue.push_function(
-		[=]() {
-			vkDestroySemaphore(_device, _presentSemaphore, nullptr);
-			vkDestroySemaphore(_device, _renderSemaphore, nullptr);
-		});
+		_mainDeletionQueue.push_function(
+			[=]() {
+				vkDestroyFence(_device, _frames[i]._renderFence, nullptr);
+			});
+
+		VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_frames[i]._presentSemaphore));
+		VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_frames[i]._renderSemaphore));
+
+		_mainDeletionQueue.push_function(
+			[=]() {
+				vkDestroySemaphore(_device, _frames[i]._presentSemaphore, nullptr);
+				vkDestroySemaphore(_device, _frames[i]._renderSemaphore, nullptr);
+			});
+	}
 }
 
-void VulkanEngine::init_pipelines()
+//What the previous draw left bound, the sorted order makes most of the next draw's binds redundant
+struct BoundDrawState
+{
+	VkPipeline pipeline{ VK_NULL_HANDLE };
+	VkDescriptorSet descriptorSet{ VK_NULL_HANDLE };
+	VkBuffer vertexBuffer{ VK_NULL_HANDLE };
+	VkBuffer indexBuffer{ VK_NULL_HANDLE };
+};
+
+//Binds whatever a draw of mesh with material needs and bound doesn't hold yet
+static void bind_draw_state(VkCommandBuffer cmd, const Material& material, const Mesh& mesh, VkBuffer indexBuffer, VkIndexType indexType, BoundDrawState& bound, DrawStats& stats)
 {
-	VkShaderModule triangleFragShader;
-	if (!load_shader_module("../../shaders/colored_triangle.frag.spv", &triangleFragShader))
+	if (material.pipeline != bound.pipeline)
+	{
+		vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material.pipeline);
+		bound.pipeline = material.pipeline;
+		stats.pipelineBinds++;
+	}
+	else
 	{
-		std::cout << "Error when building the triangle fragment shader module" << std::endl;
+		stats.skippedBinds++;
 	}
 
-	VkShaderModule triangleVertexShader;
-	if (!load_shader_module("../../shaders/colored_triangle.vert.spv", &triangleVertexShader))
+	if (material.descriptorSet != VK_NULL_HANDLE)
 	{
-		std::cout << "Error when building the triangle vertex shader module" << std::endl;
+		if (material.descriptorSet != bound.descriptorSet)
+		{
+			vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, material.pipelineLayout, 1, 1, &material.descriptorSet, 0, nullptr);
+			bound.descriptorSet = material.descriptorSet;
+			stats.descriptorSetBinds++;
+		}
+		else
+		{
+			stats.skippedBinds++;
+		}
 	}
 
-	VkShaderModule redTriangleFragShader;
-	if (!load_shader_module("../../shaders/triangle.frag.spv", &redTriangleFragShader))
+	if (mesh._vertexBuffer._buffer != bound.vertexBuffer)
+	{
+		VkDeviceSize offset = 0;
+		vkCmdBindVertexBuffers(cmd, 0, 1, &mesh._vertexBuffer._buffer, &offset);
+		bound.vertexBuffer = mesh._vertexBuffer._buffer;
+		stats.vertexBufferBinds++;
+
+		//Dequantization belongs to the mesh, it only changes along with the vertex buffer
+		MeshPushConstants constants;
+		constants.positionOffset = glm::vec4(mesh._positionOffset, 0.f);
+		constants.positionScale = glm::vec4(mesh._positionScale, 0.f);
+		vkCmdPushConstants(cmd, material.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &constants);
+	}
+	else
 	{
-		std::cout << "Error when building the triangle fragment shader module" << std::endl;
+		stats.skippedBinds++;
 	}
 
-	VkShaderModule redTriangleVertShader;
-	if (!load_shader_module("../../shaders/triangle.vert.spv", &redTriangleVertShader))
+	if (indexBuffer != bound.indexBuffer)
 	{
-		std::cout << "Error when building the triangle vertex shader module" << std::endl;
+		vkCmdBindIndexBuffer(cmd, indexBuffer, 0, indexType);
+		bound.indexBuffer = indexBuffer;
+		stats.indexBufferBinds++;
 	}
+	else
+	{
+		stats.skippedBinds++;
+	}
+}
 
+//Written in front of the driver blob. The blob carries its own UUID header,
+//but not the driver version, and a new driver may reject or misuse an old blob.
+struct PipelineCacheFileHeader
+{
+	uint32_t magic;
+	uint32_t dataSize;
+	uint32_t vendorID;
+	uint32_t deviceID;
+	uint32_t driverVersion;
+	uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+};
 
-	VkPipelineLayoutCreateInfo pipeline_layout_info = vkinit::pipeline_layout_create_info();
-	VK_CHECK(vkCreatePipelineLayout(_device, &pipeline_layout_info, nullptr, &_trianglePipelineLayout));
+constexpr uint32_t PIPELINE_CACHE_MAGIC = 0x43504B56; //"VKPC"
 
-	VkPipelineLayoutCreateInfo mesh_pipeline_layout_info = vkinit::pipeline_layout_create_info();
+void VulkanEngine::init_pipeline_cache()
+{
+	VK_TRACE_ZONE("init_pipeline_cache");
 
-	VkPushConstantRange push_constant;
-	push_constant.offset = 0;
-	push_constant.size = sizeof(MeshPushConstants);
-	push_constant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(_chosenGPU, &properties);
 
-	mesh_pipeline_layout_info.pPushConstantRanges = &push_constant;
-	mesh_pipeline_layout_info.pushConstantRangeCount = 1;
+	std::vector<char> initialData;
 
-	VK_CHECK(vkCreatePipelineLayout(_device, &mesh_pipeline_layout_info, nullptr, &_meshPipelineLayout));
+	std::ifstream file(_pipelineCachePath, std::ios::binary | std::ios::ate);
+	if (file.is_open())
+	{
+		size_t fileSize = (size_t)file.tellg();
+		file.seekg(0);
 
-	
+		PipelineCacheFileHeader header = {};
+		if (fileSize >= sizeof(header))
+		{
+			file.read((char*)&header, sizeof(header));
+		}
 
-	//build the stage-create-info for both vertex and fragment stages. This lets the pipeline know the shader modules per stage
-	PipelineBuilder pipelineBuilder;
-	pipelineBuilder._shaderStages.push_back(vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT, triangleVertexShader));
-	pipelineBuilder._shaderStages.push_back(vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, triangleFragShader));
+		//Any mismatch just means starting from an empty cache
+		bool valid = fileSize >= sizeof(header)
+			&& header.magic == PIPELINE_CACHE_MAGIC
+			&& header.dataSize == fileSize - sizeof(header)
+			&& header.vendorID == properties.vendorID
+			&& header.deviceID == properties.deviceID
+			&& header.driverVersion == properties.driverVersion
+			&& memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
 
-	//vertex input controls how to read vertices from vertex buffers. We aren't using it yet
-	pipelineBuilder._vertexInputInfo = vkinit::vertex_input_state_create_info();
+		if (valid)
+		{
+			initialData.resize(header.dataSize);
+			file.read(initialData.data(), header.dataSize);
+			if (!file)
+			{
+				initialData.clear();
+			}
+		}
 
-	//input assembly is the configuration for drawing triangle lists, strips, or individual points.
-	//we are just going to draw triangle list
-	pipelineBuilder._inputAssembly = vkinit::input_assembly_create_info(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+		std::cout << (initialData.empty() ? "Pipeline cache on disk is stale, rebuilding it" : "Loaded pipeline cache from disk") << std::endl;
+	}
 
-	//build viewport and scissor from the swapchain extents
-	pipelineBuilder._viewport.x = 0.f;
+	VkPipelineCacheCreateInfo cacheInfo = {};
+	cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheInfo.pNext = nullptr;
+	cacheInfo.initialDataSize = initialData.size();
+	cacheInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+
+	//Drivers are allowed to refuse data they validated as incompatible, retry empty in that case
+	if (vkCreatePipelineCache(_device, &cacheInfo, nullptr, &_pipelineCache) != VK_SUCCESS)
+	{
+		cacheInfo.initialDataSize = 0;
+		cacheInfo.pInitialData = nullptr;
+		VK_CHECK(vkCreatePipelineCache(_device, &cacheInfo, nullptr, &_pipelineCache));
+	}
+
+	_mainDeletionQueue.push_function(
+		[=]() {
+			vkDestroyPipelineCache(_device, _pipelineCache, nullptr);
+		});
+}
+
+void VulkanEngine::save_pipeline_cache()
+{
+	size_t dataSize = 0;
+	if (vkGetPipelineCacheData(_device, _pipelineCache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0)
+		return;
+
+	std::vector<char> data(dataSize);
+	if (vkGetPipelineCacheData(_device, _pipelineCache, &dataSize, data.data()) != VK_SUCCESS)
+		return;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(_chosenGPU, &properties);
+
+	PipelineCacheFileHeader header = {};
+	header.magic = PIPELINE_CACHE_MAGIC;
+	header.dataSize = (uint32_t)dataSize;
+	header.vendorID = properties.vendorID;
+	header.deviceID = properties.deviceID;
+	header.driverVersion = properties.driverVersion;
+	memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+
+	std::ofstream file(_pipelineCachePath, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+	{
+		std::cout << "Could not write pipeline cache to " << _pipelineCachePath << std::endl;
+		return;
+	}
+
+	file.write((const char*)&header, sizeof(header));
+	file.write(data.data(), dataSize);
+}
+
+void VulkanEngine::init_descriptors()
+{
+	VK_TRACE_ZONE("init_descriptors");
+
+	//Sets made at startup and kept for good, pools get added as the enabled passes need them
+	_descriptorAllocator.init(_device);
+
+	//Sets recorded for a single frame, the slot's pools are recycled once its fence signalled
+	for (uint32_t i = 0; i < _framesInFlight; ++i)
+	{
+		_frames[i]._frameDescriptors.init(_device);
+	}
+
+	//Object matrices, then the object handle of every instance
+	VkDescriptorSetLayoutBinding objectBindings[2] = {};
+	for (uint32_t b = 0; b < 2; ++b)
+	{
+		objectBindings[b].binding = b;
+		objectBindings[b].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		objectBindings[b].descriptorCount = 1;
+		objectBindings[b].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo setLayoutInfo = {};
+	setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	setLayoutInfo.bindingCount = 2;
+	setLayoutInfo.pBindings = objectBindings;
+
+	VK_CHECK(vkCreateDescriptorSetLayout(_device, &setLayoutInfo, nullptr, &_objectSetLayout));
+
+	_mainDeletionQueue.push_function(
+		[=]() {
+			vkDestroyDescriptorSetLayout(_device, _objectSetLayout, nullptr);
+			_descriptorAllocator.cleanup();
+			for (uint32_t i = 0; i < _framesInFlight; ++i)
+			{
+				_frames[i]._frameDescriptors.cleanup();
+			}
+		});
+}
+
+void VulkanEngine::write_frame_descriptors(FrameData& frame)
+{
+	VK_TRACE_ZONE("write_frame_descriptors");
+
+	//Every binding of the three sets, written with a single vkUpdateDescriptorSets
+	VkDescriptorBufferInfo bufferInfos[14];
+	VkDescriptorImageInfo imageInfos[1];
+	VkWriteDescriptorSet writes[15];
+	uint32_t bufferCount = 0;
+	uint32_t imageCount = 0;
+	uint32_t writeCount = 0;
+
+	auto write_buffer = [&](VkDescriptorSet set, uint32_t binding, VkBuffer buffer) {
+		bufferInfos[bufferCount] = { buffer, 0, VK_WHOLE_SIZE };
+
+		VkWriteDescriptorSet& write = writes[writeCount++];
+		write = {};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = set;
+		write.dstBinding = binding;
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		write.pBufferInfo = &bufferInfos[bufferCount++];
+	};
+
+	//Object matrices, then the object handle of every instance
+	frame._objectSet = frame._frameDescriptors.allocate(_objectSetLayout);
+	write_buffer(frame._objectSet, 0, frame._objectBuffer._buffer);
+	write_buffer(frame._objectSet, 1, frame._instanceBuffer._buffer);
+
+	if (_meshletCulling)
+	{
+		frame._meshletCullSet = frame._frameDescriptors.allocate(_meshletCullSetLayout);
+		write_buffer(frame._meshletCullSet, 0, _monkeyMeshlets._meshletBuffer._buffer);
+		write_buffer(frame._meshletCullSet, 1, _monkeyMeshlets._vertexBuffer._buffer);
+		write_buffer(frame._meshletCullSet, 2, _monkeyMeshlets._triangleBuffer._buffer);
+		write_buffer(frame._meshletCullSet, 3, frame._meshletIndexBuffer._buffer);
+		write_buffer(frame._meshletCullSet, 4, frame._meshletDrawBuffer._buffer);
+	}
+
+	if (_gpuCulling)
+	{
+		frame._objectCullSet = frame._frameDescriptors.allocate(_objectCullSetLayout);
+		write_buffer(frame._objectCullSet, 0, _cullObjectBuffer._buffer);
+		write_buffer(frame._objectCullSet, 1, _cullMeshBuffer._buffer);
+		write_buffer(frame._objectCullSet, 2, frame._transformBuffer._buffer);
+		write_buffer(frame._objectCullSet, 3, frame._objectBuffer._buffer);
+		write_buffer(frame._objectCullSet, 4, frame._drawCommandBuffer._buffer);
+		write_buffer(frame._objectCullSet, 5, frame._drawCountBuffer._buffer);
+		write_buffer(frame._objectCullSet, 6, _visibilityBuffer._buffer);
+
+		//cull_objects moves the pyramid to GENERAL before any dispatch
+		imageInfos[imageCount] = { _depthPyramidSampler, _depthPyramidView, VK_IMAGE_LAYOUT_GENERAL };
+
+		VkWriteDescriptorSet& write = writes[writeCount++];
+		write = {};
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = frame._objectCullSet;
+		write.dstBinding = 7;
+		write.descriptorCount = 1;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		write.pImageInfo = &imageInfos[imageCount++];
+	}
+
+	vkUpdateDescriptorSets(_device, writeCount, writes, 0, nullptr);
+}
+
+void VulkanEngine::init_pipelines()
+{
+	VK_TRACE_ZONE("init_pipelines");
+
+	//Shader files are read and turned into modules on the workers while the layouts get created here
+	auto load_shader_async = [this](const char* filePath) {
+		return _jobs.submit([this, filePath]() {
+			VkShaderModule shaderModule = VK_NULL_HANDLE;
+			if (!load_shader_module(filePath, &shaderModule))
+			{
+				std::cout << "Error when building the shader module " << filePath << std::endl;
+			}
+			return shaderModule;
+		});
+	};
+
+	std::future<VkShaderModule> triangleFragFuture = load_shader_async("../../shaders/colored_triangle.frag.spv");
+	std::future<VkShaderModule> triangleVertFuture = load_shader_async("../../shaders/colored_triangle.vert.spv");
+	std::future<VkShaderModule> redTriangleFragFuture = load_shader_async("../../shaders/triangle.frag.spv");
+	std::future<VkShaderModule> redTriangleVertFuture = load_shader_async("../../shaders/triangle.vert.spv");
+	std::future<VkShaderModule> meshVertFuture = load_shader_async("../../shaders/triangle_mesh.vert.spv");
+	std::future<VkShaderModule> meshPackedVertFuture = load_shader_async("../../shaders/triangle_mesh_packed.vert.spv");
+
+
+	VkPipelineLayoutCreateInfo pipeline_layout_info = vkinit::pipeline_layout_create_info();
+	VK_CHECK(vkCreatePipelineLayout(_device, &pipeline_layout_info, nullptr, &_trianglePipelineLayout));
+
+	VkPipelineLayoutCreateInfo mesh_pipeline_layout_info = vkinit::pipeline_layout_create_info();
+	mesh_pipeline_layout_info.setLayoutCount = 1;
+	mesh_pipeline_layout_info.pSetLayouts = &_objectSetLayout;
+
+	VkPushConstantRange push_constant;
+	push_constant.offset = 0;
+	push_constant.size = sizeof(MeshPushConstants);
+	push_constant.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+	mesh_pipeline_layout_info.pPushConstantRanges = &push_constant;
+	mesh_pipeline_layout_info.pushConstantRangeCount = 1;
+
+	VK_CHECK(vkCreatePipelineLayout(_device, &mesh_pipeline_layout_info, nullptr, &_meshPipelineLayout));
+
+	VkShaderModule triangleFragShader = triangleFragFuture.get();
+	VkShaderModule triangleVertexShader = triangleVertFuture.get();
+	VkShaderModule redTriangleFragShader = redTriangleFragFuture.get();
+	VkShaderModule redTriangleVertShader = redTriangleVertFuture.get();
+	VkShaderModule meshVertShader = meshVertFuture.get();
+	VkShaderModule meshPackedVertShader = meshPackedVertFuture.get();
+
+	//build the stage-create-info for both vertex and fragment stages. This lets the pipeline know the shader modules per stage
+	PipelineBuilder pipelineBuilder;
+	pipelineBuilder._shaderStages.push_back(vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT, triangleVertexShader));
+	pipelineBuilder._shaderStages.push_back(vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, triangleFragShader));
+
+	//vertex input controls how to read vertices from vertex buffers. We aren't using it yet
+	pipelineBuilder._vertexInputInfo = vkinit::vertex_input_state_create_info();
+
+	//input assembly is the configuration for drawing triangle lists, strips, or individual points.
+	//we are just going to draw triangle list
+	pipelineBuilder._inputAssembly = vkinit::input_assembly_create_info(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+
+	//build viewport and scissor from the swapchain extents
+	pipelineBuilder._viewport.x = 0.f;
 	pipelineBuilder._viewport.y = 0.f;
 	pipelineBuilder._viewport.width = (float)_windowExtent.width;
 	pipelineBuilder._viewport.height = (float)_windowExtent.height;
@@ -582,17 +1285,23 @@ void VulkanEngine::init_pipelines()
 	//a single blend attachment with no blending and writing to RGBA
 	pipelineBuilder._colorBlendAttachment = vkinit::color_blend_attachment_state();
 
+	//default depthtesting
+	pipelineBuilder._depthStencil = vkinit::depth_stencil_create_info(true, true, VK_COMPARE_OP_LESS_OR_EQUAL);
+
 	//use the triangle layout we created
 	pipelineBuilder._pipelineLayout = _trianglePipelineLayout;
 
-	_trianglePipeline = pipelineBuilder.build_pipeline(_device, _renderPass);
+	//Every description is collected first, then the whole batch compiles at once
+	std::vector<PipelineBuilder> builders;
+	builders.push_back(pipelineBuilder);
 
 	pipelineBuilder._shaderStages.clear();
 	pipelineBuilder._shaderStages.push_back(vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT, redTriangleVertShader));
 	pipelineBuilder._shaderStages.push_back(vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, redTriangleFragShader));
-	_redTrianglePipeline = pipelineBuilder.build_pipeline(_device, _renderPass);
+	builders.push_back(pipelineBuilder);
 
 	
+	//Must stay alive until the batch is done, the builders point into it
 	VertexInputDescription vertexDescription = Vertex::get_vertex_description();
 
 	pipelineBuilder._vertexInputInfo.pVertexAttributeDescriptions = vertexDescription.attributes.data();
@@ -602,20 +1311,34 @@ void VulkanEngine::init_pipelines()
 	pipelineBuilder._vertexInputInfo.vertexBindingDescriptionCount = vertexDescription.bindings.size();
 
 	pipelineBuilder._shaderStages.clear();
-
-	VkShaderModule meshVertShader;
-	if (!load_shader_module("../../shaders/triangle_mesh.vert.spv", &meshVertShader))
-	{
-		std::cout << "Error when building the triangle vertex shader module" << std::endl;
-	}
-
 	pipelineBuilder._shaderStages.push_back(vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT, meshVertShader));
 	pipelineBuilder._shaderStages.push_back(vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, triangleFragShader));
 
 	pipelineBuilder._pipelineLayout = _meshPipelineLayout;
-	_meshPipeline = pipelineBuilder.build_pipeline(_device, _renderPass);
+	builders.push_back(pipelineBuilder);
+
+	VertexInputDescription packedVertexDescription = PackedVertex::get_vertex_description();
+
+	pipelineBuilder._vertexInputInfo.pVertexAttributeDescriptions = packedVertexDescription.attributes.data();
+	pipelineBuilder._vertexInputInfo.vertexAttributeDescriptionCount = packedVertexDescription.attributes.size();
+
+	pipelineBuilder._vertexInputInfo.pVertexBindingDescriptions = packedVertexDescription.bindings.data();
+	pipelineBuilder._vertexInputInfo.vertexBindingDescriptionCount = packedVertexDescription.bindings.size();
+
+	pipelineBuilder._shaderStages.clear();
+	pipelineBuilder._shaderStages.push_back(vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_VERTEX_BIT, meshPackedVertShader));
+	pipelineBuilder._shaderStages.push_back(vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_FRAGMENT_BIT, triangleFragShader));
+	builders.push_back(pipelineBuilder);
+
+	std::vector<std::future<VkPipeline>> pipelines = PipelineBuilder::build_pipelines_async(_jobs, _device, _renderPass, _pipelineCache, builders);
+
+	_trianglePipeline = pipelines[0].get();
+	_redTrianglePipeline = pipelines[1].get();
+	_meshPipeline = pipelines[2].get();
+	_meshPackedPipeline = pipelines[3].get();
 
 	vkDestroyShaderModule(_device, meshVertShader, nullptr);
+	vkDestroyShaderModule(_device, meshPackedVertShader, nullptr);
 	vkDestroyShaderModule(_device, redTriangleVertShader, nullptr);
 	vkDestroyShaderModule(_device, redTriangleFragShader, nullptr);
 	vkDestroyShaderModule(_device, triangleFragShader, nullptr);
@@ -626,6 +1349,7 @@ void VulkanEngine::init_pipelines()
 			vkDestroyPipeline(_device, _redTrianglePipeline, nullptr);
 			vkDestroyPipeline(_device, _trianglePipeline, nullptr);
 			vkDestroyPipeline(_device, _meshPipeline, nullptr);
+			vkDestroyPipeline(_device, _meshPackedPipeline, nullptr);
 
 			vkDestroyPipelineLayout(_device, _trianglePipelineLayout, nullptr);
 			vkDestroyPipelineLayout(_device, _meshPipelineLayout, nullptr);
@@ -673,6 +1397,8 @@ bool VulkanEngine::load_shader_module(const char* filePath, VkShaderModule* outS
 
 void VulkanEngine::load_meshes()
 {
+	VK_TRACE_ZONE("load_meshes");
+
 	std::vector<Vertex>& _vertices = _triangleMesh._vertices;
 	_vertices.resize(3);
 
@@ -684,40 +1410,1001 @@ void VulkanEngine::load_meshes()
 	_vertices[1].color = { 0.f, 1.f, 0.f };
 	_vertices[2].color = { 0.f, 1.f, 0.f };
 
-	_monkeyMesh.load_from_obj("../../assets/monkey_smooth.obj");
+	_triangleMesh._indices = { 0, 1, 2 };
+	_triangleMesh.compute_bounds();
 
 	upload_mesh(_triangleMesh);
-	upload_mesh(_monkeyMesh);
+
+	//asset_baker writes one file per vertex format, the OBJ is only parsed when that file is missing or stale
+	const char* monkeySource = "../../assets/monkey_smooth.obj";
+	const char* monkeyAsset = _packedVertices ? "../../assets/monkey_smooth.packed.mesh" : "../../assets/monkey_smooth.mesh";
+	if (!load_baked_mesh(_monkeyMesh, monkeyAsset, monkeySource))
+	{
+		std::cout << "Processing " << monkeySource << ", run asset_baker to skip this on the next launch" << std::endl;
+
+		vkobj::load_obj(monkeySource, _monkeyMesh, _jobs);
+
+		//Reorder for the post-transform cache, overdraw and vertex fetch before anything reaches the GPU
+		vkmeshopt::optimize_mesh(_monkeyMesh, "monkey_smooth");
+
+		//Coarser levels go after the full mesh in the same index buffer
+		vklod::generate_lods(_monkeyMesh, "monkey_smooth");
+
+		if (_packedVertices)
+		{
+			_monkeyMesh.pack_vertices();
+		}
+
+		upload_mesh(_monkeyMesh);
+	}
+
+	//Both meshes go out in a single submit
+	_uploader.wait_idle();
+
+	const UploadStats& uploadStats = _uploader.get_stats();
+	std::cout << "Uploaded " << uploadStats.bytesUploaded << " bytes in " << uploadStats.batchesSubmitted << " batch(es) at "
+		<< uploadStats.get_bytes_per_second() / (1024.0 * 1024.0) << " MB/s" << std::endl;
+}
+
+void VulkanEngine::init_scene()
+{
+	VK_TRACE_ZONE("init_scene");
+
+	Material* meshMaterial = _scene.create_material("defaultmesh", _meshPipeline, _meshPipelineLayout);
+	Material* packedMaterial = _scene.create_material("packedmesh", _meshPackedPipeline, _meshPipelineLayout);
+
+	auto material_for = [&](const Mesh& mesh) {
+		return mesh._vertexFormat == VertexFormat::Packed ? packedMaterial : meshMaterial;
+	};
+
+	//The spinning monkey, draw() moves it along the frame pose
+	RenderObject monkey;
+	monkey.mesh = &_monkeyMesh;
+	monkey.material = material_for(_monkeyMesh);
+	_heroObject = _scene.add_object(monkey, glm::mat4{ 1.f });
+
+	//A wall of triangles behind it with a monkey every few cells, added interleaved so the sort has work to do
+	for (int x = -20; x < 20; ++x)
+	{
+		for (int y = -20; y < 20; ++y)
+		{
+			glm::vec3 position = { x * 1.5f, y * 1.5f, -25.f };
+
+			RenderObject triangle;
+			triangle.mesh = &_triangleMesh;
+			triangle.material = material_for(_triangleMesh);
+			_scene.add_object(triangle, glm::translate(position) * glm::scale(glm::vec3(0.5f)));
+
+			if ((x + y) % 5 == 0)
+			{
+				RenderObject background;
+				background.mesh = &_monkeyMesh;
+				background.material = material_for(_monkeyMesh);
+				_scene.add_object(background, glm::translate(position + glm::vec3(0.f, 0.f, 5.f)) * glm::scale(glm::vec3(0.6f)));
+			}
+		}
+	}
+
+	std::cout << "Scene holds " << _scene.get_object_count() << " objects" << std::endl;
+
+	//The scene is fixed from here on, every frame gets room for all of its matrices
+	for (uint32_t i = 0; i < _framesInFlight; ++i)
+	{
+		FrameData& frame = _frames[i];
+
+		VkBufferCreateInfo bufferInfo = {};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = _scene.get_object_count() * sizeof(GPUObjectData);
+		bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+		//Written straight from the transform kernel, the GPU reads it once per draw.
+		//The object culling pass writes it on the GPU instead, then it never leaves video memory.
+		VmaAllocationCreateInfo vmaallocInfo = {};
+		vmaallocInfo.usage = _gpuCulling ? VMA_MEMORY_USAGE_GPU_ONLY : VMA_MEMORY_USAGE_CPU_TO_GPU;
+		vmaallocInfo.flags = _gpuCulling ? 0 : VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+		VmaAllocationInfo allocationInfo;
+		VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaallocInfo, &frame._objectBuffer._buffer, &frame._objectBuffer._allocation, &allocationInfo));
+		frame._objectData = (GPUObjectData*)allocationInfo.pMappedData;
+
+		//Indirect draws pick their object with firstInstance through the first half, draw_objects fills the second
+		size_t objectCount = _scene.get_object_count();
+		bufferInfo.size = std::max<size_t>(2 * objectCount, 1) * sizeof(uint32_t);
+
+		VmaAllocationCreateInfo instanceAllocInfo = {};
+		instanceAllocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+		instanceAllocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+		VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &instanceAllocInfo, &frame._instanceBuffer._buffer, &frame._instanceBuffer._allocation, &allocationInfo));
+		frame._instanceData = (uint32_t*)allocationInfo.pMappedData;
+
+		for (uint32_t handle = 0; handle < (uint32_t)objectCount; ++handle)
+		{
+			frame._instanceData[handle] = handle;
+		}
+		VK_CHECK(vmaFlushAllocation(_allocator, frame._instanceBuffer._allocation, 0, VK_WHOLE_SIZE));
+
+		_mainDeletionQueue.push_function(
+			[=]() {
+				vmaDestroyBuffer(_allocator, _frames[i]._objectBuffer._buffer, _frames[i]._objectBuffer._allocation);
+				vmaDestroyBuffer(_allocator, _frames[i]._instanceBuffer._buffer, _frames[i]._instanceBuffer._allocation);
+			});
+	}
+}
+
+void VulkanEngine::draw_objects(VkCommandBuffer cmd, FrameData& frame, const glm::mat4& projection, const glm::mat4& view, const glm::vec3& cameraPosition)
+{
+	VK_TRACE_ZONE("draw_objects");
+
+	DrawStats stats;
+
+	glm::mat4 viewProjection = projection * view;
+
+	//Off-screen objects never reach the loop, what is left keeps the sorted order
+	_lastCullStats = CullStats{};
+	_lastCullStats.visible = (uint32_t)_scene.get_object_count();
+	const std::vector<uint32_t>& objects = _frustumCulling ? _scene.cull(viewProjection, _lastCullStats, _hierarchicalCulling) : _scene.get_draw_order();
+
+	//Every object's matrix at once, straight into the mapped buffer the shaders index by instance
+	static_assert(sizeof(GPUObjectData) == sizeof(glm::mat4), "the transform kernel writes bare matrices");
+	vktransform::compute_mvp(viewProjection, _scene.get_transforms(), (glm::mat4*)frame._objectData, &_jobs);
+	VK_CHECK(vmaFlushAllocation(_allocator, frame._objectBuffer._allocation, 0, VK_WHOLE_SIZE));
+
+	float projectionScale = get_projection_scale();
+
+	//Same layout for every mesh material, it stays bound across their pipelines
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _meshPipelineLayout, 0, 1, &frame._objectSet, 0, nullptr);
+	stats.descriptorSetBinds++;
+
+	BoundDrawState bound;
+
+	//Instanced draws list their objects behind the identity slots of the instance buffer
+	uint32_t firstInstance = (uint32_t)_scene.get_object_count();
+	uint32_t instanceCount = 0;
+
+	size_t next = 0;
+	while (next < objects.size())
+	{
+		uint32_t handle = objects[next];
+		const RenderObject& object = _scene.get_object(handle);
+		const Mesh& mesh = *object.mesh;
+
+		//The hero's triangles come out of this frame's meshlet culling pass instead of its own index buffer
+		if (_meshletCulling && handle == _heroObject)
+		{
+			bind_draw_state(cmd, *object.material, mesh, frame._meshletIndexBuffer._buffer, VK_INDEX_TYPE_UINT32, bound, stats);
+			vkCmdDrawIndexedIndirect(cmd, frame._meshletDrawBuffer._buffer, 0, 1, sizeof(VkDrawIndexedIndirectCommand));
+			stats.draws++;
+			stats.instances++;
+			next++;
+			continue;
+		}
+
+		//The sort keeps equal materials and meshes next to each other, the run ends wherever either changes
+		for (; next < objects.size(); ++next)
+		{
+			uint32_t runHandle = objects[next];
+			const RenderObject& runObject = _scene.get_object(runHandle);
+			if (runObject.material != object.material || runObject.mesh != object.mesh || (_meshletCulling && runHandle == _heroObject))
+				break;
+
+			uint32_t level = 0;
+			if (!mesh._lods.empty() && _lodPixelError > 0.f)
+			{
+				//The model matrix columns hold the object's scale and position
+				glm::mat4 transform = _scene.get_transform(runHandle);
+				float scale = std::max({ glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1])), glm::length(glm::vec3(transform[2])) });
+				float distance = glm::length(glm::vec3(transform[3]) - cameraPosition);
+				level = vklod::select_lod(mesh, distance, scale, projectionScale, _lodPixelError);
+			}
+			_lodInstances[level].push_back(runHandle);
+		}
+
+		bind_draw_state(cmd, *object.material, mesh, mesh._indexBuffer._buffer, mesh._indexType, bound, stats);
+
+		//One draw per level the run uses, its instances index the handles written just before it
+		for (uint32_t level = 0; level < vklod::MAX_LODS; ++level)
+		{
+			std::vector<uint32_t>& instances = _lodInstances[level];
+			if (instances.empty())
+				continue;
+
+			uint32_t firstIndex = mesh._lods.empty() ? 0 : mesh._lods[level].firstIndex;
+			uint32_t indexCount = mesh._lods.empty() ? mesh._indexCount : mesh._lods[level].indexCount;
+
+			memcpy(frame._instanceData + firstInstance + instanceCount, instances.data(), instances.size() * sizeof(uint32_t));
+			vkCmdDrawIndexed(cmd, indexCount, (uint32_t)instances.size(), firstIndex, 0, firstInstance + instanceCount);
+
+			instanceCount += (uint32_t)instances.size();
+			stats.draws++;
+			stats.instances += (uint32_t)instances.size();
+			instances.clear();
+		}
+	}
+
+	VK_CHECK(vmaFlushAllocation(_allocator, frame._instanceBuffer._allocation, 0, VK_WHOLE_SIZE));
+
+	_lastDrawStats = stats;
+}
+
+void VulkanEngine::draw_batches(VkCommandBuffer cmd, FrameData& frame, CullPhase phase)
+{
+	VK_TRACE_ZONE("draw_batches");
+
+	//The late pass adds to what the early one recorded
+	DrawStats stats = phase == CullPhase::Late ? _lastDrawStats : DrawStats{};
+
+	//The late phase's commands and counts sit behind the early phase's
+	VkDeviceSize firstCommand = phase == CullPhase::Late ? _gpuCullScene.commandCount : 0;
+	VkDeviceSize firstCount = phase == CullPhase::Late ? _gpuCullScene.batches.size() : 0;
+
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, _meshPipelineLayout, 0, 1, &frame._objectSet, 0, nullptr);
+	stats.descriptorSetBinds++;
+
+	BoundDrawState bound;
+
+	//The CPU cost follows the batch count, the object count only matters to the culling dispatch
+	for (uint32_t b = 0; b < (uint32_t)_gpuCullScene.batches.size(); ++b)
+	{
+		const DrawBatch& batch = _gpuCullScene.batches[b];
+		bind_draw_state(cmd, *batch.material, *batch.mesh, batch.mesh->_indexBuffer._buffer, batch.mesh->_indexType, bound, stats);
+
+		VkDeviceSize commandOffset = (firstCommand + batch.firstCommand) * sizeof(VkDrawIndexedIndirectCommand);
+		if (_vkCmdDrawIndexedIndirectCount != nullptr)
+		{
+			_vkCmdDrawIndexedIndirectCount(cmd, frame._drawCommandBuffer._buffer, commandOffset, frame._drawCountBuffer._buffer, (firstCount + b) * sizeof(uint32_t), batch.commandCount, sizeof(VkDrawIndexedIndirectCommand));
+		}
+		else
+		{
+			vkCmdDrawIndexedIndirect(cmd, frame._drawCommandBuffer._buffer, commandOffset, batch.commandCount, sizeof(VkDrawIndexedIndirectCommand));
+		}
+		stats.draws++;
+	}
+
+	//The hero was left out of the batches, its triangles come from the meshlet pass
+	if (_meshletCulling && phase != CullPhase::Late)
+	{
+		const RenderObject& hero = _scene.get_object(_heroObject);
+		bind_draw_state(cmd, *hero.material, *hero.mesh, frame._meshletIndexBuffer._buffer, VK_INDEX_TYPE_UINT32, bound, stats);
+		vkCmdDrawIndexedIndirect(cmd, frame._meshletDrawBuffer._buffer, 0, 1, sizeof(VkDrawIndexedIndirectCommand));
+		stats.draws++;
+	}
+
+	_lastDrawStats = stats;
 }
 
 void VulkanEngine::upload_mesh(Mesh& mesh)
 {
-	VkBufferCreateInfo bufferInfo = {};
-	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	bufferInfo.size = mesh._vertices.size() * sizeof(Vertex);
-	bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	VK_TRACE_ZONE("upload_mesh");
 
-	VmaAllocationCreateInfo vmaallocInfo = {};
-	vmaallocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+	//Goes through the staging ring into GPU_ONLY memory, the copy is submitted with the next flush
+	if (mesh._vertexFormat == VertexFormat::Packed)
+	{
+		mesh._vertexBuffer = _uploader.upload_buffer(mesh._packedVertices.data(), mesh._packedVertices.size() * sizeof(PackedVertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+	}
+	else
+	{
+		mesh._vertexBuffer = _uploader.upload_buffer(mesh._vertices.data(), mesh._vertices.size() * sizeof(Vertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+	}
+
+	mesh._indexCount = (uint32_t)mesh._indices.size();
+
+	//16 bit indices halve the index buffer, 0xFFFF stays free as it means primitive restart
+	if (mesh._vertices.size() < 0xFFFF)
+	{
+		std::vector<uint16_t> indices16(mesh._indices.begin(), mesh._indices.end());
 
-	VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaallocInfo, &mesh._vertexBuffer._buffer, &mesh._vertexBuffer._allocation, nullptr));
+		mesh._indexType = VK_INDEX_TYPE_UINT16;
+		mesh._indexBuffer = _uploader.upload_buffer(indices16.data(), indices16.size() * sizeof(uint16_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+	}
+	else
+	{
+		mesh._indexType = VK_INDEX_TYPE_UINT32;
+		mesh._indexBuffer = _uploader.upload_buffer(mesh._indices.data(), mesh._indices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+	}
 
 	_mainDeletionQueue.push_function(
 		[=]() {
 			vmaDestroyBuffer(_allocator, mesh._vertexBuffer._buffer, mesh._vertexBuffer._allocation);
+			vmaDestroyBuffer(_allocator, mesh._indexBuffer._buffer, mesh._indexBuffer._allocation);
+		});
+}
+
+bool VulkanEngine::load_baked_mesh(Mesh& mesh, const char* path, const char* sourcePath)
+{
+	VK_TRACE_ZONE("load_baked_mesh");
+
+	MappedFile file;
+	if (!file.open(path))
+		return false;
+
+	vkasset::AssetView view;
+	vkasset::MeshInfo info;
+	if (!vkasset::read_asset(file, view) || !vkasset::read_mesh_info(view, info))
+	{
+		std::cout << "Ignoring invalid mesh asset " << path << std::endl;
+		return false;
+	}
+
+	//Same hash asset_baker stored, an edited OBJ or a newer baker no longer matches. Without the source the bake is all there is.
+	MappedFile source;
+	if (source.open(sourcePath))
+	{
+		vkasset::BakeKind kind = info.vertexFormat == VertexFormat::Packed ? vkasset::BakeKind::PackedMesh : vkasset::BakeKind::Mesh;
+		uint64_t sourceHash = vkasset::hash_bytes(source.data(), source.size(), vkasset::get_bake_seed(kind, view.header->compression));
+		if (sourceHash != view.header->sourceHash)
+		{
+			std::cout << "Ignoring stale mesh asset " << path << ", it was baked from another version of " << sourcePath << std::endl;
+			return false;
+		}
+	}
+
+	//Uncompressed blobs are copied into staging straight from the mapping, compressed ones are unpacked first
+	const uint8_t* blob = view.blob;
+	std::vector<uint8_t> unpacked;
+	if (view.header->compression != vkasset::AssetCompression::None)
+	{
+		unpacked.resize(view.header->blobRawSize);
+		if (!vkasset::unpack_blob(view, unpacked.data()))
+		{
+			std::cout << "Ignoring corrupted mesh asset " << path << std::endl;
+			return false;
+		}
+		blob = unpacked.data();
+	}
+
+	mesh._vertexFormat = info.vertexFormat;
+	mesh._positionOffset = { info.positionOffset[0], info.positionOffset[1], info.positionOffset[2] };
+	mesh._positionScale = { info.positionScale[0], info.positionScale[1], info.positionScale[2] };
+	mesh._indexCount = info.indexCount;
+	mesh._indexType = info.indexSize == sizeof(uint16_t) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+	mesh._lods = info.lods;
+	mesh._boundsMin = { info.boundsMin[0], info.boundsMin[1], info.boundsMin[2] };
+	mesh._boundsMax = { info.boundsMax[0], info.boundsMax[1], info.boundsMax[2] };
+	mesh._boundingSphere = { info.boundingSphere[0], info.boundingSphere[1], info.boundingSphere[2], info.boundingSphere[3] };
+
+	mesh._vertexBuffer = _uploader.upload_buffer(blob, info.vertexDataSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+	mesh._indexBuffer = _uploader.upload_buffer(blob + info.indexDataOffset, info.indexDataSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+
+	//The meshlet builder needs the geometry on the CPU as well
+	if (_meshletCulling)
+	{
+		if (info.vertexFormat == VertexFormat::Packed)
+		{
+			const PackedVertex* vertices = (const PackedVertex*)blob;
+			mesh._packedVertices.assign(vertices, vertices + info.vertexCount);
+		}
+		else
+		{
+			const Vertex* vertices = (const Vertex*)blob;
+			mesh._vertices.assign(vertices, vertices + info.vertexCount);
+		}
+
+		mesh._indices.resize(info.indexCount);
+		for (uint32_t i = 0; i < info.indexCount; ++i)
+		{
+			const uint8_t* index = blob + info.indexDataOffset + i * info.indexSize;
+			mesh._indices[i] = info.indexSize == sizeof(uint16_t) ? *(const uint16_t*)index : *(const uint32_t*)index;
+		}
+	}
+
+	_mainDeletionQueue.push_function(
+		[=, &mesh]() {
+			vmaDestroyBuffer(_allocator, mesh._vertexBuffer._buffer, mesh._vertexBuffer._allocation);
+			vmaDestroyBuffer(_allocator, mesh._indexBuffer._buffer, mesh._indexBuffer._allocation);
+		});
+
+	std::cout << "Loaded baked mesh " << path << ": " << info.vertexCount << " vertices, " << info.indexCount << " indices" << std::endl;
+	return true;
+}
+
+void VulkanEngine::init_meshlet_culling()
+{
+	VK_TRACE_ZONE("init_meshlet_culling");
+
+	//Full detail only, the culling pass already trims what the camera can't see
+	std::vector<uint32_t> indices = _monkeyMesh._indices;
+	if (!_monkeyMesh._lods.empty())
+	{
+		indices.resize(_monkeyMesh._lods[0].indexCount);
+	}
+
+	vkmeshlet::build_meshlets(_monkeyMesh.get_positions(), indices, _monkeyMeshlets);
+
+	_monkeyMeshlets._meshletBuffer = _uploader.upload_buffer(_monkeyMeshlets._meshlets.data(), _monkeyMeshlets._meshlets.size() * sizeof(Meshlet), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	_monkeyMeshlets._vertexBuffer = _uploader.upload_buffer(_monkeyMeshlets._vertices.data(), _monkeyMeshlets._vertices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	_monkeyMeshlets._triangleBuffer = _uploader.upload_buffer(_monkeyMeshlets._triangles.data(), _monkeyMeshlets._triangles.size() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	_uploader.wait_idle();
+
+	_mainDeletionQueue.push_function(
+		[=]() {
+			vmaDestroyBuffer(_allocator, _monkeyMeshlets._meshletBuffer._buffer, _monkeyMeshlets._meshletBuffer._allocation);
+			vmaDestroyBuffer(_allocator, _monkeyMeshlets._vertexBuffer._buffer, _monkeyMeshlets._vertexBuffer._allocation);
+			vmaDestroyBuffer(_allocator, _monkeyMeshlets._triangleBuffer._buffer, _monkeyMeshlets._triangleBuffer._allocation);
+		});
+
+	//Meshlets, meshlet vertices, meshlet triangles, output indices, indirect draw
+	const uint32_t bindingCount = 5;
+	VkDescriptorSetLayoutBinding bindings[bindingCount];
+	for (uint32_t i = 0; i < bindingCount; ++i)
+	{
+		bindings[i] = {};
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo setLayoutInfo = {};
+	setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	setLayoutInfo.bindingCount = bindingCount;
+	setLayoutInfo.pBindings = bindings;
+
+	VK_CHECK(vkCreateDescriptorSetLayout(_device, &setLayoutInfo, nullptr, &_meshletCullSetLayout));
+
+	VkPushConstantRange pushConstant;
+	pushConstant.offset = 0;
+	pushConstant.size = sizeof(MeshletCullConstants);
+	pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = vkinit::pipeline_layout_create_info();
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &_meshletCullSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstant;
+
+	VK_CHECK(vkCreatePipelineLayout(_device, &pipelineLayoutInfo, nullptr, &_meshletCullPipelineLayout));
+
+	VkShaderModule cullShader;
+	if (!load_shader_module("../../shaders/meshlet_cull.comp.spv", &cullShader))
+	{
+		std::cout << "Error when building the shader module ../../shaders/meshlet_cull.comp.spv" << std::endl;
+	}
+
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, cullShader);
+	pipelineInfo.layout = _meshletCullPipelineLayout;
+
+	VK_CHECK(vkCreateComputePipelines(_device, _pipelineCache, 1, &pipelineInfo, nullptr, &_meshletCullPipeline));
+
+	vkDestroyShaderModule(_device, cullShader, nullptr);
+
+	_mainDeletionQueue.push_function(
+		[=]() {
+			vkDestroyPipeline(_device, _meshletCullPipeline, nullptr);
+			vkDestroyPipelineLayout(_device, _meshletCullPipelineLayout, nullptr);
+			vkDestroyDescriptorSetLayout(_device, _meshletCullSetLayout, nullptr);
+		});
+
+	//Room for every triangle, in case nothing gets culled
+	uint32_t triangleCount = (uint32_t)_monkeyMeshlets._triangles.size();
+
+	for (uint32_t i = 0; i < _framesInFlight; ++i)
+	{
+		FrameData& frame = _frames[i];
+
+		VkBufferCreateInfo bufferInfo = {};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = triangleCount * 3 * sizeof(uint32_t);
+		bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+
+		VmaAllocationCreateInfo vmaallocInfo = {};
+		vmaallocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+		VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaallocInfo, &frame._meshletIndexBuffer._buffer, &frame._meshletIndexBuffer._allocation, nullptr));
+
+		bufferInfo.size = sizeof(VkDrawIndexedIndirectCommand);
+		bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+		VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaallocInfo, &frame._meshletDrawBuffer._buffer, &frame._meshletDrawBuffer._allocation, nullptr));
+
+		_mainDeletionQueue.push_function(
+			[=]() {
+				vmaDestroyBuffer(_allocator, _frames[i]._meshletIndexBuffer._buffer, _frames[i]._meshletIndexBuffer._allocation);
+				vmaDestroyBuffer(_allocator, _frames[i]._meshletDrawBuffer._buffer, _frames[i]._meshletDrawBuffer._allocation);
+			});
+	}
+}
+
+void VulkanEngine::cull_meshlets(VkCommandBuffer cmd, FrameData& frame, const glm::mat4& projection, const glm::mat4& view, const glm::mat4& model)
+{
+	ScopedGpuZone cullZone(_gpuProfiler, cmd, "meshlet cull");
+
+	//Start from an empty draw, the shader appends the surviving triangles
+	//firstInstance picks the hero's matrix in the object buffer
+	VkDrawIndexedIndirectCommand emptyDraw = { 0, 1, 0, 0, _heroObject };
+	vkCmdUpdateBuffer(cmd, frame._meshletDrawBuffer._buffer, 0, sizeof(emptyDraw), &emptyDraw);
+
+	VkMemoryBarrier resetBarrier = {};
+	resetBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	resetBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	resetBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &resetBarrier, 0, nullptr, 0, nullptr);
+
+	//Packed positions are dequantized by the draw, the meshlet bounds are already in mesh space
+	MeshletCullConstants constants = vkmeshlet::get_cull_constants(projection, view, model);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _meshletCullPipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _meshletCullPipelineLayout, 0, 1, &frame._meshletCullSet, 0, nullptr);
+	vkCmdPushConstants(cmd, _meshletCullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(MeshletCullConstants), &constants);
+	vkCmdDispatch(cmd, (uint32_t)_monkeyMeshlets._meshlets.size(), 1, 1);
+
+	//The draw reads the command and the indices the dispatch just wrote
+	VkMemoryBarrier cullBarrier = {};
+	cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &cullBarrier, 0, nullptr, 0, nullptr);
+}
+
+//Largest power of two not above the value, the pyramid halves exactly from its first level on
+static uint32_t previous_pow2(uint32_t value)
+{
+	uint32_t result = 1;
+	while (result * 2 <= value)
+	{
+		result *= 2;
+	}
+	return result;
+}
+
+void VulkanEngine::init_depth_pyramid()
+{
+	VK_TRACE_ZONE("init_depth_pyramid");
+
+	_depthPyramidExtent = { previous_pow2(_windowExtent.width), previous_pow2(_windowExtent.height) };
+
+	_depthPyramidLevels = 1;
+	while ((std::max(_depthPyramidExtent.width, _depthPyramidExtent.height) >> _depthPyramidLevels) > 0)
+	{
+		_depthPyramidLevels++;
+	}
+
+	VkImageCreateInfo imageInfo = vkinit::image_create_info(VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, { _depthPyramidExtent.width, _depthPyramidExtent.height, 1 });
+	imageInfo.mipLevels = _depthPyramidLevels;
+
+	VmaAllocationCreateInfo imageAllocInfo = {};
+	imageAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+	VK_CHECK(vmaCreateImage(_allocator, &imageInfo, &imageAllocInfo, &_depthPyramid._image, &_depthPyramid._allocation, nullptr));
+
+	//The culling shader samples every level, each reduction writes one
+	VkImageViewCreateInfo viewInfo = vkinit::imageview_create_info(VK_FORMAT_R32_SFLOAT, _depthPyramid._image, VK_IMAGE_ASPECT_COLOR_BIT);
+	viewInfo.subresourceRange.levelCount = _depthPyramidLevels;
+
+	VK_CHECK(vkCreateImageView(_device, &viewInfo, nullptr, &_depthPyramidView));
+
+	_depthPyramidMips.resize(_depthPyramidLevels);
+	for (uint32_t level = 0; level < _depthPyramidLevels; ++level)
+	{
+		viewInfo.subresourceRange.baseMipLevel = level;
+		viewInfo.subresourceRange.levelCount = 1;
+
+		VK_CHECK(vkCreateImageView(_device, &viewInfo, nullptr, &_depthPyramidMips[level]));
+	}
+
+	//Point sampling, a filtered depth would no longer be the farthest of its area
+	VkSamplerCreateInfo samplerInfo = {};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_NEAREST;
+	samplerInfo.minFilter = VK_FILTER_NEAREST;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.minLod = 0.f;
+	samplerInfo.maxLod = (float)_depthPyramidLevels;
+
+	VK_CHECK(vkCreateSampler(_device, &samplerInfo, nullptr, &_depthPyramidSampler));
+
+	_mainDeletionQueue.push_function(
+		[=]() {
+			vkDestroySampler(_device, _depthPyramidSampler, nullptr);
+			for (VkImageView view : _depthPyramidMips)
+			{
+				vkDestroyImageView(_device, view, nullptr);
+			}
+			vkDestroyImageView(_device, _depthPyramidView, nullptr);
+			vmaDestroyImage(_allocator, _depthPyramid._image, _depthPyramid._allocation);
+		});
+
+	//Without occlusion culling the pyramid is only there for the culling set to point at, it never gets built
+	if (!_occlusionCulling)
+		return;
+
+	//Level below, level written
+	VkDescriptorSetLayoutBinding bindings[2] = {};
+	bindings[0].binding = 0;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	bindings[0].descriptorCount = 1;
+	bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	bindings[1].binding = 1;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	bindings[1].descriptorCount = 1;
+	bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkDescriptorSetLayoutCreateInfo setLayoutInfo = {};
+	setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	setLayoutInfo.bindingCount = 2;
+	setLayoutInfo.pBindings = bindings;
+
+	VK_CHECK(vkCreateDescriptorSetLayout(_device, &setLayoutInfo, nullptr, &_depthReduceSetLayout));
+
+	VkPushConstantRange pushConstant;
+	pushConstant.offset = 0;
+	pushConstant.size = sizeof(DepthReduceConstants);
+	pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = vkinit::pipeline_layout_create_info();
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &_depthReduceSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstant;
+
+	VK_CHECK(vkCreatePipelineLayout(_device, &pipelineLayoutInfo, nullptr, &_depthReducePipelineLayout));
+
+	VkShaderModule reduceShader;
+	if (!load_shader_module("../../shaders/depth_reduce.comp.spv", &reduceShader))
+	{
+		std::cout << "Error when building the shader module ../../shaders/depth_reduce.comp.spv" << std::endl;
+	}
+
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, reduceShader);
+	pipelineInfo.layout = _depthReducePipelineLayout;
+
+	VK_CHECK(vkCreateComputePipelines(_device, _pipelineCache, 1, &pipelineInfo, nullptr, &_depthReducePipeline));
+
+	vkDestroyShaderModule(_device, reduceShader, nullptr);
+
+	_mainDeletionQueue.push_function(
+		[=]() {
+			vkDestroyPipeline(_device, _depthReducePipeline, nullptr);
+			vkDestroyPipelineLayout(_device, _depthReducePipelineLayout, nullptr);
+			vkDestroyDescriptorSetLayout(_device, _depthReduceSetLayout, nullptr);
 		});
 
+	_depthReduceSets.resize(_depthPyramidLevels);
+
+	for (uint32_t level = 0; level < _depthPyramidLevels; ++level)
+	{
+		_depthReduceSets[level] = _descriptorAllocator.allocate(_depthReduceSetLayout);
 
-	void* data;
-	vmaMapMemory(_allocator, mesh._vertexBuffer._allocation, &data);
+		//build_depth_pyramid moves the depth image to SHADER_READ_ONLY for the reduction, the pyramid stays in GENERAL
+		VkDescriptorImageInfo sourceInfo = level == 0
+			? VkDescriptorImageInfo{ _depthPyramidSampler, _depthImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL }
+			: VkDescriptorImageInfo{ _depthPyramidSampler, _depthPyramidMips[level - 1], VK_IMAGE_LAYOUT_GENERAL };
+		VkDescriptorImageInfo destinationInfo = { VK_NULL_HANDLE, _depthPyramidMips[level], VK_IMAGE_LAYOUT_GENERAL };
+
+		VkWriteDescriptorSet writes[2] = {};
+		for (uint32_t b = 0; b < 2; ++b)
+		{
+			writes[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			writes[b].dstSet = _depthReduceSets[level];
+			writes[b].dstBinding = b;
+			writes[b].descriptorCount = 1;
+			writes[b].descriptorType = bindings[b].descriptorType;
+		}
+		writes[0].pImageInfo = &sourceInfo;
+		writes[1].pImageInfo = &destinationInfo;
+
+		vkUpdateDescriptorSets(_device, 2, writes, 0, nullptr);
+	}
+
+	std::cout << "Depth pyramid is " << _depthPyramidExtent.width << "x" << _depthPyramidExtent.height << " with " << _depthPyramidLevels << " levels" << std::endl;
+}
+
+void VulkanEngine::build_depth_pyramid(VkCommandBuffer cmd)
+{
+	VK_TRACE_ZONE("build_depth_pyramid");
+
+	ScopedGpuZone pyramidZone(_gpuProfiler, cmd, "depth pyramid");
+
+	//Waits for the early pass's depth, and for the early cull to be done reading the visibility the late one rewrites
+	VkImageMemoryBarrier depthBarrier = {};
+	depthBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	depthBarrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	depthBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	depthBarrier.oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+	depthBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	depthBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	depthBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	depthBarrier.image = _depthImage._image;
+	depthBarrier.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &depthBarrier);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _depthReducePipeline);
+
+	for (uint32_t level = 0; level < _depthPyramidLevels; ++level)
+	{
+		DepthReduceConstants constants;
+		constants.destinationSize = { std::max(_depthPyramidExtent.width >> level, 1u), std::max(_depthPyramidExtent.height >> level, 1u) };
+		constants.sourceSize = level == 0
+			? glm::uvec2(_windowExtent.width, _windowExtent.height)
+			: glm::uvec2(std::max(_depthPyramidExtent.width >> (level - 1), 1u), std::max(_depthPyramidExtent.height >> (level - 1), 1u));
+
+		vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _depthReducePipelineLayout, 0, 1, &_depthReduceSets[level], 0, nullptr);
+		vkCmdPushConstants(cmd, _depthReducePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(DepthReduceConstants), &constants);
+		vkCmdDispatch(cmd, (constants.destinationSize.x + 7) / 8, (constants.destinationSize.y + 7) / 8, 1);
+
+		//The next level reduces this one, the late cull samples them all
+		VkImageMemoryBarrier levelBarrier = {};
+		levelBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		levelBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+		levelBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		levelBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		levelBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		levelBarrier.image = _depthPyramid._image;
+		levelBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1 };
+
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &levelBarrier);
+	}
 
-	//Fastest way to copy chunk of memory
-	memcpy(data, mesh._vertices.data(), mesh._vertices.size() * sizeof(Vertex));
+	//The late pass keeps testing and writing the same depth
+	depthBarrier.srcAccessMask = 0;
+	depthBarrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	depthBarrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	depthBarrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
-	vmaUnmapMemory(_allocator, mesh._vertexBuffer._allocation);
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, 0, 0, nullptr, 0, nullptr, 1, &depthBarrier);
 }
 
-VkPipeline PipelineBuilder::build_pipeline(VkDevice device, VkRenderPass pass)
+void VulkanEngine::init_object_culling()
+{
+	VK_TRACE_ZONE("init_object_culling");
+
+	//The scene is complete, its batches and tables never change from here on
+	vkgpucull::build_cull_scene(_scene, _meshletCulling ? _heroObject : UINT32_MAX, _gpuCullScene);
+
+	_cullObjectBuffer = _uploader.upload_buffer(_gpuCullScene.objects.data(), _gpuCullScene.objects.size() * sizeof(GPUCullObject), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	_cullMeshBuffer = _uploader.upload_buffer(_gpuCullScene.meshes.data(), _gpuCullScene.meshes.size() * sizeof(GPUMeshLods), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+	//Nothing counts as visible before the first frame, its early pass draws nothing and the late one everything in view
+	std::vector<uint32_t> visibility(_scene.get_object_count(), 0);
+	_visibilityBuffer = _uploader.upload_buffer(visibility.data(), std::max<size_t>(visibility.size(), 1) * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	_uploader.wait_idle();
+
+	_mainDeletionQueue.push_function(
+		[=]() {
+			vmaDestroyBuffer(_allocator, _cullObjectBuffer._buffer, _cullObjectBuffer._allocation);
+			vmaDestroyBuffer(_allocator, _cullMeshBuffer._buffer, _cullMeshBuffer._allocation);
+			vmaDestroyBuffer(_allocator, _visibilityBuffer._buffer, _visibilityBuffer._allocation);
+		});
+
+	//Cull objects, mesh levels, transforms, output matrices, draw commands, draw counts, visibility, then the depth pyramid
+	const uint32_t bufferBindingCount = 7;
+	const uint32_t bindingCount = bufferBindingCount + 1;
+	VkDescriptorSetLayoutBinding bindings[bindingCount];
+	for (uint32_t i = 0; i < bindingCount; ++i)
+	{
+		bindings[i] = {};
+		bindings[i].binding = i;
+		bindings[i].descriptorType = i < bufferBindingCount ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo setLayoutInfo = {};
+	setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	setLayoutInfo.bindingCount = bindingCount;
+	setLayoutInfo.pBindings = bindings;
+
+	VK_CHECK(vkCreateDescriptorSetLayout(_device, &setLayoutInfo, nullptr, &_objectCullSetLayout));
+
+	VkPushConstantRange pushConstant;
+	pushConstant.offset = 0;
+	pushConstant.size = sizeof(GPUCullConstants);
+	pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = vkinit::pipeline_layout_create_info();
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &_objectCullSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstant;
+
+	VK_CHECK(vkCreatePipelineLayout(_device, &pipelineLayoutInfo, nullptr, &_objectCullPipelineLayout));
+
+	VkShaderModule cullShader;
+	if (!load_shader_module("../../shaders/object_cull.comp.spv", &cullShader))
+	{
+		std::cout << "Error when building the shader module ../../shaders/object_cull.comp.spv" << std::endl;
+	}
+
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, cullShader);
+	pipelineInfo.layout = _objectCullPipelineLayout;
+
+	VK_CHECK(vkCreateComputePipelines(_device, _pipelineCache, 1, &pipelineInfo, nullptr, &_objectCullPipeline));
+
+	vkDestroyShaderModule(_device, cullShader, nullptr);
+
+	_mainDeletionQueue.push_function(
+		[=]() {
+			vkDestroyPipeline(_device, _objectCullPipeline, nullptr);
+			vkDestroyPipelineLayout(_device, _objectCullPipelineLayout, nullptr);
+			vkDestroyDescriptorSetLayout(_device, _objectCullSetLayout, nullptr);
+		});
+
+	size_t objectCount = _scene.get_object_count();
+	//Zero sized buffers are invalid, an empty scene still gets one slot. Occlusion culling keeps the late phase's behind the early one's.
+	size_t phaseCount = _occlusionCulling ? 2 : 1;
+	size_t commandCount = std::max<size_t>(_gpuCullScene.commandCount * phaseCount, 1);
+	size_t batchCount = std::max<size_t>(_gpuCullScene.batches.size() * phaseCount, 1);
+
+	for (uint32_t i = 0; i < _framesInFlight; ++i)
+	{
+		FrameData& frame = _frames[i];
+
+		VkBufferCreateInfo bufferInfo = {};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = objectCount * sizeof(glm::mat4);
+		bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+		//Every transform once, after that only the moved ones are rewritten
+		VmaAllocationCreateInfo mappedAllocInfo = {};
+		mappedAllocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+		mappedAllocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+		VmaAllocationInfo allocationInfo;
+		VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &mappedAllocInfo, &frame._transformBuffer._buffer, &frame._transformBuffer._allocation, &allocationInfo));
+		frame._transformData = (glm::mat4*)allocationInfo.pMappedData;
+
+		for (uint32_t handle = 0; handle < (uint32_t)objectCount; ++handle)
+		{
+			frame._transformData[handle] = _scene.get_transform(handle);
+		}
+		VK_CHECK(vmaFlushAllocation(_allocator, frame._transformBuffer._allocation, 0, VK_WHOLE_SIZE));
+		frame._pendingTransforms.clear();
+
+		VmaAllocationCreateInfo gpuAllocInfo = {};
+		gpuAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+		bufferInfo.size = commandCount * sizeof(VkDrawIndexedIndirectCommand);
+		bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+
+		VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &gpuAllocInfo, &frame._drawCommandBuffer._buffer, &frame._drawCommandBuffer._allocation, nullptr));
+
+		bufferInfo.size = batchCount * sizeof(uint32_t);
+		bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+		VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &gpuAllocInfo, &frame._drawCountBuffer._buffer, &frame._drawCountBuffer._allocation, nullptr));
+
+		//Host side copy of the counts, only read for stats once the slot's fence signalled
+		VmaAllocationCreateInfo readbackAllocInfo = {};
+		readbackAllocInfo.usage = VMA_MEMORY_USAGE_GPU_TO_CPU;
+		readbackAllocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+		bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+		VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &readbackAllocInfo, &frame._drawCountReadback._buffer, &frame._drawCountReadback._allocation, &allocationInfo));
+		frame._drawCounts = (const uint32_t*)allocationInfo.pMappedData;
+		memset(allocationInfo.pMappedData, 0, bufferInfo.size);
+
+		_mainDeletionQueue.push_function(
+			[=]() {
+				vmaDestroyBuffer(_allocator, _frames[i]._transformBuffer._buffer, _frames[i]._transformBuffer._allocation);
+				vmaDestroyBuffer(_allocator, _frames[i]._drawCommandBuffer._buffer, _frames[i]._drawCommandBuffer._allocation);
+				vmaDestroyBuffer(_allocator, _frames[i]._drawCountBuffer._buffer, _frames[i]._drawCountBuffer._allocation);
+				vmaDestroyBuffer(_allocator, _frames[i]._drawCountReadback._buffer, _frames[i]._drawCountReadback._allocation);
+			});
+	}
+
+	std::cout << "Object culling draws " << _gpuCullScene.commandCount << " objects in " << _gpuCullScene.batches.size() << " batches" << std::endl;
+}
+
+void VulkanEngine::cull_objects(VkCommandBuffer cmd, FrameData& frame, const glm::mat4& viewProjection, const glm::vec3& cameraPosition, CullPhase phase)
+{
+	VK_TRACE_ZONE("cull_objects");
+
+	ScopedGpuZone cullZone(_gpuProfiler, cmd, phase == CullPhase::Late ? "late object cull" : "object cull");
+
+	uint32_t batchCount = (uint32_t)_gpuCullScene.batches.size();
+	uint32_t phaseCount = _occlusionCulling ? 2 : 1;
+
+	//Counts, transforms and the pyramid's layout are set up once per frame, by the first phase
+	if (phase != CullPhase::Late)
+	{
+		//This slot's fence signalled, its readback holds the counts of the last frame it recorded, both phases with occlusion culling
+		VK_CHECK(vmaInvalidateAllocation(_allocator, frame._drawCountReadback._allocation, 0, VK_WHOLE_SIZE));
+
+		_lastCullStats = CullStats{};
+		for (uint32_t b = 0; b < batchCount * phaseCount; ++b)
+		{
+			_lastCullStats.visible += frame._drawCounts[b];
+		}
+		_lastCullStats.culled = _gpuCullScene.commandCount - _lastCullStats.visible;
+
+		//Every slot has to catch up on the moves, this one does it now and the others when they record next
+		const std::vector<uint32_t>& moved = _scene.get_moved_objects();
+		for (uint32_t i = 0; i < _framesInFlight; ++i)
+		{
+			_frames[i]._pendingTransforms.insert(_frames[i]._pendingTransforms.end(), moved.begin(), moved.end());
+		}
+
+		if (!frame._pendingTransforms.empty())
+		{
+			for (uint32_t handle : frame._pendingTransforms)
+			{
+				frame._transformData[handle] = _scene.get_transform(handle);
+			}
+			VK_CHECK(vmaFlushAllocation(_allocator, frame._transformBuffer._allocation, 0, VK_WHOLE_SIZE));
+			frame._pendingTransforms.clear();
+		}
+
+		//Counts start at 0, the shader appends behind them
+		vkCmdFillBuffer(cmd, frame._drawCountBuffer._buffer, 0, VK_WHOLE_SIZE, 0);
+
+		//Also makes the visibility the last frame's late phase wrote readable
+		VkMemoryBarrier resetBarrier = {};
+		resetBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		resetBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		resetBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+		//The pyramid is rebuilt before the late phase reads it, its old contents can go. The last frame's late phase must be done sampling it.
+		VkImageMemoryBarrier pyramidBarrier = {};
+		pyramidBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		pyramidBarrier.srcAccessMask = 0;
+		pyramidBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		pyramidBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		pyramidBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		pyramidBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		pyramidBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		pyramidBarrier.image = _depthPyramid._image;
+		pyramidBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, _depthPyramidLevels, 0, 1 };
+
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &resetBarrier, 0, nullptr, 1, &pyramidBarrier);
+	}
+
+	float projectionScale = get_projection_scale();
+
+	GPUCullConstants constants = {};
+	constants.viewProjection = viewProjection;
+	constants.cameraPosition = glm::vec4(cameraPosition, _lodPixelError > 0.f ? projectionScale / _lodPixelError : 0.f);
+	constants.objectCount = (uint32_t)_scene.get_object_count();
+	constants.compact = _vkCmdDrawIndexedIndirectCount != nullptr ? 1 : 0;
+	constants.frustumCulling = _frustumCulling ? 1 : 0;
+	constants.phase = (uint32_t)phase;
+	constants.pyramidSize = glm::vec2(_depthPyramidExtent.width, _depthPyramidExtent.height);
+	constants.commandOffset = phase == CullPhase::Late ? _gpuCullScene.commandCount : 0;
+	constants.countOffset = phase == CullPhase::Late ? batchCount : 0;
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _objectCullPipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, _objectCullPipelineLayout, 0, 1, &frame._objectCullSet, 0, nullptr);
+	vkCmdPushConstants(cmd, _objectCullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GPUCullConstants), &constants);
+	vkCmdDispatch(cmd, (constants.objectCount + 63) / 64, 1, 1);
+
+	//The draws read the commands, the counts and the matrices, the copy below the counts again
+	VkMemoryBarrier cullBarrier = {};
+	cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &cullBarrier, 0, nullptr, 0, nullptr);
+
+	//The early phase's counts are read back together with the late phase's
+	if (phase == CullPhase::Early)
+		return;
+
+	VkBufferCopy countCopy = { 0, 0, std::max<VkDeviceSize>(batchCount * phaseCount, 1) * sizeof(uint32_t) };
+	vkCmdCopyBuffer(cmd, frame._drawCountBuffer._buffer, frame._drawCountReadback._buffer, 1, &countCopy);
+
+	VkMemoryBarrier readbackBarrier = {};
+	readbackBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	readbackBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	readbackBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &readbackBarrier, 0, nullptr, 0, nullptr);
+}
+
+VkPipeline PipelineBuilder::build_pipeline(VkDevice device, VkRenderPass pass, VkPipelineCache cache)
 {
 	//make viewport state from our stored viewport and scissor.
 	//at the moment we won't support multiple viewports or scissors
@@ -754,17 +2441,35 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device, VkRenderPass pass)
 	pipelineInfo.pRasterizationState = &_rasterizer;
 	pipelineInfo.pMultisampleState = &_multisampling;
 	pipelineInfo.pColorBlendState = &colorBlending;
+	pipelineInfo.pDepthStencilState = &_depthStencil;
 	pipelineInfo.layout = _pipelineLayout;
 	pipelineInfo.renderPass = pass;
 	pipelineInfo.subpass = 0;
 	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
 	VkPipeline newPipeline;
-	if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &newPipeline) != VK_SUCCESS)
+	if (vkCreateGraphicsPipelines(device, cache, 1, &pipelineInfo, nullptr, &newPipeline) != VK_SUCCESS)
 	{
 		std::cout << "failed to create pipeline\n";
 		return VK_NULL_HANDLE;
 	}
 	else
 		return newPipeline;
-}
\ No newline at end of file
+}
+
+std::vector<std::future<VkPipeline>> PipelineBuilder::build_pipelines_async(JobSystem& jobs, VkDevice device, VkRenderPass pass, VkPipelineCache cache, const std::vector<PipelineBuilder>& builders)
+{
+	std::vector<std::future<VkPipeline>> pipelines;
+	pipelines.reserve(builders.size());
+
+	//vkCreateGraphicsPipelines synchronizes the cache internally, every worker can share it
+	for (const PipelineBuilder& builder : builders)
+	{
+		pipelines.push_back(jobs.submit([builder = builder, device, pass, cache]() mutable {
+			VK_TRACE_ZONE("build_pipeline");
+			return builder.build_pipeline(device, pass, cache);
+		}));
+	}
+
+	return pipelines;
+}
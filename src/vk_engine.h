@@ -9,13 +9,45 @@
 #include <functional>
 
 #include <vk_mesh.h>
+#include <vk_profiler.h>
+#include <vk_jobs.h>
+#include <vk_upload.h>
+#include <vk_meshlet.h>
+#include <vk_scene.h>
+#include <vk_gpu_cull.h>
+#include <vk_descriptors.h>
 #include <glm/glm.hpp>
 
-//Exact same struct in vertex shader
+//Exact same struct in the mesh vertex shaders, pushed once per mesh
 struct MeshPushConstants
 {
-	glm::vec4 data;
-	glm::mat4 render_matrix;
+	//Packed positions decode as offset + unorm * scale, unused by full vertices
+	glm::vec4 positionOffset;
+	glm::vec4 positionScale;
+};
+
+//One per scene object in the frame's object buffer, the shaders index it with gl_InstanceIndex
+struct GPUObjectData
+{
+	glm::mat4 modelViewProjection;
+};
+
+//CPU side timings of the last draw() call, in milliseconds
+struct FrameStats
+{
+	//Recording the command buffer, from acquire to vkEndCommandBuffer
+	double recordMs{ 0.0 };
+	//vkQueueSubmit and vkQueuePresentKHR
+	double submitMs{ 0.0 };
+	//Blocked on the fence of the frame slot, high values mean the GPU is the bottleneck
+	double fenceWaitMs{ 0.0 };
+};
+
+//Where the camera and the model sit for a given frame
+struct FramePose
+{
+	glm::vec3 camPos;
+	glm::mat4 model;
 };
 
 struct DeletionQueue
@@ -38,6 +70,52 @@ struct DeletionQueue
 	}
 };
 
+//Upper bound of the frames-in-flight ring, the depth actually used is picked at runtime
+constexpr unsigned int MAX_FRAMES_IN_FLIGHT = 4;
+
+//Everything a single frame needs to be recorded while the GPU still works on the previous ones
+struct FrameData
+{
+	VkSemaphore _presentSemaphore;
+	VkSemaphore _renderSemaphore;
+	VkFence _renderFence;
+
+	VkCommandPool _commandPool;
+	VkCommandBuffer _mainCommandBuffer;
+
+	//Host visible copy of the rendered image, only allocated in headless mode with readback enabled
+	AllocatedBuffer _readbackBuffer;
+	//Frame number whose pixels sit in _readbackBuffer, -1 when there is nothing to hand out
+	int _readbackFrame{ -1 };
+
+	//Written by the meshlet culling pass each frame: surviving triangles and the indirect draw reading them
+	AllocatedBuffer _meshletIndexBuffer;
+	AllocatedBuffer _meshletDrawBuffer;
+	VkDescriptorSet _meshletCullSet;
+
+	//Written by the CPU every frame, persistently mapped. GPU only and written by the object culling pass with _gpuCulling.
+	AllocatedBuffer _objectBuffer;
+	GPUObjectData* _objectData{ nullptr };
+	//Object handle per instance, persistently mapped: every handle once, then the instances of draw_objects' draws
+	AllocatedBuffer _instanceBuffer;
+	uint32_t* _instanceData{ nullptr };
+	VkDescriptorSet _objectSet;
+
+	//Object culling pass with _gpuCulling: model matrices, persistently mapped, and the handles moved since this slot last wrote them
+	AllocatedBuffer _transformBuffer;
+	glm::mat4* _transformData{ nullptr };
+	std::vector<uint32_t> _pendingTransforms;
+	//Indirect commands and per-batch draw counts written by the pass, the counts are copied to the mapped readback for stats
+	AllocatedBuffer _drawCommandBuffer;
+	AllocatedBuffer _drawCountBuffer;
+	AllocatedBuffer _drawCountReadback;
+	const uint32_t* _drawCounts{ nullptr };
+	VkDescriptorSet _objectCullSet;
+
+	//Where _meshletCullSet, _objectSet and _objectCullSet come from, reset and written again by draw() once the slot's fence signalled
+	DescriptorAllocator _frameDescriptors;
+};
+
 class VulkanEngine 
 {
 public:
@@ -45,6 +123,46 @@ public:
 	bool _isInitialized{ false };
 	int _frameNumber {0};
 
+	//Render into offscreen images without SDL, a window or a swapchain
+	bool _headless{ false };
+	//Copy every headless frame back to host memory and hand it to _onFrameReadback
+	bool _readbackFrames{ false };
+	//run() stops after this many frames, 0 runs until the window is closed
+	int _frameLimit{ 0 };
+	//Upload loaded meshes in the 16 byte PackedVertex format instead of the full 36 byte Vertex
+	bool _packedVertices{ false };
+	//Split the model into meshlets and let a compute pass drop the ones off-screen or facing away
+	bool _meshletCulling{ false };
+	//Largest screen-space error, in pixels, a coarser level of detail may show. 0 always draws the full mesh
+	float _lodPixelError{ 1.f };
+	//Skip scene objects outside the view frustum
+	bool _frustumCulling{ true };
+	//Walk the scene's box tree instead of testing every bounding sphere
+	bool _hierarchicalCulling{ true };
+	//Cull, pick levels of detail and write draw commands in a compute pass, the CPU records one multi-draw per batch
+	bool _gpuCulling{ false };
+	//Draw what was visible last frame, test the rest against a depth pyramid of it and draw what turned visible. Implies _gpuCulling.
+	bool _occlusionCulling{ false };
+
+	//Called with tightly packed RGBA8 pixels once the GPU is done with a headless frame
+	std::function<void(int frameNumber, const uint8_t* pixels, VkExtent2D extent)> _onFrameReadback;
+
+	//Replaces the default spinning model when set, benchmarks use it to get the same frames on every run
+	std::function<FramePose(int frameNumber)> _scriptedPath;
+
+	FrameStats _lastFrameStats;
+	//Draws and state binds recorded by the last draw() call
+	DrawStats _lastDrawStats;
+	//Visible and culled objects and the CPU time the frustum test took, last draw() call.
+	//With _gpuCulling the counts come back from the GPU _framesInFlight frames late and cullMs stays 0.
+	CullStats _lastCullStats;
+
+	//GPU time per named scope of draw(), resolved a few frames late
+	GpuProfiler _gpuProfiler;
+
+	//Worker threads for startup work such as shader loading and pipeline compilation
+	JobSystem _jobs;
+
 	VkExtent2D _windowExtent{ 1700 , 900 };
 
 	struct SDL_Window* _window{ nullptr };
@@ -53,24 +171,31 @@ public:
 	VkDebugUtilsMessengerEXT _debug_messenger;
 	VkPhysicalDevice _chosenGPU;
 	VkDevice _device;
-	VkSurfaceKHR _surface;
+	VkSurfaceKHR _surface{ VK_NULL_HANDLE };
 
 	VkSwapchainKHR _swapchain;
 	VkFormat _swapchainImageFormat;
 	std::vector<VkImage> _swapchainImages;
 	std::vector<VkImageView> _swapchainImageViews;
 
+	//Stand-ins for the swapchain images in headless mode, one per frame in flight
+	std::vector<AllocatedImage> _offscreenImages;
+
 	VkQueue _graphicsQueue;
 	uint32_t _graphicsQueueFamily;
-	VkCommandPool _commandPool;
-	VkCommandBuffer _mainCommandBuffer;
 
 	VkRenderPass _renderPass;
+	//Same attachments as _renderPass, loaded instead of cleared, for the late draws of _occlusionCulling
+	VkRenderPass _occlusionRenderPass{ VK_NULL_HANDLE };
 	std::vector<VkFramebuffer> _framebuffers;
 
-	VkSemaphore _presentSemaphore;
-	VkSemaphore _renderSemaphore;
-	VkFence _renderFence;
+	//Compiled pipelines persisted across launches, only reused on the same device and driver
+	VkPipelineCache _pipelineCache{ VK_NULL_HANDLE };
+	const char* _pipelineCachePath{ "pipeline_cache.bin" };
+
+	//Number of frames the CPU may record ahead of the GPU, clamped to [2, MAX_FRAMES_IN_FLIGHT] in init()
+	uint32_t _framesInFlight{ 2 };
+	FrameData _frames[MAX_FRAMES_IN_FLIGHT];
 
 	VkPipelineLayout _trianglePipelineLayout;
 	VkPipeline _trianglePipeline;
@@ -83,12 +208,63 @@ public:
 
 	VmaAllocator _allocator;
 
+	UploadManager _uploader;
+
 	VkPipeline _meshPipeline;
+	//Same as _meshPipeline, reading PackedVertex
+	VkPipeline _meshPackedPipeline;
 	Mesh _triangleMesh;
 
 	VkPipelineLayout _meshPipelineLayout;
 
 	Mesh _monkeyMesh;
+	MeshletMesh _monkeyMeshlets;
+
+	RenderScene _scene;
+	//Scene object following the frame pose, the one meshlet culling applies to
+	uint32_t _heroObject{ 0 };
+
+	//Every set made at startup, none are freed before shutdown
+	DescriptorAllocator _descriptorAllocator;
+
+	//Set 0 of the mesh pipelines: the frame's object and instance buffers
+	VkDescriptorSetLayout _objectSetLayout;
+
+	VkDescriptorSetLayout _meshletCullSetLayout;
+	VkPipelineLayout _meshletCullPipelineLayout;
+	VkPipeline _meshletCullPipeline;
+
+	//vkCmdDrawIndexedIndirectCount from VK_KHR_draw_indirect_count, null when the device lacks it
+	PFN_vkCmdDrawIndexedIndirectCountKHR _vkCmdDrawIndexedIndirectCount{ nullptr };
+
+	//Batches and shader tables of the scene, built once it is complete
+	GPUCullScene _gpuCullScene;
+	AllocatedBuffer _cullObjectBuffer;
+	AllocatedBuffer _cullMeshBuffer;
+
+	VkDescriptorSetLayout _objectCullSetLayout;
+	VkPipelineLayout _objectCullPipelineLayout;
+	VkPipeline _objectCullPipeline;
+
+	//draw_objects' handles per level of detail for the run being recorded, kept to reuse their storage
+	std::vector<uint32_t> _lodInstances[vklod::MAX_LODS];
+
+	//1 per object the last late phase found visible, shared by every frame since they run in submission order
+	AllocatedBuffer _visibilityBuffer;
+
+	//Farthest depth per texel, the largest level is the window extent rounded down to powers of two
+	AllocatedImage _depthPyramid;
+	VkImageView _depthPyramidView;
+	std::vector<VkImageView> _depthPyramidMips;
+	VkExtent2D _depthPyramidExtent;
+	uint32_t _depthPyramidLevels{ 0 };
+	VkSampler _depthPyramidSampler;
+
+	//One set per level, reading the level below (the depth image for level 0) and writing its own
+	VkDescriptorSetLayout _depthReduceSetLayout;
+	VkPipelineLayout _depthReducePipelineLayout;
+	VkPipeline _depthReducePipeline;
+	std::vector<VkDescriptorSet> _depthReduceSets;
 
 	VkImageView _depthImageView;
 	AllocatedImage _depthImage;
@@ -102,19 +278,57 @@ public:
 	void draw();
 	void run();
 
+	FrameData& get_current_frame();
+
 private:
 	void init_vulkan();
 	void init_swapchain();
+	void init_offscreen_targets();
 	void init_commands();
 	void init_default_renderpass();
 	void init_framebuffers();
 	void init_sync_structures();
+	void init_pipeline_cache();
+	void save_pipeline_cache();
+	void init_descriptors();
+	//Allocates this frame's sets from the slot's _frameDescriptors and points them at its buffers
+	void write_frame_descriptors(FrameData& frame);
 	void init_pipelines();
 
 	bool load_shader_module(const char* filePath, VkShaderModule* outShaderModule);
 
+	//Pixels per unit of screen-space error at unit distance, for picking levels of detail
+	float get_projection_scale() const;
+
+	void flush_readback(FrameData& frame);
+
 	void load_meshes();
 	void upload_mesh(Mesh& mesh);
+	//Maps a baked mesh and copies its blobs straight into the staging ring, false when missing, invalid or baked from another version of sourcePath
+	bool load_baked_mesh(Mesh& mesh, const char* path, const char* sourcePath);
+
+	//Materials, the objects drawn every frame and the per-frame buffers holding their matrices
+	void init_scene();
+	//Walks the scene in sort key order, skipping binds of state that is already bound.
+	//Objects sharing material, mesh and level of detail go out as one instanced draw.
+	void draw_objects(VkCommandBuffer cmd, FrameData& frame, const glm::mat4& projection, const glm::mat4& view, const glm::vec3& cameraPosition);
+
+	//Uploads the scene tables and creates the culling pipeline with its per-frame buffers
+	void init_object_culling();
+	//Compute pass writing this frame's matrices and draw commands, recorded outside the render passes
+	void cull_objects(VkCommandBuffer cmd, FrameData& frame, const glm::mat4& viewProjection, const glm::vec3& cameraPosition, CullPhase phase);
+	//One multi-draw per batch over the commands cull_objects wrote for the phase
+	void draw_batches(VkCommandBuffer cmd, FrameData& frame, CullPhase phase);
+
+	//Pyramid image with a view per level and the reduction pipeline, the object culling set samples it
+	void init_depth_pyramid();
+	//Reduces the depth image into every level of the pyramid, recorded between the early and late passes
+	void build_depth_pyramid(VkCommandBuffer cmd);
+
+	//Builds and uploads the monkey's meshlets, then the culling pipeline and its per-frame outputs
+	void init_meshlet_culling();
+	//Compute pass filling this frame's index buffer and indirect draw, recorded before the render pass
+	void cull_meshlets(VkCommandBuffer cmd, FrameData& frame, const glm::mat4& projection, const glm::mat4& view, const glm::mat4& model);
 };
 
 class PipelineBuilder
@@ -128,7 +342,12 @@ public:
 	VkPipelineRasterizationStateCreateInfo _rasterizer;
 	VkPipelineColorBlendAttachmentState _colorBlendAttachment;
 	VkPipelineMultisampleStateCreateInfo _multisampling;
+	VkPipelineDepthStencilStateCreateInfo _depthStencil;
 	VkPipelineLayout _pipelineLayout;
 
-	VkPipeline build_pipeline(VkDevice device, VkRenderPass pass);
+	VkPipeline build_pipeline(VkDevice device, VkRenderPass pass, VkPipelineCache cache);
+
+	//Compiles every builder on the job system, futures come back in the same order.
+	//Whatever the builders point to (vertex descriptions, shader modules) must outlive the futures.
+	static std::vector<std::future<VkPipeline>> build_pipelines_async(JobSystem& jobs, VkDevice device, VkRenderPass pass, VkPipelineCache cache, const std::vector<PipelineBuilder>& builders);
 };
\ No newline at end of file
@@ -0,0 +1,76 @@
+#include "vk_gpu_cull.h"
+#include "vk_trace.h"
+
+#include <unordered_map>
+#include <algorithm>
+
+namespace vkgpucull {
+
+	void build_cull_scene(RenderScene& scene, uint32_t excludedHandle, GPUCullScene& outScene)
+	{
+		VK_TRACE_ZONE("vkgpucull::build_cull_scene");
+
+		outScene.objects.assign(scene.get_object_count(), GPUCullObject{});
+		outScene.meshes.clear();
+		outScene.batches.clear();
+		outScene.commandCount = 0;
+
+		std::unordered_map<const Mesh*, uint32_t> meshIndices;
+
+		for (uint32_t handle : scene.get_draw_order())
+		{
+			const RenderObject& object = scene.get_object(handle);
+
+			auto mesh = meshIndices.try_emplace(object.mesh, (uint32_t)outScene.meshes.size());
+			if (mesh.second)
+			{
+				//Meshes without a chain draw their whole index buffer as the only level
+				GPUMeshLods lods = {};
+				if (object.mesh->_lods.empty())
+				{
+					lods.lodCount = 1;
+					lods.indexCount[0] = object.mesh->_indexCount;
+				}
+				else
+				{
+					//GPUMeshLods holds MAX_LODS levels, read_mesh_info already rejects longer chains
+					lods.lodCount = std::min((uint32_t)object.mesh->_lods.size(), vklod::MAX_LODS);
+					for (uint32_t level = 0; level < lods.lodCount; ++level)
+					{
+						lods.firstIndex[level] = object.mesh->_lods[level].firstIndex;
+						lods.indexCount[level] = object.mesh->_lods[level].indexCount;
+						lods.error[level] = object.mesh->_lods[level].error;
+					}
+				}
+				outScene.meshes.push_back(lods);
+			}
+
+			GPUCullObject& cullObject = outScene.objects[handle];
+			cullObject.sphere = object.mesh->_boundingSphere;
+			cullObject.meshIndex = mesh.first->second;
+			cullObject.batchIndex = NO_BATCH;
+
+			if (handle == excludedHandle)
+				continue;
+
+			//The draw order groups equal materials and meshes, a new batch starts wherever either changes
+			if (outScene.batches.empty() || outScene.batches.back().material != object.material || outScene.batches.back().mesh != object.mesh)
+			{
+				DrawBatch batch;
+				batch.material = object.material;
+				batch.mesh = object.mesh;
+				batch.firstCommand = outScene.commandCount;
+				batch.commandCount = 0;
+				outScene.batches.push_back(batch);
+			}
+
+			DrawBatch& batch = outScene.batches.back();
+			cullObject.batchIndex = (uint32_t)outScene.batches.size() - 1;
+			cullObject.firstCommand = batch.firstCommand;
+			cullObject.commandIndex = batch.firstCommand + batch.commandCount;
+
+			batch.commandCount++;
+			outScene.commandCount++;
+		}
+	}
+}
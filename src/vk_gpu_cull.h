@@ -0,0 +1,97 @@
+#pragma once
+
+#include <vk_scene.h>
+#include <vk_lod.h>
+#include <vector>
+#include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
+
+//Same layout as the CullObject struct of object_cull.comp (std430), one per scene object indexed by handle
+struct GPUCullObject
+{
+	//xyz center, w radius, in mesh space. The shader moves it by the object's transform.
+	glm::vec4 sphere;
+	uint32_t meshIndex;
+	//Batch whose count the object adds to, NO_BATCH when the CPU records its draw itself
+	uint32_t batchIndex;
+	//First command of the batch, where surviving commands are appended
+	uint32_t firstCommand;
+	//Fixed slot of the object, used when the device can't take a draw count
+	uint32_t commandIndex;
+};
+
+//Same layout as the MeshLods struct of object_cull.comp (std430)
+struct GPUMeshLods
+{
+	uint32_t lodCount;
+	uint32_t firstIndex[vklod::MAX_LODS];
+	uint32_t indexCount[vklod::MAX_LODS];
+	//Largest distance to the full detail surface, in mesh units
+	float error[vklod::MAX_LODS];
+};
+
+//Exact same struct in object_cull.comp
+struct GPUCullConstants
+{
+	glm::mat4 viewProjection;
+	//xyz camera position, w projection scale over the allowed pixel error, 0 keeps the full mesh
+	glm::vec4 cameraPosition;
+	uint32_t objectCount;
+	//1 appends surviving commands behind a count, 0 writes every slot and zeroes the instance count of culled ones
+	uint32_t compact;
+	//0 draws every object, only picking its level of detail
+	uint32_t frustumCulling;
+	//CullPhase of the dispatch
+	uint32_t phase;
+	//Texels of the depth pyramid's largest level
+	glm::vec2 pyramidSize;
+	//Where this phase's commands and counts start, the late phase writes behind the early one's
+	uint32_t commandOffset;
+	uint32_t countOffset;
+};
+
+//Exact same struct in depth_reduce.comp, sizes in texels of the level read and the level written
+struct DepthReduceConstants
+{
+	glm::uvec2 sourceSize;
+	glm::uvec2 destinationSize;
+};
+
+//Which objects a cull dispatch writes commands for, same values as the PHASE constants of object_cull.comp
+enum class CullPhase : uint32_t
+{
+	//Every object passing the frustum test, no occlusion culling
+	All = 0,
+	//Objects visible last frame, drawn first to lay down the depth the pyramid is built from
+	Early = 1,
+	//Everything tested against the pyramid, draws the newly visible objects and records visibility for the next frame
+	Late = 2
+};
+
+//Objects sharing material and mesh, recorded as one multi-draw over their commands
+struct DrawBatch
+{
+	const Material* material;
+	const Mesh* mesh;
+	uint32_t firstCommand;
+	uint32_t commandCount;
+};
+
+//What the culling shader reads and how the draw loop walks its output
+struct GPUCullScene
+{
+	std::vector<GPUCullObject> objects;
+	std::vector<GPUMeshLods> meshes;
+	std::vector<DrawBatch> batches;
+	//Commands of every batch together, the size of the per-frame command buffer
+	uint32_t commandCount{ 0 };
+};
+
+namespace vkgpucull {
+
+	constexpr uint32_t NO_BATCH = 0xFFFFFFFF;
+
+	//Cuts the draw order into runs of the same material and mesh and fills the shader tables.
+	//excludedHandle stays out of every batch, UINT32_MAX excludes nothing.
+	void build_cull_scene(RenderScene& scene, uint32_t excludedHandle, GPUCullScene& outScene);
+}
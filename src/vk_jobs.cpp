@@ -0,0 +1,56 @@
+#include "vk_jobs.h"
+
+#include <algorithm>
+
+void JobSystem::init(uint32_t threadCount)
+{
+	if (threadCount == 0)
+	{
+		//hardware_concurrency may report 0 when it can't tell
+		uint32_t hardwareThreads = std::thread::hardware_concurrency();
+		threadCount = std::max(hardwareThreads, 2u) - 1;
+	}
+
+	_stopping = false;
+	_workers.reserve(threadCount);
+	for (uint32_t i = 0; i < threadCount; ++i)
+	{
+		_workers.emplace_back([this]() { worker_loop(); });
+	}
+}
+
+void JobSystem::shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_wakeUp.notify_all();
+
+	for (std::thread& worker : _workers)
+	{
+		worker.join();
+	}
+	_workers.clear();
+}
+
+void JobSystem::worker_loop()
+{
+	while (true)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wakeUp.wait(lock, [this]() { return _stopping || !_queue.empty(); });
+
+			//Drain the queue before leaving so no future is left without a value
+			if (_queue.empty())
+				return;
+
+			job = std::move(_queue.front());
+			_queue.pop_front();
+		}
+
+		job();
+	}
+}
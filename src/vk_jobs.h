@@ -0,0 +1,100 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <type_traits>
+#include <atomic>
+#include <algorithm>
+
+//Fixed pool of worker threads running jobs in submission order.
+//Results and exceptions come back through std::future.
+class JobSystem
+{
+public:
+	//0 picks one worker per hardware thread, minus the main thread
+	void init(uint32_t threadCount = 0);
+	//Runs the jobs already queued, then joins the workers
+	void shutdown();
+
+	template<typename F>
+	auto submit(F&& function) -> std::future<std::invoke_result_t<std::decay_t<F>>>
+	{
+		using Result = std::invoke_result_t<std::decay_t<F>>;
+
+		//std::function needs a copyable callable, packaged_task is move only
+		auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(function));
+		std::future<Result> result = task->get_future();
+
+		if (_workers.empty())
+		{
+			//No pool running, behave like a plain call
+			(*task)();
+			return result;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_queue.emplace_back([task]() { (*task)(); });
+		}
+		_wakeUp.notify_one();
+
+		return result;
+	}
+
+	//Runs function(i) for every i in [0, count) and returns once all of them finished.
+	//The calling thread works through the range too and only waits on items already running,
+	//so it is safe to call from inside a job even when every worker is busy.
+	template<typename F>
+	void parallel_for(uint32_t count, F&& function)
+	{
+		struct Range
+		{
+			std::atomic<uint32_t> next{ 0 };
+			std::atomic<uint32_t> done{ 0 };
+		};
+
+		//Helpers may start after the range is exhausted and the caller returned, they only touch the shared state then
+		auto range = std::make_shared<Range>();
+		auto run = [range, count, &function]() {
+			for (uint32_t i = range->next.fetch_add(1); i < count; i = range->next.fetch_add(1))
+			{
+				function(i);
+				range->done.fetch_add(1, std::memory_order_release);
+			}
+		};
+
+		uint32_t helpers = std::min(get_thread_count(), count > 0 ? count - 1 : 0);
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			for (uint32_t i = 0; i < helpers; ++i)
+			{
+				_queue.emplace_back(run);
+			}
+		}
+		_wakeUp.notify_all();
+
+		run();
+
+		while (range->done.load(std::memory_order_acquire) < count)
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	uint32_t get_thread_count() const { return (uint32_t)_workers.size(); }
+
+private:
+	void worker_loop();
+
+	std::vector<std::thread> _workers;
+	std::deque<std::function<void()>> _queue;
+	std::mutex _mutex;
+	std::condition_variable _wakeUp;
+	bool _stopping{ false };
+};
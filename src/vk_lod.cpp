@@ -0,0 +1,483 @@
+#include "vk_lod.h"
+#include "vk_mesh_opt.h"
+#include "vk_trace.h"
+
+#include <iostream>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#include <glm/geometric.hpp>
+
+namespace {
+
+	//Open borders keep their shape unless collapsing along them costs this much more than going inwards
+	constexpr double BORDER_WEIGHT = 10.0;
+	//Collapses turning a triangle further than ~75 degrees are rejected, it would likely fold over
+	constexpr float MIN_NORMAL_DOT = 0.25f;
+
+	//Sum of squared distances to a set of planes, as the symmetric 4x4 matrix of Garland & Heckbert
+	struct Quadric
+	{
+		double a00, a01, a02, a11, a12, a22;
+		double b0, b1, b2;
+		double c;
+		//Total area of the planes, turns the sum into an average
+		double weight;
+
+		void add_plane(const glm::vec3& normal, float distance, double planeWeight)
+		{
+			double nx = normal.x, ny = normal.y, nz = normal.z, d = distance;
+			a00 += planeWeight * nx * nx;
+			a01 += planeWeight * nx * ny;
+			a02 += planeWeight * nx * nz;
+			a11 += planeWeight * ny * ny;
+			a12 += planeWeight * ny * nz;
+			a22 += planeWeight * nz * nz;
+			b0 += planeWeight * nx * d;
+			b1 += planeWeight * ny * d;
+			b2 += planeWeight * nz * d;
+			c += planeWeight * d * d;
+			weight += planeWeight;
+		}
+
+		void add(const Quadric& other)
+		{
+			a00 += other.a00; a01 += other.a01; a02 += other.a02;
+			a11 += other.a11; a12 += other.a12; a22 += other.a22;
+			b0 += other.b0; b1 += other.b1; b2 += other.b2;
+			c += other.c;
+			weight += other.weight;
+		}
+
+		double evaluate(const glm::vec3& p) const
+		{
+			double x = p.x, y = p.y, z = p.z;
+			double result = a00 * x * x + 2.0 * a01 * x * y + 2.0 * a02 * x * z
+				+ a11 * y * y + 2.0 * a12 * y * z + a22 * z * z
+				+ 2.0 * (b0 * x + b1 * y + b2 * z) + c;
+			//Rounding can take it slightly below 0
+			return std::max(result, 0.0);
+		}
+	};
+
+	struct Collapse
+	{
+		uint32_t from;
+		uint32_t to;
+		//Mean squared distance of the merged vertex to its planes, orders the collapses
+		double cost;
+	};
+
+	//Closest point on a triangle, Ericson's Real-Time Collision Detection 5.1.5
+	float distance_to_triangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+	{
+		glm::vec3 ab = b - a;
+		glm::vec3 ac = c - a;
+		glm::vec3 ap = p - a;
+		float d1 = glm::dot(ab, ap);
+		float d2 = glm::dot(ac, ap);
+		if (d1 <= 0.f && d2 <= 0.f)
+			return glm::length(p - a);
+
+		glm::vec3 bp = p - b;
+		float d3 = glm::dot(ab, bp);
+		float d4 = glm::dot(ac, bp);
+		if (d3 >= 0.f && d4 <= d3)
+			return glm::length(p - b);
+
+		float vc = d1 * d4 - d3 * d2;
+		if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f)
+			return glm::length(p - (a + ab * (d1 / (d1 - d3))));
+
+		glm::vec3 cp = p - c;
+		float d5 = glm::dot(ab, cp);
+		float d6 = glm::dot(ac, cp);
+		if (d6 >= 0.f && d5 <= d6)
+			return glm::length(p - c);
+
+		float vb = d5 * d2 - d1 * d6;
+		if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f)
+			return glm::length(p - (a + ac * (d2 / (d2 - d6))));
+
+		float va = d3 * d6 - d5 * d4;
+		if (va <= 0.f && (d4 - d3) >= 0.f && (d5 - d6) >= 0.f)
+			return glm::length(p - (b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)))));
+
+		float denominator = 1.f / (va + vb + vc);
+		return glm::length(p - (a + ab * (vb * denominator) + ac * (vc * denominator)));
+	}
+
+	//Triangles around each vertex as offsets into a flat list of triangle numbers
+	void build_adjacency(const std::vector<uint32_t>& indices, size_t vertexCount, std::vector<uint32_t>& outOffsets, std::vector<uint32_t>& outTriangles)
+	{
+		outOffsets.assign(vertexCount + 1, 0);
+		for (uint32_t index : indices)
+		{
+			outOffsets[index + 1]++;
+		}
+		for (size_t v = 0; v < vertexCount; ++v)
+		{
+			outOffsets[v + 1] += outOffsets[v];
+		}
+
+		outTriangles.resize(indices.size());
+		std::vector<uint32_t> fill(outOffsets.begin(), outOffsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); ++i)
+		{
+			outTriangles[fill[indices[i]]++] = (uint32_t)(i / 3);
+		}
+	}
+
+	uint64_t edge_key(uint32_t a, uint32_t b)
+	{
+		return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+	}
+
+	//Bitwise position match, seams split by normals or colors collapse as one vertex
+	struct PositionHash
+	{
+		size_t operator()(const glm::vec3& p) const
+		{
+			uint32_t words[3];
+			memcpy(words, &p, sizeof(words));
+			return (size_t)((words[0] * 73856093u) ^ (words[1] * 19349663u) ^ (words[2] * 83492791u));
+		}
+	};
+
+	struct PositionEqual
+	{
+		bool operator()(const glm::vec3& a, const glm::vec3& b) const
+		{
+			return memcmp(&a, &b, sizeof(glm::vec3)) == 0;
+		}
+	};
+}
+
+namespace vklod {
+
+	std::vector<uint32_t> simplify(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices, size_t targetIndexCount, float& outError)
+	{
+		VK_TRACE_ZONE("vklod::simplify");
+
+		outError = 0.f;
+		size_t vertexCount = positions.size();
+
+		//Every corner points at the first vertex sharing its position
+		std::vector<uint32_t> canonical(vertexCount);
+		{
+			std::unordered_map<glm::vec3, uint32_t, PositionHash, PositionEqual> firstVertex;
+			firstVertex.reserve(vertexCount);
+			for (uint32_t v = 0; v < vertexCount; ++v)
+			{
+				canonical[v] = firstVertex.try_emplace(positions[v], v).first->second;
+			}
+		}
+
+		std::vector<uint32_t> result;
+		result.reserve(indices.size());
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			uint32_t a = canonical[indices[i + 0]];
+			uint32_t b = canonical[indices[i + 1]];
+			uint32_t c = canonical[indices[i + 2]];
+			if (a != b && b != c && a != c)
+			{
+				result.push_back(a);
+				result.push_back(b);
+				result.push_back(c);
+			}
+		}
+
+		//Undirected edges in sorted order, an edge seen once lies on an open border
+		std::vector<uint64_t> edges;
+		auto collect_edges = [&]() {
+			edges.clear();
+			for (size_t i = 0; i < result.size(); i += 3)
+			{
+				edges.push_back(edge_key(result[i + 0], result[i + 1]));
+				edges.push_back(edge_key(result[i + 1], result[i + 2]));
+				edges.push_back(edge_key(result[i + 2], result[i + 0]));
+			}
+			std::sort(edges.begin(), edges.end());
+		};
+		auto is_border_edge = [&](uint32_t a, uint32_t b) {
+			uint64_t key = edge_key(a, b);
+			auto range = std::equal_range(edges.begin(), edges.end(), key);
+			return range.second - range.first == 1;
+		};
+
+		collect_edges();
+
+		std::vector<Quadric> quadrics(vertexCount, Quadric{});
+		std::vector<bool> border(vertexCount, false);
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			uint32_t corners[3] = { result[i + 0], result[i + 1], result[i + 2] };
+			const glm::vec3& p0 = positions[corners[0]];
+			glm::vec3 normal = glm::cross(positions[corners[1]] - p0, positions[corners[2]] - p0);
+			float area = glm::length(normal);
+			if (area <= 0.f)
+				continue;
+			normal /= area;
+
+			for (int k = 0; k < 3; ++k)
+			{
+				quadrics[corners[k]].add_plane(normal, -glm::dot(normal, p0), area * 0.5);
+			}
+
+			//A plane through each border edge, perpendicular to the surface, pins the outline in place
+			for (int k = 0; k < 3; ++k)
+			{
+				uint32_t a = corners[k];
+				uint32_t b = corners[(k + 1) % 3];
+				if (!is_border_edge(a, b))
+					continue;
+
+				border[a] = border[b] = true;
+
+				glm::vec3 edge = positions[b] - positions[a];
+				float edgeLength = glm::length(edge);
+				if (edgeLength <= 0.f)
+					continue;
+
+				glm::vec3 borderNormal = glm::normalize(glm::cross(edge, normal));
+				double borderWeight = BORDER_WEIGHT * edgeLength * edgeLength;
+				quadrics[a].add_plane(borderNormal, -glm::dot(borderNormal, positions[a]), borderWeight);
+				quadrics[b].add_plane(borderNormal, -glm::dot(borderNormal, positions[a]), borderWeight);
+			}
+		}
+
+		std::vector<uint32_t> adjacencyOffsets;
+		std::vector<uint32_t> adjacency;
+		std::vector<Collapse> collapses;
+		std::vector<uint32_t> collapseTarget(vertexCount);
+		std::vector<bool> locked(vertexCount);
+
+		//Where each original vertex ended up
+		std::vector<uint32_t> finalVertex(vertexCount);
+		for (size_t v = 0; v < vertexCount; ++v)
+		{
+			finalVertex[v] = canonical[v];
+		}
+
+		//Each pass picks the cheapest collapses that don't touch each other, applies them all, then starts over
+		while (result.size() > targetIndexCount)
+		{
+			size_t triangleCount = result.size() / 3;
+
+			build_adjacency(result, vertexCount, adjacencyOffsets, adjacency);
+
+			//Border vertices may only slide along the border, anything else may go either way
+			collapses.clear();
+			for (size_t e = 0; e < edges.size(); ++e)
+			{
+				if (e > 0 && edges[e] == edges[e - 1])
+					continue;
+
+				uint32_t a = (uint32_t)(edges[e] >> 32);
+				uint32_t b = (uint32_t)edges[e];
+				bool borderEdge = e + 1 >= edges.size() || edges[e + 1] != edges[e];
+
+				Quadric merged = quadrics[a];
+				merged.add(quadrics[b]);
+				double weight = std::max(merged.weight, 1e-12);
+
+				Collapse best = { 0, 0, -1.0 };
+				if (!border[a] || (borderEdge && border[b]))
+				{
+					best = { a, b, merged.evaluate(positions[b]) / weight };
+				}
+				if (!border[b] || (borderEdge && border[a]))
+				{
+					double cost = merged.evaluate(positions[a]) / weight;
+					if (best.cost < 0.0 || cost < best.cost)
+					{
+						best = { b, a, cost };
+					}
+				}
+
+				if (best.cost >= 0.0)
+				{
+					collapses.push_back(best);
+				}
+			}
+
+			std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+
+			for (size_t v = 0; v < vertexCount; ++v)
+			{
+				collapseTarget[v] = (uint32_t)v;
+			}
+			std::fill(locked.begin(), locked.end(), false);
+
+			size_t targetTriangles = targetIndexCount / 3;
+			size_t collapsed = 0;
+			for (const Collapse& collapse : collapses)
+			{
+				if (triangleCount <= targetTriangles)
+					break;
+
+				if (locked[collapse.from] || locked[collapse.to])
+					continue;
+
+				//Every triangle around from that survives must keep facing the same way
+				bool flips = false;
+				uint32_t removedTriangles = 0;
+				for (uint32_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1] && !flips; ++a)
+				{
+					const uint32_t* corners = &result[adjacency[a] * 3];
+					if (corners[0] == collapse.to || corners[1] == collapse.to || corners[2] == collapse.to)
+					{
+						removedTriangles++;
+						continue;
+					}
+
+					glm::vec3 p[3];
+					for (int k = 0; k < 3; ++k)
+					{
+						p[k] = positions[corners[k]];
+					}
+					glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+					for (int k = 0; k < 3; ++k)
+					{
+						if (corners[k] == collapse.from)
+							p[k] = positions[collapse.to];
+					}
+					glm::vec3 after = glm::cross(p[1] - p[0], p[2] - p[0]);
+
+					flips = glm::dot(before, after) < MIN_NORMAL_DOT * glm::length(before) * glm::length(after);
+
+					//A triangle to already has over the same two vertices means the surface folds onto itself,
+					//which is how small closed parts shrink into a double sided sliver and then vanish
+					uint32_t x = corners[0] == collapse.from ? corners[1] : corners[0];
+					uint32_t y = corners[2] == collapse.from ? corners[1] : corners[2];
+					for (uint32_t t = adjacencyOffsets[collapse.to]; t < adjacencyOffsets[collapse.to + 1] && !flips; ++t)
+					{
+						const uint32_t* other = &result[adjacency[t] * 3];
+						bool hasX = other[0] == x || other[1] == x || other[2] == x;
+						bool hasY = other[0] == y || other[1] == y || other[2] == y;
+						flips = hasX && hasY;
+					}
+				}
+
+				if (flips)
+					continue;
+
+				//The whole one-ring is frozen for the rest of the pass, so the flip test above stays valid
+				for (uint32_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1]; ++a)
+				{
+					const uint32_t* corners = &result[adjacency[a] * 3];
+					locked[corners[0]] = locked[corners[1]] = locked[corners[2]] = true;
+				}
+
+				collapseTarget[collapse.from] = collapse.to;
+				quadrics[collapse.to].add(quadrics[collapse.from]);
+
+				triangleCount -= removedTriangles;
+				collapsed++;
+			}
+
+			if (collapsed == 0)
+				break;
+
+			for (size_t v = 0; v < vertexCount; ++v)
+			{
+				finalVertex[v] = collapseTarget[finalVertex[v]];
+			}
+
+			size_t write = 0;
+			for (size_t i = 0; i < result.size(); i += 3)
+			{
+				uint32_t a = collapseTarget[result[i + 0]];
+				uint32_t b = collapseTarget[result[i + 1]];
+				uint32_t c = collapseTarget[result[i + 2]];
+				if (a != b && b != c && a != c)
+				{
+					result[write++] = a;
+					result[write++] = b;
+					result[write++] = c;
+				}
+			}
+			result.resize(write);
+
+			collect_edges();
+		}
+
+		//The quadrics average over many planes and underestimate creases, so the reported error is measured:
+		//each original vertex against the simplified triangles around the vertex it collapsed into
+		build_adjacency(result, vertexCount, adjacencyOffsets, adjacency);
+		for (size_t v = 0; v < vertexCount; ++v)
+		{
+			uint32_t target = finalVertex[v];
+			if (target == v)
+				continue;
+
+			float distance = glm::length(positions[v] - positions[target]);
+			for (uint32_t a = adjacencyOffsets[target]; a < adjacencyOffsets[target + 1]; ++a)
+			{
+				const uint32_t* corners = &result[adjacency[a] * 3];
+				distance = std::min(distance, distance_to_triangle(positions[v], positions[corners[0]], positions[corners[1]], positions[corners[2]]));
+			}
+			outError = std::max(outError, distance);
+		}
+
+		return result;
+	}
+
+	void generate_lods(Mesh& mesh, const char* name)
+	{
+		VK_TRACE_ZONE("vklod::generate_lods");
+
+		std::vector<glm::vec3> positions = mesh.get_positions();
+		std::vector<uint32_t> fullDetail = mesh._indices;
+
+		mesh._lods.clear();
+		mesh._lods.push_back({ 0, (uint32_t)fullDetail.size(), 0.f });
+
+		std::cout << name << ": LOD 0 " << fullDetail.size() / 3 << " triangles";
+
+		//Every level starts over from the full mesh, so its error is measured against the real surface
+		for (uint32_t level = 1; level < MAX_LODS; ++level)
+		{
+			const MeshLod& previous = mesh._lods.back();
+			size_t target = (previous.indexCount / 2) / 3 * 3;
+
+			float error;
+			std::vector<uint32_t> lod = simplify(positions, fullDetail, target, error);
+
+			//Stuck on borders or flips, another level would look the same
+			if (lod.empty() || lod.size() > previous.indexCount * 9 / 10)
+				break;
+
+			vkmeshopt::optimize_vertex_cache(lod, positions.size());
+
+			MeshLod next;
+			next.firstIndex = (uint32_t)mesh._indices.size();
+			next.indexCount = (uint32_t)lod.size();
+			next.error = std::max(error, previous.error);
+
+			mesh._indices.insert(mesh._indices.end(), lod.begin(), lod.end());
+			mesh._lods.push_back(next);
+
+			std::cout << ", LOD " << level << " " << lod.size() / 3 << " (error " << next.error << ")";
+		}
+
+		std::cout << std::endl;
+	}
+
+	uint32_t select_lod(const Mesh& mesh, float distance, float scale, float projectionScale, float maxPixelError)
+	{
+		if (mesh._lods.empty() || distance <= 0.f)
+			return 0;
+
+		for (uint32_t level = (uint32_t)mesh._lods.size() - 1; level > 0; --level)
+		{
+			float pixelError = mesh._lods[level].error * scale / distance * projectionScale;
+			if (pixelError <= maxPixelError)
+				return level;
+		}
+		return 0;
+	}
+}
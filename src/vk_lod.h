@@ -0,0 +1,24 @@
+#pragma once
+
+#include <vk_mesh.h>
+
+//Level of detail chains built by edge collapse simplification (Garland & Heckbert quadric error metrics).
+//Collapses only ever move a vertex onto one of its neighbours, so every level reuses the vertices of
+//the full mesh and only needs its own index range.
+namespace vklod {
+
+	//Levels generate_lods aims for, including the full mesh
+	constexpr uint32_t MAX_LODS = 5;
+
+	//Collapses edges of indices until at most targetIndexCount remain or nothing can go without flipping triangles.
+	//outError is the largest distance, in mesh units, between the result and the surface it came from.
+	std::vector<uint32_t> simplify(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices, size_t targetIndexCount, float& outError);
+
+	//Appends up to MAX_LODS - 1 coarser levels, each about half the triangles of the previous one, after the
+	//current indices and fills mesh._lods. The chain stops early once simplification stops making progress.
+	void generate_lods(Mesh& mesh, const char* name);
+
+	//Coarsest level whose error, projected at distance, stays under maxPixelError.
+	//projectionScale is the viewport height over 2 * tan(fovy / 2), scale the largest axis scale of the model matrix.
+	uint32_t select_lod(const Mesh& mesh, float distance, float scale, float projectionScale, float maxPixelError);
+}
@@ -0,0 +1,199 @@
+#include "vk_lz4.h"
+
+#include <cstring>
+#include <vector>
+
+namespace {
+
+	constexpr size_t MIN_MATCH = 4;
+	//The format requires the last 5 bytes to be literals and the last match to start 12 bytes before the end
+	constexpr size_t LAST_LITERALS = 5;
+	constexpr size_t MATCH_FIND_LIMIT = 12;
+	constexpr size_t MAX_OFFSET = 65535;
+	constexpr uint32_t HASH_LOG = 16;
+
+	uint32_t read32(const uint8_t* p)
+	{
+		uint32_t value;
+		memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	uint32_t hash_sequence(uint32_t sequence)
+	{
+		return (sequence * 2654435761u) >> (32 - HASH_LOG);
+	}
+
+	//Lengths past the 4 bit token field continue as a run of 255 bytes plus a remainder
+	uint8_t* write_length(uint8_t* op, size_t length)
+	{
+		while (length >= 255)
+		{
+			*op++ = 255;
+			length -= 255;
+		}
+		*op++ = (uint8_t)length;
+		return op;
+	}
+
+	uint8_t* write_sequence(uint8_t* op, const uint8_t* literals, size_t literalLength, size_t offset, size_t matchLength)
+	{
+		size_t matchCode = matchLength - MIN_MATCH;
+
+		uint8_t* token = op++;
+		*token = (uint8_t)(((literalLength < 15 ? literalLength : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+
+		if (literalLength >= 15)
+		{
+			op = write_length(op, literalLength - 15);
+		}
+
+		memcpy(op, literals, literalLength);
+		op += literalLength;
+
+		*op++ = (uint8_t)(offset & 0xFF);
+		*op++ = (uint8_t)(offset >> 8);
+
+		if (matchCode >= 15)
+		{
+			op = write_length(op, matchCode - 15);
+		}
+
+		return op;
+	}
+}
+
+namespace vklz4 {
+
+	size_t compress_bound(size_t srcSize)
+	{
+		return srcSize + srcSize / 255 + 16;
+	}
+
+	size_t compress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstCapacity)
+	{
+		if (dstCapacity < compress_bound(srcSize))
+			return 0;
+
+		uint8_t* op = dst;
+		size_t anchor = 0;
+
+		if (srcSize > MATCH_FIND_LIMIT)
+		{
+			//Last position seen for each hashed 4 byte sequence, +1 so 0 means empty
+			std::vector<uint32_t> table(1u << HASH_LOG, 0);
+
+			size_t matchEnd = srcSize - LAST_LITERALS;
+			size_t ip = 0;
+			while (ip < srcSize - MATCH_FIND_LIMIT)
+			{
+				uint32_t sequence = read32(src + ip);
+				uint32_t h = hash_sequence(sequence);
+				size_t candidate = table[h];
+				table[h] = (uint32_t)(ip + 1);
+
+				if (candidate == 0 || ip - (candidate - 1) > MAX_OFFSET || read32(src + candidate - 1) != sequence)
+				{
+					++ip;
+					continue;
+				}
+
+				size_t match = candidate - 1;
+				size_t length = MIN_MATCH;
+				while (ip + length < matchEnd && src[match + length] == src[ip + length])
+				{
+					++length;
+				}
+
+				op = write_sequence(op, src + anchor, ip - anchor, ip - match, length);
+
+				ip += length;
+				anchor = ip;
+			}
+		}
+
+		//Whatever is left goes out as a literal only sequence
+		size_t literalLength = srcSize - anchor;
+		*op++ = (uint8_t)((literalLength < 15 ? literalLength : 15) << 4);
+		if (literalLength >= 15)
+		{
+			op = write_length(op, literalLength - 15);
+		}
+		if (literalLength > 0)
+		{
+			memcpy(op, src + anchor, literalLength);
+			op += literalLength;
+		}
+
+		return (size_t)(op - dst);
+	}
+
+	bool decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize)
+	{
+		const uint8_t* ip = src;
+		const uint8_t* srcEnd = src + srcSize;
+		uint8_t* op = dst;
+		uint8_t* dstEnd = dst + dstSize;
+
+		auto read_length = [&](size_t& length) {
+			uint8_t b;
+			do
+			{
+				if (ip >= srcEnd)
+					return false;
+				b = *ip++;
+				length += b;
+			} while (b == 255);
+			return true;
+		};
+
+		while (ip < srcEnd)
+		{
+			uint8_t token = *ip++;
+
+			size_t literalLength = token >> 4;
+			if (literalLength == 15 && !read_length(literalLength))
+				return false;
+
+			if (literalLength > (size_t)(srcEnd - ip) || literalLength > (size_t)(dstEnd - op))
+				return false;
+
+			if (literalLength > 0)
+			{
+				memcpy(op, ip, literalLength);
+				ip += literalLength;
+				op += literalLength;
+			}
+
+			//The last sequence has no match part
+			if (ip == srcEnd)
+				break;
+
+			if (srcEnd - ip < 2)
+				return false;
+
+			size_t offset = ip[0] | (ip[1] << 8);
+			ip += 2;
+			if (offset == 0 || offset > (size_t)(op - dst))
+				return false;
+
+			size_t matchLength = token & 15;
+			if (matchLength == 15 && !read_length(matchLength))
+				return false;
+			matchLength += MIN_MATCH;
+
+			if (matchLength > (size_t)(dstEnd - op))
+				return false;
+
+			//Byte by byte since the match may overlap what it is writing
+			const uint8_t* match = op - offset;
+			for (size_t i = 0; i < matchLength; ++i)
+			{
+				op[i] = match[i];
+			}
+			op += matchLength;
+		}
+
+		return op == dstEnd;
+	}
+}
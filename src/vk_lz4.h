@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+//LZ4 block format codec, output is readable by any LZ4 block decoder and the other way around.
+//The compressor is the plain greedy single-probe variant: fast, a bit below reference ratios.
+namespace vklz4 {
+
+	//Worst case compressed size for srcSize bytes of incompressible input
+	size_t compress_bound(size_t srcSize);
+
+	//Returns the compressed size, 0 when dstCapacity is below compress_bound(srcSize)
+	size_t compress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstCapacity);
+
+	//True only when src decodes to exactly dstSize bytes, malformed input never reads or writes out of bounds
+	bool decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t dstSize);
+}
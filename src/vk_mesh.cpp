@@ -1,7 +1,145 @@
 #include "vk_mesh.h"
+#include "vk_trace.h"
 
 #include <tiny_obj_loader.h>
 #include <iostream>
+#include <unordered_map>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+#include <glm/gtx/transform.hpp>
+
+namespace {
+
+	//Hashes the raw bits of every component, matching the bitwise operator==
+	struct VertexHash
+	{
+		size_t operator()(const Vertex& vertex) const
+		{
+			uint32_t words[sizeof(Vertex) / sizeof(uint32_t)];
+			memcpy(words, &vertex, sizeof(Vertex));
+
+			//FNV-1a over 32 bit words with a final avalanche, cheap and good enough for float bit patterns
+			uint64_t hash = 14695981039346656037ull;
+			for (uint32_t word : words)
+			{
+				hash = (hash ^ word) * 1099511628211ull;
+			}
+			hash ^= hash >> 32;
+			return (size_t)hash;
+		}
+	};
+
+	//Positions are strided floats so Vertex arrays are read in place
+	struct PositionStream
+	{
+		const float* data;
+		size_t stride;
+		size_t count;
+
+		const float* operator[](size_t i) const { return data + i * stride; }
+
+		//x, y, z and junk in the last lane. The last tightly packed position would read past the end, it is assembled instead.
+		__m128 load(size_t i) const
+		{
+			const float* p = (*this)[i];
+			return (stride > 3 || i + 1 < count) ? _mm_loadu_ps(p) : _mm_setr_ps(p[0], p[1], p[2], 0.f);
+		}
+
+		//Squared distances from center of positions i to i + 3, one per lane
+		__m128 distance_squared4(size_t i, __m128 cx, __m128 cy, __m128 cz) const
+		{
+			const float* p0 = (*this)[i];
+			const float* p1 = (*this)[i + 1];
+			const float* p2 = (*this)[i + 2];
+			const float* p3 = (*this)[i + 3];
+			__m128 dx = _mm_sub_ps(_mm_setr_ps(p0[0], p1[0], p2[0], p3[0]), cx);
+			__m128 dy = _mm_sub_ps(_mm_setr_ps(p0[1], p1[1], p2[1], p3[1]), cy);
+			__m128 dz = _mm_sub_ps(_mm_setr_ps(p0[2], p1[2], p2[2], p3[2]), cz);
+			return _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		}
+	};
+
+	glm::vec3 to_vec3(const float* p)
+	{
+		return glm::vec3(p[0], p[1], p[2]);
+	}
+
+	float horizontal_max(__m128 v)
+	{
+		v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+		v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+		return _mm_cvtss_f32(v);
+	}
+
+	//Largest distance from center to any position, the radius of a sphere around it holding them all
+	float max_distance(const PositionStream& positions, const glm::vec3& center)
+	{
+		__m128 cx = _mm_set1_ps(center.x);
+		__m128 cy = _mm_set1_ps(center.y);
+		__m128 cz = _mm_set1_ps(center.z);
+
+		__m128 maxSquared = _mm_setzero_ps();
+		size_t i = 0;
+		for (; i + 4 <= positions.count; i += 4)
+		{
+			maxSquared = _mm_max_ps(maxSquared, positions.distance_squared4(i, cx, cy, cz));
+		}
+
+		float result = horizontal_max(maxSquared);
+		for (; i < positions.count; ++i)
+		{
+			glm::vec3 d = to_vec3(positions[i]) - center;
+			result = std::max(result, glm::dot(d, d));
+		}
+		return std::sqrt(result);
+	}
+}
+
+VertexInputDescription PackedVertex::get_vertex_description()
+{
+	VertexInputDescription description;
+
+	VkVertexInputBindingDescription mainBinding = {};
+	mainBinding.binding = 0;
+	mainBinding.stride = sizeof(PackedVertex);
+	mainBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+	description.bindings.push_back(mainBinding);
+
+	//Same locations as Vertex, the shader gets floats back from the normalized formats
+	VkVertexInputAttributeDescription positionAttribute = {};
+	positionAttribute.binding = 0;
+	positionAttribute.location = 0;
+	positionAttribute.format = VK_FORMAT_R16G16B16A16_UNORM;
+	positionAttribute.offset = offsetof(PackedVertex, position);
+
+	VkVertexInputAttributeDescription normalAttribute = {};
+	normalAttribute.binding = 0;
+	normalAttribute.location = 1;
+	normalAttribute.format = VK_FORMAT_R16G16_SNORM;
+	normalAttribute.offset = offsetof(PackedVertex, normal);
+
+	VkVertexInputAttributeDescription colorAttribute = {};
+	colorAttribute.binding = 0;
+	colorAttribute.location = 2;
+	colorAttribute.format = VK_FORMAT_R8G8B8A8_UNORM;
+	colorAttribute.offset = offsetof(PackedVertex, color);
+
+	description.attributes.push_back(positionAttribute);
+	description.attributes.push_back(normalAttribute);
+	description.attributes.push_back(colorAttribute);
+
+	return description;
+}
+
+bool Vertex::operator==(const Vertex& other) const
+{
+	return memcmp(this, &other, sizeof(Vertex)) == 0;
+}
 
 VertexInputDescription Vertex::get_vertex_description()
 {
@@ -45,6 +183,8 @@ VertexInputDescription Vertex::get_vertex_description()
 
 bool Mesh::load_from_obj(const char* filename)
 {
+	VK_TRACE_ZONE("Mesh::load_from_obj");
+
 	//attrib will contain the vertex arrays of the file
 	tinyobj::attrib_t attrib;
 	//shapes contains the info for each separate object in the file
@@ -66,6 +206,12 @@ bool Mesh::load_from_obj(const char* filename)
 		return false;
 	}
 
+	//Identical corners map to a single vertex, every corner still gets an index
+	std::unordered_map<Vertex, uint32_t, VertexHash> uniqueVertices;
+	uniqueVertices.reserve(attrib.vertices.size() / 3);
+
+	size_t cornerCount = 0;
+
 	//Loop over shapes
 	const size_t& shapesSize = shapes.size();
 	for (size_t s = 0; s < shapesSize; ++s)
@@ -95,7 +241,9 @@ bool Mesh::load_from_obj(const char* filename)
 				tinyobj::real_t& ny = attrib.normals[3 * idx.normal_index + 1];
 				tinyobj::real_t& nz = attrib.normals[3 * idx.normal_index + 2];
 
+				//Zeroed so padding can't break the bitwise hash and compare
 				Vertex new_vert;
+				memset(&new_vert, 0, sizeof(Vertex));
 				new_vert.position.x = vx;
 				new_vert.position.y = vy;
 				new_vert.position.z = vz;
@@ -108,12 +256,237 @@ bool Mesh::load_from_obj(const char* filename)
 				new_vert.color = new_vert.normal;
 
 
-				_vertices.push_back(new_vert);
+				auto inserted = uniqueVertices.try_emplace(new_vert, (uint32_t)_vertices.size());
+				if (inserted.second)
+				{
+					_vertices.push_back(new_vert);
+				}
+				_indices.push_back(inserted.first->second);
 			}
 
 			index_offset += fv;
+			cornerCount += fv;
 		}
 	}
 
+	std::cout << filename << ": " << _vertices.size() << " unique vertices out of " << cornerCount << " corners" << std::endl;
+
+	compute_bounds();
+
 	return true;
+}
+
+void Mesh::compute_bounds()
+{
+	VK_TRACE_ZONE("Mesh::compute_bounds");
+
+	//Packed positions only exist quantized, they are decoded once and read from there
+	std::vector<glm::vec3> decoded;
+	PositionStream positions;
+	if (_vertexFormat == VertexFormat::Packed)
+	{
+		decoded = get_positions();
+		positions = { decoded.empty() ? nullptr : &decoded[0].x, 3, decoded.size() };
+	}
+	else
+	{
+		positions = { _vertices.empty() ? nullptr : &_vertices[0].position.x, sizeof(Vertex) / sizeof(float), _vertices.size() };
+	}
+
+	if (positions.count == 0)
+	{
+		_boundsMin = _boundsMax = glm::vec3(0.f);
+		_boundingSphere = glm::vec4(0.f);
+		return;
+	}
+
+	//One position per iteration with x, y and z side by side, also tracking which vertex holds each extreme
+	__m128 minBounds = positions.load(0);
+	__m128 maxBounds = minBounds;
+	__m128i minVertex = _mm_setzero_si128();
+	__m128i maxVertex = _mm_setzero_si128();
+	for (size_t i = 1; i < positions.count; ++i)
+	{
+		__m128 p = positions.load(i);
+		__m128i vertex = _mm_set1_epi32((int)i);
+
+		__m128i below = _mm_castps_si128(_mm_cmplt_ps(p, minBounds));
+		__m128i above = _mm_castps_si128(_mm_cmpgt_ps(p, maxBounds));
+		minVertex = _mm_or_si128(_mm_and_si128(below, vertex), _mm_andnot_si128(below, minVertex));
+		maxVertex = _mm_or_si128(_mm_and_si128(above, vertex), _mm_andnot_si128(above, maxVertex));
+
+		minBounds = _mm_min_ps(minBounds, p);
+		maxBounds = _mm_max_ps(maxBounds, p);
+	}
+
+	float minStored[4];
+	float maxStored[4];
+	int32_t minVertices[4];
+	int32_t maxVertices[4];
+	_mm_storeu_ps(minStored, minBounds);
+	_mm_storeu_ps(maxStored, maxBounds);
+	_mm_storeu_si128((__m128i*)minVertices, minVertex);
+	_mm_storeu_si128((__m128i*)maxVertices, maxVertex);
+
+	_boundsMin = to_vec3(minStored);
+	_boundsMax = to_vec3(maxStored);
+
+	//Ritter: start from the axis whose extreme vertices are furthest apart
+	glm::vec3 from = to_vec3(positions[minVertices[0]]);
+	glm::vec3 to = to_vec3(positions[maxVertices[0]]);
+	for (int axis = 1; axis < 3; ++axis)
+	{
+		glm::vec3 axisFrom = to_vec3(positions[minVertices[axis]]);
+		glm::vec3 axisTo = to_vec3(positions[maxVertices[axis]]);
+		if (glm::dot(axisTo - axisFrom, axisTo - axisFrom) > glm::dot(to - from, to - from))
+		{
+			from = axisFrom;
+			to = axisTo;
+		}
+	}
+
+	glm::vec3 center = (from + to) * 0.5f;
+	float radius = glm::length(to - from) * 0.5f;
+
+	//Then grow it over every vertex left outside. Four at a time are tested, the rare miss grows one vertex at a time.
+	auto grow = [&](size_t i) {
+		glm::vec3 p = to_vec3(positions[i]);
+		float distance = glm::length(p - center);
+		if (distance <= radius)
+			return;
+
+		float grownRadius = (radius + distance) * 0.5f;
+		center += (p - center) * ((grownRadius - radius) / distance);
+		radius = grownRadius;
+	};
+
+	size_t i = 0;
+	for (; i + 4 <= positions.count; i += 4)
+	{
+		__m128 distanceSquared = positions.distance_squared4(i, _mm_set1_ps(center.x), _mm_set1_ps(center.y), _mm_set1_ps(center.z));
+		if (_mm_movemask_ps(_mm_cmpgt_ps(distanceSquared, _mm_set1_ps(radius * radius))) == 0)
+			continue;
+
+		for (size_t k = i; k < i + 4; ++k)
+		{
+			grow(k);
+		}
+	}
+	for (; i < positions.count; ++i)
+	{
+		grow(i);
+	}
+
+	//Rounding in the growth steps can leave the last vertex a hair outside, measure the final radius exactly
+	radius = max_distance(positions, center);
+
+	//Boxy meshes can do better around the box center
+	glm::vec3 boxCenter = (_boundsMin + _boundsMax) * 0.5f;
+	float boxRadius = max_distance(positions, boxCenter);
+	if (boxRadius < radius)
+	{
+		center = boxCenter;
+		radius = boxRadius;
+	}
+
+	_boundingSphere = glm::vec4(center, radius);
+}
+
+void Mesh::pack_vertices()
+{
+	glm::vec3 minBounds(0.f);
+	glm::vec3 maxBounds(0.f);
+	if (!_vertices.empty())
+	{
+		minBounds = maxBounds = _vertices[0].position;
+	}
+	for (const Vertex& vertex : _vertices)
+	{
+		minBounds = glm::min(minBounds, vertex.position);
+		maxBounds = glm::max(maxBounds, vertex.position);
+	}
+
+	_positionOffset = minBounds;
+	_positionScale = maxBounds - minBounds;
+
+	//Flat axes would divide by zero, any scale decodes them right
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (_positionScale[axis] <= 0.f)
+		{
+			_positionScale[axis] = 1.f;
+		}
+	}
+
+	auto unorm16 = [](float v) { return (uint16_t)std::lround(std::clamp(v, 0.f, 1.f) * 65535.f); };
+	auto snorm16 = [](float v) { return (int16_t)std::lround(std::clamp(v, -1.f, 1.f) * 32767.f); };
+	auto unorm8 = [](float v) { return (uint8_t)std::lround(std::clamp(v, 0.f, 1.f) * 255.f); };
+
+	_packedVertices.resize(_vertices.size());
+	for (size_t i = 0; i < _vertices.size(); ++i)
+	{
+		const Vertex& vertex = _vertices[i];
+		PackedVertex& packed = _packedVertices[i];
+
+		glm::vec3 position = (vertex.position - _positionOffset) / _positionScale;
+		packed.position[0] = unorm16(position.x);
+		packed.position[1] = unorm16(position.y);
+		packed.position[2] = unorm16(position.z);
+		packed.position[3] = 0;
+
+		//Octahedral mapping: project on the octahedron, fold the lower half over the upper one
+		glm::vec3 n = vertex.normal;
+		float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+		n = l1 > 0.f ? n / l1 : glm::vec3(0.f, 0.f, 1.f);
+
+		float ex = n.x;
+		float ey = n.y;
+		if (n.z < 0.f)
+		{
+			ex = (1.f - std::abs(n.y)) * (n.x >= 0.f ? 1.f : -1.f);
+			ey = (1.f - std::abs(n.x)) * (n.y >= 0.f ? 1.f : -1.f);
+		}
+		packed.normal[0] = snorm16(ex);
+		packed.normal[1] = snorm16(ey);
+
+		packed.color[0] = unorm8(vertex.color.r);
+		packed.color[1] = unorm8(vertex.color.g);
+		packed.color[2] = unorm8(vertex.color.b);
+		packed.color[3] = 255;
+	}
+
+	_vertexFormat = VertexFormat::Packed;
+}
+
+glm::mat4 Mesh::get_dequantization_matrix() const
+{
+	if (_vertexFormat != VertexFormat::Packed)
+		return glm::mat4{ 1.f };
+
+	return glm::translate(_positionOffset) * glm::scale(_positionScale);
+}
+
+std::vector<glm::vec3> Mesh::get_positions() const
+{
+	std::vector<glm::vec3> positions;
+
+	if (_vertexFormat == VertexFormat::Packed)
+	{
+		positions.reserve(_packedVertices.size());
+		for (const PackedVertex& vertex : _packedVertices)
+		{
+			glm::vec3 unorm = glm::vec3(vertex.position[0], vertex.position[1], vertex.position[2]) / 65535.f;
+			positions.push_back(_positionOffset + unorm * _positionScale);
+		}
+	}
+	else
+	{
+		positions.reserve(_vertices.size());
+		for (const Vertex& vertex : _vertices)
+		{
+			positions.push_back(vertex.position);
+		}
+	}
+
+	return positions;
 }
\ No newline at end of file
@@ -3,6 +3,8 @@
 #include <vk_types.h>
 #include <vector>
 #include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
 
 struct VertexInputDescription
 {
@@ -19,13 +21,74 @@ struct Vertex
 	glm::vec3 color;
 
 	static VertexInputDescription get_vertex_description();
+
+	//Bitwise comparison, used to merge identical corners when loading
+	bool operator==(const Vertex& other) const;
+};
+
+//16 bytes instead of 36: positions are unorm16 within the mesh bounds,
+//normals octahedral encoded in 2 snorm16 and color is RGBA8
+struct PackedVertex
+{
+	uint16_t position[4];
+	int16_t normal[2];
+	uint8_t color[4];
+
+	static VertexInputDescription get_vertex_description();
+};
+
+enum class VertexFormat
+{
+	Full,
+	Packed
+};
+
+//One level of detail, a range of Mesh::_indices over the vertices shared by every level
+struct MeshLod
+{
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	//Largest distance to the full detail surface, in mesh units
+	float error;
 };
 
 struct Mesh
 {
 	std::vector<Vertex> _vertices;
+	//Always 32 bit on the CPU, narrowed to 16 bit at upload when the vertex count allows it
+	std::vector<uint32_t> _indices;
+	//Finest first. Empty when no chain was generated, the whole index buffer is then the only level
+	std::vector<MeshLod> _lods;
+
+	//Filled by pack_vertices(), what gets uploaded when the format is Packed
+	std::vector<PackedVertex> _packedVertices;
+	VertexFormat _vertexFormat{ VertexFormat::Full };
+	//Packed positions decode as offset + unorm * scale
+	glm::vec3 _positionOffset{ 0.f };
+	glm::vec3 _positionScale{ 1.f };
+
+	//Mesh space bounds, filled by compute_bounds() when the mesh is loaded and stored with baked meshes
+	glm::vec3 _boundsMin{ 0.f };
+	glm::vec3 _boundsMax{ 0.f };
+	//xyz center, w radius
+	glm::vec4 _boundingSphere{ 0.f };
 
 	AllocatedBuffer _vertexBuffer;
+	AllocatedBuffer _indexBuffer;
+	VkIndexType _indexType{ VK_INDEX_TYPE_UINT32 };
+	uint32_t _indexCount{ 0 };
 
 	bool load_from_obj(const char* filename);
+
+	//AABB and a Ritter bounding sphere of the current vertices, SSE over the positions
+	void compute_bounds();
+
+	//Quantizes _vertices into _packedVertices and switches the mesh to the packed format
+	void pack_vertices();
+
+	//Maps packed positions back to mesh space, to be folded into the model matrix. Identity when Full.
+	glm::mat4 get_dequantization_matrix() const;
+
+	//Mesh space positions of whichever vertex array the current format uses
+	std::vector<glm::vec3> get_positions() const;
 };
\ No newline at end of file
@@ -0,0 +1,356 @@
+#include "vk_mesh_opt.h"
+#include "vk_trace.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+
+namespace {
+
+	//Triangles using each vertex, as offsets into a flat list
+	struct Adjacency
+	{
+		std::vector<uint32_t> offsets;
+		std::vector<uint32_t> triangles;
+		std::vector<uint32_t> counts;
+	};
+
+	void build_adjacency(Adjacency& adjacency, const std::vector<uint32_t>& indices, size_t vertexCount)
+	{
+		adjacency.counts.assign(vertexCount, 0);
+		for (uint32_t index : indices)
+		{
+			adjacency.counts[index]++;
+		}
+
+		adjacency.offsets.resize(vertexCount + 1);
+		adjacency.offsets[0] = 0;
+		for (size_t v = 0; v < vertexCount; ++v)
+		{
+			adjacency.offsets[v + 1] = adjacency.offsets[v] + adjacency.counts[v];
+		}
+
+		adjacency.triangles.resize(indices.size());
+		std::vector<uint32_t> fill(adjacency.offsets.begin(), adjacency.offsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); ++i)
+		{
+			adjacency.triangles[fill[indices[i]]++] = (uint32_t)(i / 3);
+		}
+	}
+
+	//FIFO cache simulation, returns the misses of one triangle
+	struct FifoCache
+	{
+		std::vector<uint32_t> timestamps;
+		uint32_t time;
+		uint32_t size;
+
+		FifoCache(size_t vertexCount, uint32_t cacheSize) : timestamps(vertexCount, 0), time(cacheSize + 1), size(cacheSize) {}
+
+		void reset()
+		{
+			//Moving time forward evicts everything without touching the table
+			time += size + 1;
+		}
+
+		uint32_t triangle(const uint32_t* tri)
+		{
+			uint32_t misses = 0;
+			for (int k = 0; k < 3; ++k)
+			{
+				if (time - timestamps[tri[k]] > size)
+				{
+					timestamps[tri[k]] = time++;
+					misses++;
+				}
+			}
+			return misses;
+		}
+	};
+}
+
+namespace vkmeshopt {
+
+	VertexCacheStats analyze_vertex_cache(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize)
+	{
+		VertexCacheStats stats = { 0.f, 0.f };
+		if (indices.empty())
+			return stats;
+
+		FifoCache cache(vertexCount, cacheSize);
+		std::vector<bool> referenced(vertexCount, false);
+
+		size_t misses = 0;
+		size_t uniqueVertices = 0;
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			misses += cache.triangle(&indices[i]);
+
+			for (int k = 0; k < 3; ++k)
+			{
+				if (!referenced[indices[i + k]])
+				{
+					referenced[indices[i + k]] = true;
+					uniqueVertices++;
+				}
+			}
+		}
+
+		stats.acmr = (float)misses / (indices.size() / 3);
+		stats.atvr = (float)misses / uniqueVertices;
+		return stats;
+	}
+
+	void optimize_vertex_cache(std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize)
+	{
+		size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0)
+			return;
+
+		Adjacency adjacency;
+		build_adjacency(adjacency, indices, vertexCount);
+
+		//Triangles left to emit per vertex
+		std::vector<uint32_t> live = adjacency.counts;
+		std::vector<uint32_t> cacheTime(vertexCount, 0);
+		std::vector<bool> emitted(triangleCount, false);
+
+		std::vector<uint32_t> deadEnd;
+		std::vector<uint32_t> candidates;
+
+		std::vector<uint32_t> result;
+		result.reserve(indices.size());
+
+		uint32_t time = cacheSize + 1;
+		size_t cursor = 0;
+		int64_t fanning = 0;
+
+		while (fanning >= 0)
+		{
+			candidates.clear();
+
+			//Emit every remaining triangle around the fanning vertex
+			for (uint32_t a = adjacency.offsets[fanning]; a < adjacency.offsets[fanning + 1]; ++a)
+			{
+				uint32_t t = adjacency.triangles[a];
+				if (emitted[t])
+					continue;
+
+				for (int k = 0; k < 3; ++k)
+				{
+					uint32_t v = indices[t * 3 + k];
+					result.push_back(v);
+					deadEnd.push_back(v);
+					candidates.push_back(v);
+					live[v]--;
+
+					if (time - cacheTime[v] > cacheSize)
+					{
+						cacheTime[v] = time++;
+					}
+				}
+				emitted[t] = true;
+			}
+
+			//Next fanning vertex: the oldest candidate that will still be in the cache after its fan
+			int64_t best = -1;
+			int64_t bestPriority = -1;
+			for (uint32_t v : candidates)
+			{
+				if (live[v] == 0)
+					continue;
+
+				int64_t priority = 0;
+				if (time - cacheTime[v] + 2 * live[v] <= cacheSize)
+				{
+					priority = time - cacheTime[v];
+				}
+				if (priority > bestPriority)
+				{
+					best = v;
+					bestPriority = priority;
+				}
+			}
+
+			if (best == -1)
+			{
+				//Dead end, go back to recently touched vertices first, then scan in input order
+				while (!deadEnd.empty())
+				{
+					uint32_t v = deadEnd.back();
+					deadEnd.pop_back();
+					if (live[v] > 0)
+					{
+						best = v;
+						break;
+					}
+				}
+
+				while (best == -1 && cursor < vertexCount)
+				{
+					if (live[cursor] > 0)
+					{
+						best = (int64_t)cursor;
+					}
+					++cursor;
+				}
+			}
+
+			fanning = best;
+		}
+
+		indices.swap(result);
+	}
+
+	void optimize_overdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, float threshold, uint32_t cacheSize)
+	{
+		size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0)
+			return;
+
+		float targetAcmr = analyze_vertex_cache(indices, vertices.size(), cacheSize).acmr * threshold;
+
+		//Hard boundaries are where the order jumped: all three vertices missed the cache.
+		//Clusters are cut there, and also inside once their own ACMR reached the target, as the
+		//cut will cost a few extra misses when clusters get reordered.
+		std::vector<uint32_t> clusters;
+		{
+			FifoCache hardCache(vertices.size(), cacheSize);
+			FifoCache softCache(vertices.size(), cacheSize);
+
+			size_t clusterStart = 0;
+			size_t clusterMisses = 0;
+			for (size_t t = 0; t < triangleCount; ++t)
+			{
+				bool hardBoundary = hardCache.triangle(&indices[t * 3]) == 3;
+				if (t == 0 || hardBoundary)
+				{
+					clusters.push_back((uint32_t)t);
+					clusterStart = t;
+					clusterMisses = 0;
+					softCache.reset();
+				}
+
+				clusterMisses += softCache.triangle(&indices[t * 3]);
+
+				float clusterAcmr = (float)clusterMisses / (t - clusterStart + 1);
+				if (clusterAcmr <= targetAcmr && t + 1 < triangleCount)
+				{
+					clusters.push_back((uint32_t)(t + 1));
+					clusterStart = t + 1;
+					clusterMisses = 0;
+					softCache.reset();
+					//The hard cache keeps running, a soft cut is not a jump in the input order
+				}
+			}
+
+			//Soft cuts right before a hard boundary leave duplicates
+			clusters.erase(std::unique(clusters.begin(), clusters.end()), clusters.end());
+		}
+
+		size_t clusterCount = clusters.size();
+		clusters.push_back((uint32_t)triangleCount);
+
+		//Area weighted centroid and normal of the whole mesh and of every cluster
+		std::vector<glm::vec3> clusterCentroids(clusterCount, glm::vec3(0.f));
+		std::vector<glm::vec3> clusterNormals(clusterCount, glm::vec3(0.f));
+		glm::vec3 meshCentroid(0.f);
+		float meshArea = 0.f;
+
+		for (size_t c = 0; c < clusterCount; ++c)
+		{
+			float clusterArea = 0.f;
+			for (uint32_t t = clusters[c]; t < clusters[c + 1]; ++t)
+			{
+				const glm::vec3& p0 = vertices[indices[t * 3 + 0]].position;
+				const glm::vec3& p1 = vertices[indices[t * 3 + 1]].position;
+				const glm::vec3& p2 = vertices[indices[t * 3 + 2]].position;
+
+				glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+				float area = glm::length(normal);
+				glm::vec3 center = (p0 + p1 + p2) / 3.f;
+
+				clusterCentroids[c] += center * area;
+				clusterNormals[c] += normal;
+				clusterArea += area;
+			}
+
+			meshCentroid += clusterCentroids[c];
+			meshArea += clusterArea;
+
+			if (clusterArea > 0.f)
+			{
+				clusterCentroids[c] /= clusterArea;
+			}
+
+			float normalLength = glm::length(clusterNormals[c]);
+			if (normalLength > 0.f)
+			{
+				clusterNormals[c] /= normalLength;
+			}
+		}
+
+		if (meshArea > 0.f)
+		{
+			meshCentroid /= meshArea;
+		}
+
+		//Clusters far out along their own normal are likely to occlude the rest, they go first
+		std::vector<float> sortKeys(clusterCount);
+		for (size_t c = 0; c < clusterCount; ++c)
+		{
+			sortKeys[c] = glm::dot(clusterCentroids[c] - meshCentroid, clusterNormals[c]);
+		}
+
+		std::vector<uint32_t> order(clusterCount);
+		std::iota(order.begin(), order.end(), 0);
+		std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+		std::vector<uint32_t> result;
+		result.reserve(indices.size());
+		for (uint32_t c : order)
+		{
+			result.insert(result.end(), indices.begin() + clusters[c] * 3, indices.begin() + clusters[c + 1] * 3);
+		}
+
+		indices.swap(result);
+	}
+
+	void optimize_vertex_fetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+	{
+		std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+
+		std::vector<Vertex> result;
+		result.reserve(vertices.size());
+
+		for (uint32_t& index : indices)
+		{
+			if (remap[index] == UINT32_MAX)
+			{
+				remap[index] = (uint32_t)result.size();
+				result.push_back(vertices[index]);
+			}
+			index = remap[index];
+		}
+
+		vertices.swap(result);
+	}
+
+	void optimize_mesh(Mesh& mesh, const char* name)
+	{
+		VK_TRACE_ZONE("vkmeshopt::optimize_mesh");
+
+		VertexCacheStats before = analyze_vertex_cache(mesh._indices, mesh._vertices.size());
+
+		optimize_vertex_cache(mesh._indices, mesh._vertices.size());
+		optimize_overdraw(mesh._indices, mesh._vertices);
+		optimize_vertex_fetch(mesh._vertices, mesh._indices);
+
+		VertexCacheStats after = analyze_vertex_cache(mesh._indices, mesh._vertices.size());
+
+		std::cout << name << ": ACMR " << before.acmr << " -> " << after.acmr
+			<< ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+	}
+}
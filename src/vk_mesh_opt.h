@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vk_mesh.h>
+
+//Index and vertex reordering passes run once after a mesh is loaded
+namespace vkmeshopt {
+
+	//FIFO cache size the passes and the statistics assume, close to what current GPUs behave like
+	constexpr uint32_t DEFAULT_CACHE_SIZE = 16;
+
+	struct VertexCacheStats
+	{
+		//Average cache miss ratio: transformed vertices per triangle, 0.5 is the ideal, 3 the worst
+		float acmr;
+		//Average transform to vertex ratio: transformed vertices per vertex, 1 is the ideal
+		float atvr;
+	};
+
+	VertexCacheStats analyze_vertex_cache(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize = DEFAULT_CACHE_SIZE);
+
+	//Tipsify (Sander et al. 2007), reorders triangles for post-transform cache hits in linear time
+	void optimize_vertex_cache(std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize = DEFAULT_CACHE_SIZE);
+
+	//Splits cache optimized indices into clusters and sorts them so outward facing clusters are drawn first.
+	//threshold bounds how much ACMR may be traded for overdraw, 1.05 allows 5% more vertex transforms.
+	void optimize_overdraw(std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, float threshold = 1.05f, uint32_t cacheSize = DEFAULT_CACHE_SIZE);
+
+	//Orders vertices by first use in the index buffer, drops unreferenced ones and remaps the indices
+	void optimize_vertex_fetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+	//Runs every pass above in order and prints ACMR/ATVR before and after
+	void optimize_mesh(Mesh& mesh, const char* name);
+}
@@ -0,0 +1,258 @@
+#include "vk_meshlet.h"
+#include "vk_trace.h"
+#include "vk_culling.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+#include <glm/geometric.hpp>
+#include <glm/matrix.hpp>
+
+namespace {
+
+	//Only meshlets whose triangles all face within this of the axis get a usable cone
+	constexpr float MIN_CONE_SPREAD = 0.1f;
+	//Cost of a neighbour facing away from the meshlet, relative to one extra vertex.
+	//Higher gives narrower cones (more backface culling) at the price of more duplicated vertices.
+	constexpr float CONE_WEIGHT = 1.f;
+
+	void compute_bounds(const std::vector<glm::vec3>& positions, const MeshletMesh& mesh, Meshlet& meshlet)
+	{
+		glm::vec3 minBounds = positions[mesh._vertices[meshlet.vertexOffset]];
+		glm::vec3 maxBounds = minBounds;
+		for (uint32_t i = 0; i < meshlet.vertexCount; ++i)
+		{
+			const glm::vec3& p = positions[mesh._vertices[meshlet.vertexOffset + i]];
+			minBounds = glm::min(minBounds, p);
+			maxBounds = glm::max(maxBounds, p);
+		}
+
+		glm::vec3 center = (minBounds + maxBounds) * 0.5f;
+		float radius = 0.f;
+		for (uint32_t i = 0; i < meshlet.vertexCount; ++i)
+		{
+			radius = std::max(radius, glm::length(positions[mesh._vertices[meshlet.vertexOffset + i]] - center));
+		}
+		meshlet.sphere = glm::vec4(center, radius);
+
+		//Triangle corners and unit normals, degenerate triangles face nowhere and are left out
+		struct Triangle
+		{
+			glm::vec3 p0;
+			glm::vec3 normal;
+		};
+		Triangle triangles[MESHLET_MAX_TRIANGLES];
+		uint32_t triangleCount = 0;
+
+		glm::vec3 axis(0.f);
+		for (uint32_t t = 0; t < meshlet.triangleCount; ++t)
+		{
+			uint32_t packed = mesh._triangles[meshlet.triangleOffset + t];
+			const glm::vec3& p0 = positions[mesh._vertices[meshlet.vertexOffset + (packed & 0xFF)]];
+			const glm::vec3& p1 = positions[mesh._vertices[meshlet.vertexOffset + ((packed >> 8) & 0xFF)]];
+			const glm::vec3& p2 = positions[mesh._vertices[meshlet.vertexOffset + ((packed >> 16) & 0xFF)]];
+
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			float area = glm::length(normal);
+			if (area <= 0.f)
+				continue;
+
+			triangles[triangleCount++] = { p0, normal / area };
+			axis += normal / area;
+		}
+
+		//Never culled unless the cone below proves otherwise
+		meshlet.cone = glm::vec4(0.f, 0.f, 1.f, 1.f);
+		meshlet.coneApex = glm::vec4(center, 0.f);
+
+		float axisLength = glm::length(axis);
+		if (triangleCount == 0 || axisLength <= 0.f)
+			return;
+		axis /= axisLength;
+
+		float minDot = 1.f;
+		for (uint32_t t = 0; t < triangleCount; ++t)
+		{
+			minDot = std::min(minDot, glm::dot(axis, triangles[t].normal));
+		}
+
+		//Normals spread over (nearly) a half sphere, some triangle always faces the camera
+		if (minDot <= MIN_CONE_SPREAD)
+			return;
+
+		//Push the apex back along the axis until it sits behind every triangle plane,
+		//so seeing the apex from outside the cone means seeing every triangle from behind
+		float maxT = 0.f;
+		for (uint32_t t = 0; t < triangleCount; ++t)
+		{
+			float distance = glm::dot(center - triangles[t].p0, triangles[t].normal);
+			maxT = std::max(maxT, distance / glm::dot(axis, triangles[t].normal));
+		}
+
+		meshlet.cone = glm::vec4(axis, std::sqrt(1.f - minDot * minDot));
+		meshlet.coneApex = glm::vec4(center - axis * maxT, 0.f);
+	}
+}
+
+namespace vkmeshlet {
+
+	void build_meshlets(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices, MeshletMesh& outMeshlets)
+	{
+		VK_TRACE_ZONE("vkmeshlet::build_meshlets");
+
+		outMeshlets._meshlets.clear();
+		outMeshlets._vertices.clear();
+		outMeshlets._triangles.clear();
+
+		size_t triangleCount = indices.size() / 3;
+
+		//Triangles around each vertex, so a meshlet can grow into its neighbourhood
+		std::vector<uint32_t> adjacencyOffsets(positions.size() + 1, 0);
+		for (size_t i = 0; i < triangleCount * 3; ++i)
+		{
+			adjacencyOffsets[indices[i] + 1]++;
+		}
+		for (size_t v = 0; v < positions.size(); ++v)
+		{
+			adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+		}
+		std::vector<uint32_t> adjacency(triangleCount * 3);
+		{
+			std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+			for (size_t i = 0; i < triangleCount * 3; ++i)
+			{
+				adjacency[fill[indices[i]]++] = (uint32_t)(i / 3);
+			}
+		}
+
+		std::vector<glm::vec3> triangleNormals(triangleCount);
+		for (size_t t = 0; t < triangleCount; ++t)
+		{
+			const glm::vec3& p0 = positions[indices[t * 3 + 0]];
+			glm::vec3 normal = glm::cross(positions[indices[t * 3 + 1]] - p0, positions[indices[t * 3 + 2]] - p0);
+			float area = glm::length(normal);
+			triangleNormals[t] = area > 0.f ? normal / area : glm::vec3(0.f);
+		}
+
+		std::vector<bool> emitted(triangleCount, false);
+		//Slot of each mesh vertex in the meshlet being filled, 0xFF when it is not in there yet
+		std::vector<uint8_t> localIndex(positions.size(), 0xFF);
+
+		Meshlet current = {};
+		//Unnormalized average facing of the meshlet being filled
+		glm::vec3 normalSum(0.f);
+
+		auto finish_meshlet = [&]() {
+			if (current.triangleCount == 0)
+				return;
+
+			for (uint32_t i = 0; i < current.vertexCount; ++i)
+			{
+				localIndex[outMeshlets._vertices[current.vertexOffset + i]] = 0xFF;
+			}
+
+			compute_bounds(positions, outMeshlets, current);
+			outMeshlets._meshlets.push_back(current);
+
+			current = {};
+			normalSum = glm::vec3(0.f);
+			current.vertexOffset = (uint32_t)outMeshlets._vertices.size();
+			current.triangleOffset = (uint32_t)outMeshlets._triangles.size();
+		};
+
+		auto new_vertex_count = [&](uint32_t triangle) {
+			const uint32_t* corners = &indices[triangle * 3];
+			return (uint32_t)(localIndex[corners[0]] == 0xFF) + (localIndex[corners[1]] == 0xFF) + (localIndex[corners[2]] == 0xFF);
+		};
+
+		auto add_triangle = [&](uint32_t triangle) {
+			uint32_t packed = 0;
+			for (int k = 0; k < 3; ++k)
+			{
+				uint32_t vertex = indices[triangle * 3 + k];
+				uint8_t& slot = localIndex[vertex];
+				if (slot == 0xFF)
+				{
+					slot = (uint8_t)current.vertexCount++;
+					outMeshlets._vertices.push_back(vertex);
+				}
+				packed |= (uint32_t)slot << (8 * k);
+			}
+
+			outMeshlets._triangles.push_back(packed);
+			current.triangleCount++;
+			emitted[triangle] = true;
+			normalSum += triangleNormals[triangle];
+		};
+
+		//Index order is the fallback seed, it keeps the vertex cache order of optimized meshes
+		size_t nextSeed = 0;
+		size_t emittedCount = 0;
+		while (emittedCount < triangleCount)
+		{
+			//The neighbour adding the fewest new vertices and facing the same way, so clusters stay compact and cullable
+			float normalLength = glm::length(normalSum);
+			glm::vec3 meshletNormal = normalLength > 0.f ? normalSum / normalLength : glm::vec3(0.f);
+
+			uint32_t best = UINT32_MAX;
+			float bestScore = FLT_MAX;
+			for (uint32_t i = 0; i < current.vertexCount; ++i)
+			{
+				uint32_t vertex = outMeshlets._vertices[current.vertexOffset + i];
+				for (uint32_t a = adjacencyOffsets[vertex]; a < adjacencyOffsets[vertex + 1]; ++a)
+				{
+					uint32_t triangle = adjacency[a];
+					if (emitted[triangle])
+						continue;
+
+					uint32_t newVertices = new_vertex_count(triangle);
+					float score = newVertices + CONE_WEIGHT * (1.f - glm::dot(meshletNormal, triangleNormals[triangle]));
+					if (score < bestScore && current.vertexCount + newVertices <= MESHLET_MAX_VERTICES)
+					{
+						best = triangle;
+						bestScore = score;
+					}
+				}
+			}
+
+			if (best == UINT32_MAX)
+			{
+				while (emitted[nextSeed])
+				{
+					++nextSeed;
+				}
+				best = (uint32_t)nextSeed;
+			}
+
+			if (current.vertexCount + new_vertex_count(best) > MESHLET_MAX_VERTICES || current.triangleCount + 1 > MESHLET_MAX_TRIANGLES)
+			{
+				finish_meshlet();
+			}
+
+			add_triangle(best);
+			++emittedCount;
+		}
+
+		finish_meshlet();
+
+		std::cout << "Built " << outMeshlets._meshlets.size() << " meshlets from " << indices.size() / 3 << " triangles, "
+			<< (double)outMeshlets._vertices.size() / std::max(positions.size(), (size_t)1) << " meshlet vertices per mesh vertex" << std::endl;
+	}
+
+	MeshletCullConstants get_cull_constants(const glm::mat4& projection, const glm::mat4& view, const glm::mat4& model)
+	{
+		MeshletCullConstants constants;
+
+		//Including the model matrix makes the planes come out in mesh space
+		Frustum frustum = vkcull::extract_frustum(projection * view * model);
+		for (int i = 0; i < 6; ++i)
+		{
+			constants.frustum[i] = frustum.planes[i];
+		}
+
+		constants.cameraPosition = glm::inverse(view * model) * glm::vec4(0.f, 0.f, 0.f, 1.f);
+		return constants;
+	}
+}
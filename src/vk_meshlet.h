@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vk_mesh.h>
+#include <glm/vec4.hpp>
+
+//Limits match the culling shader: one workgroup of 128 threads handles one meshlet, one triangle per thread
+constexpr uint32_t MESHLET_MAX_VERTICES = 64;
+constexpr uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+//Same layout as the Meshlet struct of meshlet_cull.comp (std430)
+struct Meshlet
+{
+	//xyz center, w radius, in mesh space
+	glm::vec4 sphere;
+	//xyz axis, w cutoff. Facing away when dot(normalize(apex - camera), axis) >= cutoff, a cutoff of 1 never culls
+	glm::vec4 cone;
+	glm::vec4 coneApex;
+
+	uint32_t vertexOffset;
+	uint32_t triangleOffset;
+	uint32_t vertexCount;
+	uint32_t triangleCount;
+};
+
+//Clusters of one mesh. Meshlet triangles index the meshlet's own vertex list,
+//which in turn indexes the vertex buffer of the mesh
+struct MeshletMesh
+{
+	std::vector<Meshlet> _meshlets;
+	std::vector<uint32_t> _vertices;
+	//3 local 8 bit indices per triangle, packed in the low 24 bits
+	std::vector<uint32_t> _triangles;
+
+	AllocatedBuffer _meshletBuffer;
+	AllocatedBuffer _vertexBuffer;
+	AllocatedBuffer _triangleBuffer;
+};
+
+//Exact same struct in meshlet_cull.comp
+struct MeshletCullConstants
+{
+	//Normalized planes, xyz normal pointing inside, in mesh space
+	glm::vec4 frustum[6];
+	glm::vec4 cameraPosition;
+};
+
+namespace vkmeshlet {
+
+	//Greedy: each meshlet grows into the neighbouring triangle adding the fewest new vertices,
+	//and a new one starts from the next unused triangle in index order
+	void build_meshlets(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices, MeshletMesh& outMeshlets);
+
+	//Moves the camera and the frustum into mesh space, so the shader tests the bounds as they are
+	MeshletCullConstants get_cull_constants(const glm::mat4& projection, const glm::mat4& view, const glm::mat4& model);
+}
@@ -0,0 +1,543 @@
+#include "vk_obj.h"
+#include "vk_asset.h"
+#include "vk_trace.h"
+
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+namespace {
+
+	//Chunks are a few MB so small files stay on one thread and large ones spread evenly
+	constexpr size_t MIN_CHUNK_SIZE = 1 << 20;
+	constexpr uint32_t CHUNKS_PER_THREAD = 4;
+
+	//Face indices as parsed: absolute ones are final, negative ones count back from the
+	//chunk's own vertices and only resolve once the vertex count of earlier chunks is known
+	constexpr int64_t RELATIVE_INDEX = -(1ll << 40);
+	constexpr int64_t MISSING_INDEX = INT64_MIN;
+
+	struct ObjCorner
+	{
+		int64_t position;
+		int64_t normal;
+	};
+
+	struct ObjChunk
+	{
+		const char* begin;
+		const char* end;
+
+		std::vector<float> positions;
+		std::vector<float> normals;
+		std::vector<ObjCorner> corners;
+		bool failed{ false };
+
+		//Prefix sums over the earlier chunks, filled by the merge
+		size_t positionBase{ 0 };
+		size_t normalBase{ 0 };
+		size_t cornerBase{ 0 };
+	};
+
+	bool is_space(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	const char* skip_space(const char* p, const char* end)
+	{
+		while (p < end && is_space(*p))
+		{
+			++p;
+		}
+		return p;
+	}
+
+	const char* skip_line(const char* p, const char* end)
+	{
+		const void* newline = memchr(p, '\n', end - p);
+		return newline ? (const char*)newline + 1 : end;
+	}
+
+	//Exact powers of ten representable in a double
+	const double POWERS_OF_TEN[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	//Decimal mantissa in an integer, scaled once by an exact power of ten.
+	//Correctly rounded to float for anything an exporter writes, no locale, no allocation.
+	const char* parse_float(const char* p, const char* end, float& out)
+	{
+		p = skip_space(p, end);
+
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			negative = *p == '-';
+			++p;
+		}
+
+		uint64_t mantissa = 0;
+		int exponent = 0;
+		int digits = 0;
+		const char* start = p;
+
+		while (p < end && *p >= '0' && *p <= '9')
+		{
+			//Digits past what 64 bits hold only shift the exponent
+			if (digits < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa != 0)
+					++digits;
+			}
+			else
+			{
+				++exponent;
+			}
+			++p;
+		}
+
+		if (p < end && *p == '.')
+		{
+			++p;
+			while (p < end && *p >= '0' && *p <= '9')
+			{
+				if (digits < 19)
+				{
+					mantissa = mantissa * 10 + (*p - '0');
+					--exponent;
+					if (mantissa != 0)
+						++digits;
+				}
+				++p;
+			}
+		}
+
+		if (p == start)
+			return nullptr;
+
+		if (p < end && (*p == 'e' || *p == 'E'))
+		{
+			++p;
+			bool negativeExponent = false;
+			if (p < end && (*p == '-' || *p == '+'))
+			{
+				negativeExponent = *p == '-';
+				++p;
+			}
+
+			int value = 0;
+			while (p < end && *p >= '0' && *p <= '9')
+			{
+				if (value < 10000)
+					value = value * 10 + (*p - '0');
+				++p;
+			}
+			exponent += negativeExponent ? -value : value;
+		}
+
+		double result = (double)mantissa;
+		if (exponent < 0 && exponent >= -22)
+		{
+			result /= POWERS_OF_TEN[-exponent];
+		}
+		else if (exponent > 0 && exponent <= 22)
+		{
+			result *= POWERS_OF_TEN[exponent];
+		}
+		else if (exponent != 0)
+		{
+			result *= std::pow(10.0, exponent);
+		}
+
+		out = (float)(negative ? -result : result);
+		return p;
+	}
+
+	const char* parse_int(const char* p, const char* end, int64_t& out)
+	{
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			negative = *p == '-';
+			++p;
+		}
+
+		const char* start = p;
+		int64_t value = 0;
+		while (p < end && *p >= '0' && *p <= '9')
+		{
+			value = value * 10 + (*p - '0');
+			++p;
+		}
+
+		if (p == start)
+			return nullptr;
+
+		out = negative ? -value : value;
+		return p;
+	}
+
+	//1 based absolute or negative relative, see RELATIVE_INDEX
+	int64_t encode_index(int64_t index, size_t localCount)
+	{
+		if (index > 0)
+			return index - 1;
+
+		return RELATIVE_INDEX + (int64_t)localCount + index;
+	}
+
+	bool resolve_index(int64_t index, size_t base, size_t count, uint32_t& out)
+	{
+		if (index < 0)
+		{
+			index = index - RELATIVE_INDEX + (int64_t)base;
+		}
+
+		if (index < 0 || index >= (int64_t)count)
+			return false;
+
+		out = (uint32_t)index;
+		return true;
+	}
+
+	//One face line, fanned into triangles: "f v v v", "f v/vt v/vt v/vt", "f v//vn ..." or "f v/vt/vn ..."
+	bool parse_face(const char* p, const char* end, ObjChunk& chunk)
+	{
+		ObjCorner first = {};
+		ObjCorner previous = {};
+		uint32_t cornerCount = 0;
+
+		size_t localPositions = chunk.positions.size() / 3;
+		size_t localNormals = chunk.normals.size() / 3;
+
+		while (true)
+		{
+			p = skip_space(p, end);
+			if (p >= end || *p == '\n' || *p == '#')
+				break;
+
+			int64_t index;
+			p = parse_int(p, end, index);
+			if (p == nullptr || index == 0)
+				return false;
+
+			ObjCorner corner;
+			corner.position = encode_index(index, localPositions);
+			corner.normal = MISSING_INDEX;
+
+			if (p < end && *p == '/')
+			{
+				++p;
+				//Texture coordinates are not used, skip them
+				while (p < end && (*p == '-' || (*p >= '0' && *p <= '9')))
+				{
+					++p;
+				}
+
+				if (p < end && *p == '/')
+				{
+					++p;
+					p = parse_int(p, end, index);
+					if (p == nullptr || index == 0)
+						return false;
+					corner.normal = encode_index(index, localNormals);
+				}
+			}
+
+			if (cornerCount == 0)
+			{
+				first = corner;
+			}
+			else if (cornerCount >= 2)
+			{
+				chunk.corners.push_back(first);
+				chunk.corners.push_back(previous);
+				chunk.corners.push_back(corner);
+			}
+
+			previous = corner;
+			++cornerCount;
+		}
+
+		return true;
+	}
+
+	void parse_chunk(ObjChunk& chunk)
+	{
+		VK_TRACE_ZONE("vkobj::parse_chunk");
+
+		const char* p = chunk.begin;
+		const char* end = chunk.end;
+
+		//Rough guess from the monkey and sponza exports, saves most of the regrowth
+		size_t estimatedLines = (end - p) / 32;
+		chunk.positions.reserve(estimatedLines);
+		chunk.normals.reserve(estimatedLines);
+		chunk.corners.reserve(estimatedLines);
+
+		while (p < end)
+		{
+			p = skip_space(p, end);
+			if (p >= end)
+				break;
+
+			const char* line = p;
+			if (end - line >= 2 && line[0] == 'v' && is_space(line[1]))
+			{
+				float xyz[3];
+				p = line + 2;
+				for (int i = 0; i < 3 && p; ++i)
+				{
+					p = parse_float(p, end, xyz[i]);
+				}
+				if (p == nullptr)
+				{
+					chunk.failed = true;
+					return;
+				}
+				chunk.positions.insert(chunk.positions.end(), xyz, xyz + 3);
+			}
+			else if (end - line >= 3 && line[0] == 'v' && line[1] == 'n' && is_space(line[2]))
+			{
+				float xyz[3];
+				p = line + 3;
+				for (int i = 0; i < 3 && p; ++i)
+				{
+					p = parse_float(p, end, xyz[i]);
+				}
+				if (p == nullptr)
+				{
+					chunk.failed = true;
+					return;
+				}
+				chunk.normals.insert(chunk.normals.end(), xyz, xyz + 3);
+			}
+			else if (end - line >= 2 && line[0] == 'f' && is_space(line[1]))
+			{
+				if (!parse_face(line + 2, end, chunk))
+				{
+					chunk.failed = true;
+					return;
+				}
+			}
+
+			//Everything else (comments, vt, groups, materials) is skipped along with the rest of the line
+			p = skip_line(p, end);
+		}
+	}
+
+	//Open addressing map from a (position, normal) index pair to its vertex, the merge's hot loop
+	class CornerTable
+	{
+	public:
+		explicit CornerTable(size_t capacity)
+		{
+			size_t size = 16;
+			while (size < capacity * 2)
+			{
+				size *= 2;
+			}
+			_mask = size - 1;
+			_keys.assign(size, EMPTY_KEY);
+			_values.resize(size);
+		}
+
+		//Returns true when the key was inserted with value, false when it was already there
+		bool insert(uint64_t key, uint32_t value, uint32_t& outValue)
+		{
+			size_t slot = hash(key) & _mask;
+			while (true)
+			{
+				if (_keys[slot] == EMPTY_KEY)
+				{
+					_keys[slot] = key;
+					_values[slot] = value;
+					outValue = value;
+					return true;
+				}
+				if (_keys[slot] == key)
+				{
+					outValue = _values[slot];
+					return false;
+				}
+				slot = (slot + 1) & _mask;
+			}
+		}
+
+	private:
+		static constexpr uint64_t EMPTY_KEY = ~0ull;
+
+		static size_t hash(uint64_t key)
+		{
+			key ^= key >> 33;
+			key *= 0xff51afd7ed558ccdull;
+			key ^= key >> 33;
+			return (size_t)key;
+		}
+
+		std::vector<uint64_t> _keys;
+		std::vector<uint32_t> _values;
+		size_t _mask;
+	};
+}
+
+namespace vkobj {
+
+	bool load_obj(const char* filename, Mesh& outMesh, JobSystem& jobs, ObjLoadStats* outStats)
+	{
+		VK_TRACE_ZONE("vkobj::load_obj");
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		MappedFile file;
+		if (!file.open(filename))
+		{
+			std::cerr << "Could not open " << filename << std::endl;
+			return false;
+		}
+
+		const char* data = (const char*)file.data();
+		const char* dataEnd = data + file.size();
+
+		//Split on line starts, each chunk ends right after a newline or at the end of the file
+		uint32_t targetChunks = (jobs.get_thread_count() + 1) * CHUNKS_PER_THREAD;
+		size_t chunkSize = std::max(file.size() / targetChunks, MIN_CHUNK_SIZE);
+
+		std::vector<ObjChunk> chunks;
+		const char* cursor = data;
+		while (cursor < dataEnd)
+		{
+			const char* chunkEnd = (size_t)(dataEnd - cursor) > chunkSize ? skip_line(cursor + chunkSize, dataEnd) : dataEnd;
+
+			ObjChunk chunk;
+			chunk.begin = cursor;
+			chunk.end = chunkEnd;
+			chunks.push_back(std::move(chunk));
+
+			cursor = chunkEnd;
+		}
+
+		jobs.parallel_for((uint32_t)chunks.size(), [&](uint32_t i) { parse_chunk(chunks[i]); });
+
+		auto parsed = std::chrono::high_resolution_clock::now();
+
+		size_t positionCount = 0;
+		size_t normalCount = 0;
+		size_t cornerCount = 0;
+		for (ObjChunk& chunk : chunks)
+		{
+			if (chunk.failed)
+			{
+				std::cerr << filename << ": malformed vertex or face at byte " << (chunk.begin - data) << " or later" << std::endl;
+				return false;
+			}
+
+			chunk.positionBase = positionCount;
+			chunk.normalBase = normalCount;
+			chunk.cornerBase = cornerCount;
+			positionCount += chunk.positions.size() / 3;
+			normalCount += chunk.normals.size() / 3;
+			cornerCount += chunk.corners.size();
+		}
+
+		if (positionCount > UINT32_MAX - 1 || normalCount > UINT32_MAX - 1)
+		{
+			std::cerr << filename << ": too many vertices" << std::endl;
+			return false;
+		}
+
+		//Flatten every corner to a (position, normal + 1) key, 0 standing for no normal
+		std::vector<uint64_t> keys(cornerCount);
+		std::atomic<bool> badIndex{ false };
+		jobs.parallel_for((uint32_t)chunks.size(), [&](uint32_t i) {
+			const ObjChunk& chunk = chunks[i];
+			uint64_t* out = keys.data() + chunk.cornerBase;
+
+			for (const ObjCorner& corner : chunk.corners)
+			{
+				uint32_t position;
+				uint32_t normal = 0;
+				bool valid = resolve_index(corner.position, chunk.positionBase, positionCount, position);
+				if (corner.normal != MISSING_INDEX)
+				{
+					valid = valid && resolve_index(corner.normal, chunk.normalBase, normalCount, normal);
+					normal += 1;
+				}
+
+				if (!valid)
+				{
+					badIndex = true;
+					return;
+				}
+
+				*out++ = ((uint64_t)position << 32) | normal;
+			}
+		});
+
+		if (badIndex)
+		{
+			std::cerr << filename << ": face references a vertex that does not exist" << std::endl;
+			return false;
+		}
+
+		//Vertices get numbered in order of first use, same as load_from_obj
+		std::vector<float> positions(positionCount * 3);
+		std::vector<float> normals(normalCount * 3);
+		jobs.parallel_for((uint32_t)chunks.size(), [&](uint32_t i) {
+			const ObjChunk& chunk = chunks[i];
+			std::copy(chunk.positions.begin(), chunk.positions.end(), positions.begin() + chunk.positionBase * 3);
+			std::copy(chunk.normals.begin(), chunk.normals.end(), normals.begin() + chunk.normalBase * 3);
+		});
+
+		outMesh._vertices.clear();
+		outMesh._indices.resize(cornerCount);
+
+		CornerTable table(cornerCount);
+		for (size_t i = 0; i < cornerCount; ++i)
+		{
+			uint64_t key = keys[i];
+			uint32_t vertexIndex;
+			if (table.insert(key, (uint32_t)outMesh._vertices.size(), vertexIndex))
+			{
+				uint32_t position = (uint32_t)(key >> 32);
+				uint32_t normal = (uint32_t)key;
+
+				Vertex vertex;
+				memset(&vertex, 0, sizeof(Vertex));
+				memcpy(&vertex.position, &positions[position * 3], sizeof(glm::vec3));
+				if (normal != 0)
+				{
+					memcpy(&vertex.normal, &normals[(normal - 1) * 3], sizeof(glm::vec3));
+				}
+
+				//we are setting the vertex color as the vertex normal. This is just for display purposes
+				vertex.color = vertex.normal;
+
+				outMesh._vertices.push_back(vertex);
+			}
+			outMesh._indices[i] = vertexIndex;
+		}
+
+		auto merged = std::chrono::high_resolution_clock::now();
+
+		std::cout << filename << ": " << outMesh._vertices.size() << " unique vertices out of " << cornerCount << " corners" << std::endl;
+
+		outMesh.compute_bounds();
+
+		if (outStats)
+		{
+			outStats->fileSize = file.size();
+			outStats->chunkCount = (uint32_t)chunks.size();
+			outStats->cornerCount = cornerCount;
+			outStats->parseMs = std::chrono::duration<double, std::milli>(parsed - start).count();
+			outStats->mergeMs = std::chrono::duration<double, std::milli>(merged - parsed).count();
+		}
+
+		return true;
+	}
+}
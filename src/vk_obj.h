@@ -0,0 +1,24 @@
+#pragma once
+
+#include <vk_mesh.h>
+#include <vk_jobs.h>
+
+//OBJ loader for large files: the file is memory mapped, split at line boundaries and
+//every chunk is parsed on the job system without building intermediate strings.
+//Only positions, normals and faces are read. The triangles and attribute values are the same as
+//Mesh::load_from_obj, but corners are shared by (position index, normal index) so the vertex count can differ.
+namespace vkobj {
+
+	struct ObjLoadStats
+	{
+		size_t fileSize;
+		uint32_t chunkCount;
+		size_t cornerCount;
+		double parseMs;
+		double mergeMs;
+	};
+
+	//Polygons are fanned into triangles, corners with the same position and normal share a vertex.
+	//Safe to call from inside a job, the calling thread takes part in the parsing.
+	bool load_obj(const char* filename, Mesh& outMesh, JobSystem& jobs, ObjLoadStats* outStats = nullptr);
+}
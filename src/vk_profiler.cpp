@@ -0,0 +1,123 @@
+#include "vk_profiler.h"
+
+void GpuProfiler::init(VkDevice device, VkPhysicalDevice gpu, uint32_t queueFamily, uint32_t framesInFlight)
+{
+	_device = device;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(gpu, &properties);
+
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(gpu, &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> families(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(gpu, &familyCount, families.data());
+
+	//A queue without valid bits can't write timestamps at all
+	uint32_t validBits = queueFamily < familyCount ? families[queueFamily].timestampValidBits : 0;
+
+	_supported = validBits > 0 && properties.limits.timestampPeriod > 0.f;
+	if (!_supported)
+	{
+		std::cout << "GPU profiler disabled: the graphics queue does not support timestamps" << std::endl;
+		return;
+	}
+
+	_timestampPeriod = properties.limits.timestampPeriod;
+	_timestampMask = validBits >= 64 ? ~0ull : ((1ull << validBits) - 1);
+
+	VkQueryPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	poolInfo.pNext = nullptr;
+	poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	//A begin and an end query per scope
+	poolInfo.queryCount = MAX_GPU_SCOPES * 2;
+
+	_frames.resize(framesInFlight);
+	for (FrameQueries& frame : _frames)
+	{
+		VK_CHECK(vkCreateQueryPool(_device, &poolInfo, nullptr, &frame._queryPool));
+
+		frame._names.resize(MAX_GPU_SCOPES);
+		frame._depths.resize(MAX_GPU_SCOPES);
+	}
+}
+
+void GpuProfiler::cleanup()
+{
+	for (FrameQueries& frame : _frames)
+	{
+		vkDestroyQueryPool(_device, frame._queryPool, nullptr);
+	}
+	_frames.clear();
+}
+
+void GpuProfiler::begin_frame(VkCommandBuffer cmd, uint32_t frameIndex, int frameNumber)
+{
+	if (!_supported)
+		return;
+
+	_current = &_frames[frameIndex];
+
+	//The fence of this slot was waited on, so what it recorded last time is ready
+	if (_current->_scopeCount > 0)
+	{
+		resolve(*_current);
+	}
+
+	vkCmdResetQueryPool(cmd, _current->_queryPool, 0, MAX_GPU_SCOPES * 2);
+
+	_current->_scopeCount = 0;
+	_current->_frameNumber = frameNumber;
+	_openScopes = 0;
+}
+
+uint32_t GpuProfiler::begin_scope(VkCommandBuffer cmd, const char* name)
+{
+	//Scopes past the limit are silently dropped
+	if (!_supported || _current == nullptr || _current->_scopeCount >= MAX_GPU_SCOPES)
+		return UINT32_MAX;
+
+	uint32_t scope = _current->_scopeCount++;
+	_current->_names[scope] = name;
+	_current->_depths[scope] = _openScopes++;
+
+	vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, _current->_queryPool, scope * 2);
+
+	return scope;
+}
+
+void GpuProfiler::end_scope(VkCommandBuffer cmd, uint32_t scope)
+{
+	if (scope == UINT32_MAX)
+		return;
+
+	--_openScopes;
+
+	vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, _current->_queryPool, scope * 2 + 1);
+}
+
+void GpuProfiler::resolve(FrameQueries& frame)
+{
+	uint64_t results[MAX_GPU_SCOPES * 2];
+
+	//No WAIT bit: if the results are somehow not there yet, skip this frame instead of stalling
+	VkResult result = vkGetQueryPoolResults(_device, frame._queryPool, 0, frame._scopeCount * 2,
+		sizeof(results), results, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+
+	if (result != VK_SUCCESS)
+		return;
+
+	_timings.resize(frame._scopeCount);
+	for (uint32_t i = 0; i < frame._scopeCount; ++i)
+	{
+		uint64_t begin = results[i * 2] & _timestampMask;
+		uint64_t end = results[i * 2 + 1] & _timestampMask;
+
+		_timings[i].name = frame._names[i];
+		_timings[i].depth = frame._depths[i];
+		//Ticks to nanoseconds to milliseconds
+		_timings[i].ms = end > begin ? (end - begin) * _timestampPeriod / 1000000.0 : 0.0;
+	}
+
+	_resolvedFrame = frame._frameNumber;
+}
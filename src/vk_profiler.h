@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vk_types.h>
+#include <vector>
+#include <string>
+
+//Upper bound of scopes a single frame can record, each one uses 2 timestamp queries
+constexpr uint32_t MAX_GPU_SCOPES = 64;
+
+struct GpuScopeTiming
+{
+	std::string name;
+	//Nesting level, 0 for scopes opened directly in the frame
+	uint32_t depth;
+	double ms;
+};
+
+//Timestamp query based GPU profiler.
+//Each frame of the ring owns a query pool. Results are read when the ring comes back to that frame,
+//after its fence was waited on, so reading them never stalls.
+class GpuProfiler
+{
+public:
+	void init(VkDevice device, VkPhysicalDevice gpu, uint32_t queueFamily, uint32_t framesInFlight);
+	void cleanup();
+
+	//Must be called outside of a render pass, right after the fence of the frame slot was waited on
+	void begin_frame(VkCommandBuffer cmd, uint32_t frameIndex, int frameNumber);
+
+	uint32_t begin_scope(VkCommandBuffer cmd, const char* name);
+	void end_scope(VkCommandBuffer cmd, uint32_t scope);
+
+	//GPU milliseconds per scope of the most recently resolved frame, in the order the scopes were opened
+	const std::vector<GpuScopeTiming>& get_timings() const { return _timings; }
+
+	//Frame number the timings belong to, -1 until the first frame got resolved
+	int get_resolved_frame() const { return _resolvedFrame; }
+
+	bool is_supported() const { return _supported; }
+
+private:
+	struct FrameQueries
+	{
+		VkQueryPool _queryPool{ VK_NULL_HANDLE };
+		std::vector<std::string> _names;
+		std::vector<uint32_t> _depths;
+		uint32_t _scopeCount{ 0 };
+		int _frameNumber{ -1 };
+	};
+
+	void resolve(FrameQueries& frame);
+
+	VkDevice _device{ VK_NULL_HANDLE };
+	bool _supported{ false };
+	//Nanoseconds per timestamp tick
+	double _timestampPeriod{ 1.0 };
+	uint64_t _timestampMask{ ~0ull };
+
+	std::vector<FrameQueries> _frames;
+	FrameQueries* _current{ nullptr };
+	uint32_t _openScopes{ 0 };
+
+	std::vector<GpuScopeTiming> _timings;
+	int _resolvedFrame{ -1 };
+};
+
+//Opens a GPU scope for the lifetime of the object
+class ScopedGpuZone
+{
+public:
+	ScopedGpuZone(GpuProfiler& profiler, VkCommandBuffer cmd, const char* name)
+		: _profiler(profiler), _cmd(cmd), _scope(profiler.begin_scope(cmd, name))
+	{
+	}
+
+	~ScopedGpuZone()
+	{
+		_profiler.end_scope(_cmd, _scope);
+	}
+
+	ScopedGpuZone(const ScopedGpuZone&) = delete;
+	ScopedGpuZone& operator=(const ScopedGpuZone&) = delete;
+
+private:
+	GpuProfiler& _profiler;
+	VkCommandBuffer _cmd;
+	uint32_t _scope;
+};
@@ -0,0 +1,183 @@
+#include "vk_scene.h"
+#include "vk_trace.h"
+
+#include <algorithm>
+#include <chrono>
+
+Material* RenderScene::create_material(const std::string& name, VkPipeline pipeline, VkPipelineLayout layout, VkDescriptorSet descriptorSet)
+{
+	Material material;
+	material.pipeline = pipeline;
+	material.pipelineLayout = layout;
+	material.descriptorSet = descriptorSet;
+
+	Material& stored = _materials[name];
+	stored = material;
+
+	//Existing objects may point at a material that was just redefined
+	_drawOrderDirty = true;
+	return &stored;
+}
+
+Material* RenderScene::get_material(const std::string& name)
+{
+	auto it = _materials.find(name);
+	return it == _materials.end() ? nullptr : &it->second;
+}
+
+uint32_t RenderScene::add_object(const RenderObject& object, const glm::mat4& transform)
+{
+	uint32_t handle = (uint32_t)_objects.size();
+	_objects.push_back(object);
+	_transforms.add(transform);
+	_sortKeys.push_back(get_sort_key(object));
+	_proxies.push_back(_tree.create_proxy(vkcull::transform_aabb(transform, object.mesh->_boundsMin, object.mesh->_boundsMax), handle));
+	_drawOrderDirty = true;
+	return handle;
+}
+
+void RenderScene::set_transform(uint32_t handle, const glm::mat4& transform)
+{
+	_transforms.set(handle, transform);
+	_movedObjects.push_back(handle);
+
+	const Mesh* mesh = _objects[handle].mesh;
+	_tree.move_proxy(_proxies[handle], vkcull::transform_aabb(transform, mesh->_boundsMin, mesh->_boundsMax));
+
+	//A pending sort recomputes every sphere anyway
+	if (!_drawOrderDirty)
+	{
+		_drawSpheres.set(_drawPositions[handle], vkcull::transform_sphere(transform, _objects[handle].mesh->_boundingSphere));
+	}
+}
+
+uint64_t RenderScene::get_sort_key(const RenderObject& object)
+{
+	auto pipeline = _pipelineIds.try_emplace(object.material->pipeline, (uint16_t)_pipelineIds.size());
+
+	uint16_t descriptorSetId = 0;
+	if (object.material->descriptorSet != VK_NULL_HANDLE)
+	{
+		descriptorSetId = _descriptorSetIds.try_emplace(object.material->descriptorSet, (uint16_t)(_descriptorSetIds.size() + 1)).first->second;
+	}
+
+	auto mesh = _meshIds.try_emplace(object.mesh, (uint32_t)_meshIds.size());
+
+	return ((uint64_t)pipeline.first->second << 48) | ((uint64_t)descriptorSetId << 32) | mesh.first->second;
+}
+
+const std::vector<uint32_t>& RenderScene::get_draw_order()
+{
+	if (!_drawOrderDirty)
+		return _drawOrder;
+
+	VK_TRACE_ZONE("RenderScene::sort");
+
+	//Keys are refreshed as well, a redefined material can move its objects
+	for (size_t i = 0; i < _objects.size(); ++i)
+	{
+		_sortKeys[i] = get_sort_key(_objects[i]);
+	}
+
+	//Sorted as (key, handle) pairs, ties keep creation order
+	std::vector<std::pair<uint64_t, uint32_t>> sorted(_objects.size());
+	for (uint32_t i = 0; i < (uint32_t)_objects.size(); ++i)
+	{
+		sorted[i] = { _sortKeys[i], i };
+	}
+	std::sort(sorted.begin(), sorted.end());
+
+	_drawOrder.resize(sorted.size());
+	_drawPositions.resize(sorted.size());
+	_drawSpheres.resize(sorted.size());
+	for (size_t i = 0; i < sorted.size(); ++i)
+	{
+		uint32_t handle = sorted[i].second;
+		_drawOrder[i] = handle;
+		_drawPositions[handle] = (uint32_t)i;
+		_drawSpheres.set(i, vkcull::transform_sphere(_transforms.get(handle), _objects[handle].mesh->_boundingSphere));
+	}
+
+	_drawOrderDirty = false;
+	return _drawOrder;
+}
+
+const std::vector<uint32_t>& RenderScene::cull(const glm::mat4& viewProjection, CullStats& outStats, bool hierarchical)
+{
+	const std::vector<uint32_t>& drawOrder = get_draw_order();
+
+	VK_TRACE_ZONE("RenderScene::cull");
+	auto start = std::chrono::high_resolution_clock::now();
+
+	Frustum frustum = vkcull::extract_frustum(viewProjection);
+
+	uint32_t visibleCount;
+	if (hierarchical)
+	{
+		//The tree hands out handles in its own order, sorting their draw positions restores the draw order
+		_visibleObjects.clear();
+		visibleCount = _tree.cull(frustum, _visibleObjects);
+
+		_visiblePositions.resize(visibleCount);
+		for (uint32_t i = 0; i < visibleCount; ++i)
+		{
+			_visiblePositions[i] = _drawPositions[_visibleObjects[i]];
+		}
+		std::sort(_visiblePositions.begin(), _visiblePositions.end());
+	}
+	else
+	{
+		_visiblePositions.resize(_drawSpheres.centerX.size());
+		visibleCount = vkcull::cull_spheres(frustum, _drawSpheres, _visiblePositions.data());
+	}
+
+	_visibleObjects.resize(visibleCount);
+	for (uint32_t i = 0; i < visibleCount; ++i)
+	{
+		_visibleObjects[i] = drawOrder[_visiblePositions[i]];
+	}
+
+	outStats.visible = visibleCount;
+	outStats.culled = (uint32_t)drawOrder.size() - visibleCount;
+	outStats.cullMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	return _visibleObjects;
+}
+
+void RenderScene::query_box(const AABB& box, std::vector<uint32_t>& outHandles) const
+{
+	//Fat boxes can overlap where the object doesn't, the exact box settles it
+	_tree.query_box(box, [&](uint32_t handle) {
+		const Mesh* mesh = _objects[handle].mesh;
+		if (vkbvh::overlaps(vkcull::transform_aabb(_transforms.get(handle), mesh->_boundsMin, mesh->_boundsMax), box))
+		{
+			outHandles.push_back(handle);
+		}
+	});
+}
+
+uint32_t RenderScene::raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float* outDistance) const
+{
+	glm::vec3 inverseDirection = 1.f / direction;
+
+	uint32_t closest = UINT32_MAX;
+	float closestDistance = maxDistance;
+	_tree.query_ray(origin, direction, maxDistance, [&](uint32_t handle, float) {
+		const Mesh* mesh = _objects[handle].mesh;
+		AABB box = vkcull::transform_aabb(_transforms.get(handle), mesh->_boundsMin, mesh->_boundsMax);
+
+		float distance;
+		if (vkbvh::intersect_ray(box, origin, inverseDirection, closestDistance, distance))
+		{
+			closest = handle;
+			closestDistance = distance;
+		}
+		//Only closer boxes matter from here on, a hit at the origin ends the walk
+		return closestDistance;
+	});
+
+	if (outDistance != nullptr && closest != UINT32_MAX)
+	{
+		*outDistance = closestDistance;
+	}
+	return closest;
+}
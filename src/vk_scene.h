@@ -0,0 +1,104 @@
+#pragma once
+
+#include <vk_types.h>
+#include <vk_mesh.h>
+#include <vk_transform.h>
+#include <vk_culling.h>
+#include <vk_bvh.h>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <glm/mat4x4.hpp>
+
+//A pipeline and what it reads, shared by every object drawn the same way
+struct Material
+{
+	VkPipeline pipeline;
+	VkPipelineLayout pipelineLayout;
+	//Bound at set 1 when not null, set 0 is the frame's object buffer
+	VkDescriptorSet descriptorSet{ VK_NULL_HANDLE };
+};
+
+//The transform is kept by the scene, apart from the object
+struct RenderObject
+{
+	Mesh* mesh;
+	Material* material;
+};
+
+//What the draw loop recorded in one frame. A skipped bind is one the previous object already left bound.
+struct DrawStats
+{
+	uint32_t draws{ 0 };
+	//Objects the CPU recorded draws cover, above draws once instancing merges them
+	uint32_t instances{ 0 };
+	uint32_t pipelineBinds{ 0 };
+	uint32_t descriptorSetBinds{ 0 };
+	uint32_t vertexBufferBinds{ 0 };
+	uint32_t indexBufferBinds{ 0 };
+	uint32_t skippedBinds{ 0 };
+};
+
+//Flat list of everything drawn, walked in an order that changes pipeline, descriptor set and mesh as rarely as possible
+class RenderScene
+{
+public:
+	//Materials live as long as the scene, the returned pointer stays valid
+	Material* create_material(const std::string& name, VkPipeline pipeline, VkPipelineLayout layout, VkDescriptorSet descriptorSet = VK_NULL_HANDLE);
+	//nullptr when there is no material with that name
+	Material* get_material(const std::string& name);
+
+	//Handles are indices in creation order, they never change and also index the transforms
+	uint32_t add_object(const RenderObject& object, const glm::mat4& transform);
+	const RenderObject& get_object(uint32_t handle) const { return _objects[handle]; }
+	size_t get_object_count() const { return _objects.size(); }
+
+	//Transforms don't take part in the sort key, moving objects keeps the draw order
+	void set_transform(uint32_t handle, const glm::mat4& transform);
+	glm::mat4 get_transform(uint32_t handle) const { return _transforms.get(handle); }
+	const TransformArray& get_transforms() const { return _transforms; }
+	//Handles given to set_transform since the last clear, in call order and possibly repeated
+	const std::vector<uint32_t>& get_moved_objects() const { return _movedObjects; }
+	void clear_moved_objects() { _movedObjects.clear(); }
+
+	//Handles sorted by key, only re-sorted after objects were added
+	const std::vector<uint32_t>& get_draw_order();
+
+	//Handles of the objects touching the view frustum, still in draw order.
+	//Flat tests every bounding sphere with SSE, hierarchical walks the box tree and only sorts the survivors.
+	const std::vector<uint32_t>& cull(const glm::mat4& viewProjection, CullStats& outStats, bool hierarchical = true);
+
+	//Handles of the objects whose world box overlaps the given box, appended to outHandles
+	void query_box(const AABB& box, std::vector<uint32_t>& outHandles) const;
+	//Closest object whose world box the ray enters, UINT32_MAX when nothing is hit within maxDistance
+	uint32_t raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float* outDistance = nullptr) const;
+
+	//Pipeline in the top 16 bits, descriptor set in the next 16 and mesh in the low 32, so sorting groups them in that order
+	uint64_t get_sort_key(const RenderObject& object);
+
+private:
+	std::unordered_map<std::string, Material> _materials;
+
+	std::vector<RenderObject> _objects;
+	TransformArray _transforms;
+	std::vector<uint32_t> _movedObjects;
+	std::vector<uint64_t> _sortKeys;
+	std::vector<uint32_t> _drawOrder;
+	bool _drawOrderDirty{ false };
+
+	//World space bounding spheres laid out in draw order, so the culled list comes out sorted
+	SphereArray _drawSpheres;
+	//World space boxes of every object, refit in place as they move
+	DynamicAabbTree _tree;
+	std::vector<int32_t> _proxies;
+
+	//Where each handle sits in the draw order
+	std::vector<uint32_t> _drawPositions;
+	std::vector<uint32_t> _visiblePositions;
+	std::vector<uint32_t> _visibleObjects;
+
+	//Dense ids in first-seen order, small enough to pack in a key. Descriptor set 0 is "none".
+	std::unordered_map<VkPipeline, uint16_t> _pipelineIds;
+	std::unordered_map<VkDescriptorSet, uint16_t> _descriptorSetIds;
+	std::unordered_map<const Mesh*, uint32_t> _meshIds;
+};
@@ -0,0 +1,159 @@
+#include "vk_trace.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+	constexpr uint32_t EVENTS_PER_CHUNK = 4096;
+
+	//Only the owning thread writes, readers see events up to count
+	struct EventChunk
+	{
+		vktrace::TraceEvent events[EVENTS_PER_CHUNK];
+		std::atomic<uint32_t> count{ 0 };
+		std::atomic<EventChunk*> next{ nullptr };
+	};
+
+	struct ThreadBuffer
+	{
+		EventChunk* head{ nullptr };
+		EventChunk* tail{ nullptr };
+		uint32_t threadId{ 0 };
+		ThreadBuffer* nextBuffer{ nullptr };
+	};
+
+	//Buffers are pushed once per thread and live until the process exits
+	std::atomic<ThreadBuffer*> gBuffers{ nullptr };
+	std::atomic<uint32_t> gNextThreadId{ 0 };
+
+	const std::chrono::steady_clock::time_point gEpoch = std::chrono::steady_clock::now();
+
+	thread_local ThreadBuffer* tBuffer = nullptr;
+
+	ThreadBuffer* get_thread_buffer()
+	{
+		if (tBuffer == nullptr)
+		{
+			ThreadBuffer* buffer = new ThreadBuffer();
+			buffer->head = buffer->tail = new EventChunk();
+			buffer->threadId = gNextThreadId.fetch_add(1, std::memory_order_relaxed);
+
+			buffer->nextBuffer = gBuffers.load(std::memory_order_relaxed);
+			while (!gBuffers.compare_exchange_weak(buffer->nextBuffer, buffer, std::memory_order_release, std::memory_order_relaxed))
+			{
+			}
+
+			tBuffer = buffer;
+		}
+		return tBuffer;
+	}
+
+	//Frees everything once static destruction runs, every recording thread is gone by then
+	struct BufferReleaser
+	{
+		~BufferReleaser()
+		{
+			ThreadBuffer* buffer = gBuffers.exchange(nullptr);
+			while (buffer)
+			{
+				EventChunk* chunk = buffer->head;
+				while (chunk)
+				{
+					EventChunk* next = chunk->next.load();
+					delete chunk;
+					chunk = next;
+				}
+
+				ThreadBuffer* nextBuffer = buffer->nextBuffer;
+				delete buffer;
+				buffer = nextBuffer;
+			}
+		}
+	} gBufferReleaser;
+
+	void write_escaped(std::ofstream& file, const char* text)
+	{
+		for (const char* c = text; *c; ++c)
+		{
+			if (*c == '"' || *c == '\\')
+			{
+				file << '\\';
+			}
+			file << *c;
+		}
+	}
+}
+
+namespace vktrace {
+
+	std::atomic<bool> gEnabled{ false };
+
+	void set_enabled(bool enabled)
+	{
+		gEnabled.store(enabled, std::memory_order_relaxed);
+	}
+
+	int64_t now_us()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - gEpoch).count();
+	}
+
+	void record(const char* name, int64_t startUs, int64_t durationUs)
+	{
+		ThreadBuffer* buffer = get_thread_buffer();
+
+		EventChunk* chunk = buffer->tail;
+		uint32_t index = chunk->count.load(std::memory_order_relaxed);
+		if (index == EVENTS_PER_CHUNK)
+		{
+			//Grow instead of dropping, the new chunk is published only once it is linked
+			EventChunk* newChunk = new EventChunk();
+			chunk->next.store(newChunk, std::memory_order_release);
+			buffer->tail = chunk = newChunk;
+			index = 0;
+		}
+
+		chunk->events[index] = { name, startUs, durationUs };
+		//Release so a reader that sees the new count also sees the event
+		chunk->count.store(index + 1, std::memory_order_release);
+	}
+
+	bool write_chrome_json(const char* path)
+	{
+		std::ofstream file(path);
+		if (!file.is_open())
+		{
+			std::cout << "Could not write trace to " << path << std::endl;
+			return false;
+		}
+
+		file << "{\"traceEvents\":[\n";
+
+		bool first = true;
+		for (ThreadBuffer* buffer = gBuffers.load(std::memory_order_acquire); buffer; buffer = buffer->nextBuffer)
+		{
+			for (EventChunk* chunk = buffer->head; chunk; chunk = chunk->next.load(std::memory_order_acquire))
+			{
+				uint32_t count = chunk->count.load(std::memory_order_acquire);
+				for (uint32_t i = 0; i < count; ++i)
+				{
+					const TraceEvent& event = chunk->events[i];
+
+					file << (first ? "" : ",\n");
+					file << "{\"name\":\"";
+					write_escaped(file, event.name);
+					file << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->threadId
+						<< ",\"ts\":" << event.startUs << ",\"dur\":" << event.durationUs << "}";
+					first = false;
+				}
+			}
+		}
+
+		file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+		std::cout << "Trace written to " << path << std::endl;
+		return true;
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+//CPU instrumentation zones, dumped as Chrome trace_event JSON (chrome://tracing, ui.perfetto.dev).
+//Zones compile away entirely when VK_TRACE_ENABLED is 0. When compiled in but not enabled at runtime
+//a zone costs one relaxed atomic load.
+#ifndef VK_TRACE_ENABLED
+#define VK_TRACE_ENABLED 1
+#endif
+
+namespace vktrace {
+
+	struct TraceEvent
+	{
+		const char* name;
+		int64_t startUs;
+		int64_t durationUs;
+	};
+
+	extern std::atomic<bool> gEnabled;
+
+	inline bool is_enabled() { return gEnabled.load(std::memory_order_relaxed); }
+	void set_enabled(bool enabled);
+
+	//Microseconds since the process started tracing
+	int64_t now_us();
+
+	//Appends to the buffer of the calling thread, no locking
+	void record(const char* name, int64_t startUs, int64_t durationUs);
+
+	//Writes every event recorded so far by every thread, safe to call while other threads keep recording
+	bool write_chrome_json(const char* path);
+
+	//Times its own lifetime. The name must outlive the trace, string literals are expected.
+	class Zone
+	{
+	public:
+		Zone(const char* name)
+		{
+			if (is_enabled())
+			{
+				_name = name;
+				_startUs = now_us();
+			}
+		}
+
+		~Zone()
+		{
+			if (_name)
+			{
+				record(_name, _startUs, now_us() - _startUs);
+			}
+		}
+
+		Zone(const Zone&) = delete;
+		Zone& operator=(const Zone&) = delete;
+
+	private:
+		const char* _name{ nullptr };
+		int64_t _startUs{ 0 };
+	};
+}
+
+#define VK_TRACE_CONCAT_INNER(a, b) a##b
+#define VK_TRACE_CONCAT(a, b) VK_TRACE_CONCAT_INNER(a, b)
+
+#if VK_TRACE_ENABLED
+#define VK_TRACE_ZONE(name) vktrace::Zone VK_TRACE_CONCAT(_traceZone, __LINE__)(name)
+#else
+#define VK_TRACE_ZONE(name)
+#endif
@@ -0,0 +1,129 @@
+#include "vk_transform.h"
+#include "vk_trace.h"
+
+#include <cstring>
+#include <xmmintrin.h>
+
+uint32_t TransformArray::add(const glm::mat4& transform)
+{
+	uint32_t index = (uint32_t)_count++;
+	if (index / 4 >= _blocks.size())
+	{
+		//Unused lanes hold zero matrices, they are computed but never written out
+		_blocks.emplace_back();
+		memset(&_blocks.back(), 0, sizeof(TransformBlock));
+	}
+	set(index, transform);
+	return index;
+}
+
+void TransformArray::set(uint32_t index, const glm::mat4& transform)
+{
+	TransformBlock& block = _blocks[index / 4];
+	const float* elements = &transform[0][0];
+	for (int e = 0; e < 16; ++e)
+	{
+		block.m[e][index % 4] = elements[e];
+	}
+}
+
+glm::mat4 TransformArray::get(uint32_t index) const
+{
+	const TransformBlock& block = _blocks[index / 4];
+	glm::mat4 transform;
+	float* elements = &transform[0][0];
+	for (int e = 0; e < 16; ++e)
+	{
+		elements[e] = block.m[e][index % 4];
+	}
+	return transform;
+}
+
+namespace {
+
+	//viewProjection * the four matrices of a block, written as four consecutive column-major mat4
+	inline void compute_block(const __m128 viewProjection[16], const TransformBlock& block, float* out)
+	{
+		for (int column = 0; column < 4; ++column)
+		{
+			__m128 m0 = _mm_load_ps(block.m[column * 4 + 0]);
+			__m128 m1 = _mm_load_ps(block.m[column * 4 + 1]);
+			__m128 m2 = _mm_load_ps(block.m[column * 4 + 2]);
+			__m128 m3 = _mm_load_ps(block.m[column * 4 + 3]);
+
+			//Row r of this column for all four objects: sum over k of viewProjection[k][r] * model[column][k]
+			__m128 row0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(viewProjection[0], m0), _mm_mul_ps(viewProjection[4], m1)), _mm_add_ps(_mm_mul_ps(viewProjection[8], m2), _mm_mul_ps(viewProjection[12], m3)));
+			__m128 row1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(viewProjection[1], m0), _mm_mul_ps(viewProjection[5], m1)), _mm_add_ps(_mm_mul_ps(viewProjection[9], m2), _mm_mul_ps(viewProjection[13], m3)));
+			__m128 row2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(viewProjection[2], m0), _mm_mul_ps(viewProjection[6], m1)), _mm_add_ps(_mm_mul_ps(viewProjection[10], m2), _mm_mul_ps(viewProjection[14], m3)));
+			__m128 row3 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(viewProjection[3], m0), _mm_mul_ps(viewProjection[7], m1)), _mm_add_ps(_mm_mul_ps(viewProjection[11], m2), _mm_mul_ps(viewProjection[15], m3)));
+
+			//Lanes are objects, transposed they become each object's column
+			_MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+			_mm_storeu_ps(out + 0 * 16 + column * 4, row0);
+			_mm_storeu_ps(out + 1 * 16 + column * 4, row1);
+			_mm_storeu_ps(out + 2 * 16 + column * 4, row2);
+			_mm_storeu_ps(out + 3 * 16 + column * 4, row3);
+		}
+	}
+
+	void compute_blocks(const __m128 viewProjection[16], const TransformArray& transforms, size_t firstBlock, size_t endBlock, glm::mat4* outMatrices)
+	{
+		size_t count = transforms.size();
+		for (size_t b = firstBlock; b < endBlock; ++b)
+		{
+			const TransformBlock& block = transforms.blocks()[b];
+			if (b * 4 + 4 <= count)
+			{
+				compute_block(viewProjection, block, &outMatrices[b * 4][0][0]);
+			}
+			else
+			{
+				//Partial last block, the output ends at the last object
+				glm::mat4 tail[4];
+				compute_block(viewProjection, block, &tail[0][0][0]);
+				memcpy(&outMatrices[b * 4], tail, (count - b * 4) * sizeof(glm::mat4));
+			}
+		}
+	}
+}
+
+namespace vktransform {
+
+	void compute_mvp(const glm::mat4& viewProjection, const TransformArray& transforms, glm::mat4* outMatrices, JobSystem* jobs)
+	{
+		VK_TRACE_ZONE("vktransform::compute_mvp");
+
+		//Every element broadcast once, the kernel only multiplies and adds
+		__m128 broadcast[16];
+		const float* elements = &viewProjection[0][0];
+		for (int e = 0; e < 16; ++e)
+		{
+			broadcast[e] = _mm_set1_ps(elements[e]);
+		}
+
+		size_t blockCount = transforms.block_count();
+		const size_t blocksPerJob = OBJECTS_PER_JOB / 4;
+		uint32_t jobCount = (uint32_t)((blockCount + blocksPerJob - 1) / blocksPerJob);
+
+		if (jobs == nullptr || jobCount <= 1)
+		{
+			compute_blocks(broadcast, transforms, 0, blockCount, outMatrices);
+			return;
+		}
+
+		jobs->parallel_for(jobCount, [&](uint32_t job) {
+			size_t first = job * blocksPerJob;
+			compute_blocks(broadcast, transforms, first, std::min(first + blocksPerJob, blockCount), outMatrices);
+		});
+	}
+
+	void compute_mvp_scalar(const glm::mat4& viewProjection, const glm::mat4* transforms, size_t count, glm::mat4* outMatrices)
+	{
+		VK_TRACE_ZONE("vktransform::compute_mvp_scalar");
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			outMatrices[i] = viewProjection * transforms[i];
+		}
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vk_jobs.h>
+#include <vector>
+#include <cstdint>
+#include <glm/mat4x4.hpp>
+
+//Four model matrices interleaved: element e (glm's column-major order) of object i sits at m[e][i % 4],
+//so one SSE load picks up the same element of four objects
+struct alignas(16) TransformBlock
+{
+	float m[16][4];
+};
+
+//Model matrices of many objects as a structure of arrays, in blocks of four
+class TransformArray
+{
+public:
+	//Index of the new transform, indices are dense and never change
+	uint32_t add(const glm::mat4& transform);
+	void set(uint32_t index, const glm::mat4& transform);
+	glm::mat4 get(uint32_t index) const;
+
+	size_t size() const { return _count; }
+	size_t block_count() const { return _blocks.size(); }
+	const TransformBlock* blocks() const { return _blocks.data(); }
+
+private:
+	std::vector<TransformBlock> _blocks;
+	size_t _count{ 0 };
+};
+
+namespace vktransform {
+
+	//Objects per job when the work is split over the job system
+	constexpr uint32_t OBJECTS_PER_JOB = 4096;
+
+	//outMatrices[i] = viewProjection * transform i, four objects per SSE iteration.
+	//Only transforms.size() matrices are written, so outMatrices can point straight into a mapped GPU buffer.
+	//Above OBJECTS_PER_JOB objects the blocks are split over jobs when one is given.
+	void compute_mvp(const glm::mat4& viewProjection, const TransformArray& transforms, glm::mat4* outMatrices, JobSystem* jobs = nullptr);
+
+	//Reference glm path, one matrix product per object
+	void compute_mvp_scalar(const glm::mat4& viewProjection, const glm::mat4* transforms, size_t count, glm::mat4* outMatrices);
+}
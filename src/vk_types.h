@@ -7,6 +7,20 @@
 
 #include <vk_mem_alloc.h>
 
+#include <iostream>
+
+#define VK_CHECK(x) \
+	do \
+	{ \
+		VkResult err = x; \
+		if (err) \
+		{ \
+			std::cout << "Detected Vulkan error: " << err << std::endl; \
+			abort(); \
+		} \
+	} \
+	while(0) \
+
 typedef struct
 {
 	//Handle to a GPU buffer
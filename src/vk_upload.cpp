@@ -0,0 +1,267 @@
+#include "vk_upload.h"
+
+#include <vk_initializers.h>
+
+#include <algorithm>
+#include <cstring>
+
+//Staging offsets are kept aligned for any copy source
+constexpr VkDeviceSize STAGING_ALIGNMENT = 16;
+
+void UploadManager::init(VkDevice device, VmaAllocator allocator, VkQueue queue, uint32_t queueFamily, VkDeviceSize stagingSize)
+{
+	_device = device;
+	_allocator = allocator;
+	_queue = queue;
+	_ringSize = stagingSize;
+
+	//Batch command buffers get recorded again once their fence signaled
+	VkCommandPoolCreateInfo poolInfo = vkinit::command_pool_create_info(queueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+	VK_CHECK(vkCreateCommandPool(_device, &poolInfo, nullptr, &_commandPool));
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.pNext = nullptr;
+	bufferInfo.size = _ringSize;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+	//CPU_ONLY memory is host coherent, writes need no flush
+	VmaAllocationCreateInfo vmaallocInfo = {};
+	vmaallocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+	vmaallocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+	VmaAllocationInfo allocationInfo;
+	VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaallocInfo, &_stagingBuffer._buffer, &_stagingBuffer._allocation, &allocationInfo));
+
+	_stagingData = (uint8_t*)allocationInfo.pMappedData;
+}
+
+void UploadManager::cleanup()
+{
+	wait_idle();
+
+	if (_recording)
+	{
+		_freeBatches.push_back(_pending);
+		_recording = false;
+	}
+
+	for (UploadBatch& batch : _freeBatches)
+	{
+		vkDestroyFence(_device, batch._fence, nullptr);
+	}
+	_freeBatches.clear();
+
+	//Destroying the pool frees its command buffers
+	vkDestroyCommandPool(_device, _commandPool, nullptr);
+	vmaDestroyBuffer(_allocator, _stagingBuffer._buffer, _stagingBuffer._allocation);
+}
+
+AllocatedBuffer UploadManager::upload_buffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage)
+{
+	AllocatedBuffer buffer;
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.pNext = nullptr;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+
+	VmaAllocationCreateInfo vmaallocInfo = {};
+	vmaallocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+	VK_CHECK(vmaCreateBuffer(_allocator, &bufferInfo, &vmaallocInfo, &buffer._buffer, &buffer._allocation, nullptr));
+
+	//Half the ring per chunk, so a chunk always fits once the ring drained
+	VkDeviceSize maxChunk = _ringSize / 2;
+
+	for (VkDeviceSize offset = 0; offset < size;)
+	{
+		VkDeviceSize chunk = std::min(size - offset, maxChunk);
+		VkDeviceSize stagingOffset = allocate(chunk);
+
+		memcpy(_stagingData + stagingOffset, (const uint8_t*)data + offset, chunk);
+
+		if (!_recording)
+		{
+			begin_batch();
+		}
+
+		VkBufferCopy copy = {};
+		copy.srcOffset = stagingOffset;
+		copy.dstOffset = offset;
+		copy.size = chunk;
+		vkCmdCopyBuffer(_pending._commandBuffer, _stagingBuffer._buffer, buffer._buffer, 1, &copy);
+
+		_pending._bytes += chunk;
+		_pending._ringEnd = _ringHead;
+
+		offset += chunk;
+	}
+
+	return buffer;
+}
+
+void UploadManager::flush()
+{
+	if (!_recording || _pending._bytes == 0)
+		return;
+
+	//Make the copies visible to any later work on the queue, whatever stage reads them
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.pNext = nullptr;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+
+	vkCmdPipelineBarrier(_pending._commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	VK_CHECK(vkEndCommandBuffer(_pending._commandBuffer));
+
+	VkSubmitInfo submit = {};
+	submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit.pNext = nullptr;
+	submit.commandBufferCount = 1;
+	submit.pCommandBuffers = &_pending._commandBuffer;
+
+	_pending._submitTime = std::chrono::steady_clock::now();
+	VK_CHECK(vkQueueSubmit(_queue, 1, &submit, _pending._fence));
+
+	_inFlight.push_back(_pending);
+	_recording = false;
+
+	_stats.batchesSubmitted++;
+}
+
+void UploadManager::retire()
+{
+	while (!_inFlight.empty() && vkGetFenceStatus(_device, _inFlight.front()._fence) == VK_SUCCESS)
+	{
+		complete_batch(_inFlight.front());
+		_inFlight.pop_front();
+	}
+}
+
+void UploadManager::wait_idle()
+{
+	flush();
+
+	while (!_inFlight.empty())
+	{
+		VK_CHECK(vkWaitForFences(_device, 1, &_inFlight.front()._fence, true, UINT64_MAX));
+		complete_batch(_inFlight.front());
+		_inFlight.pop_front();
+	}
+}
+
+bool UploadManager::try_allocate(VkDeviceSize size, VkDeviceSize& outOffset)
+{
+	//Nothing staged anywhere, start over from the beginning of the ring
+	if (_inFlight.empty() && (!_recording || _pending._bytes == 0))
+	{
+		_ringHead = 0;
+		_ringTail = 0;
+	}
+
+	VkDeviceSize head = (_ringHead + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1);
+
+	if (_ringHead >= _ringTail)
+	{
+		//Free space is [head, end) then [0, tail)
+		if (head + size <= _ringSize)
+		{
+			outOffset = head;
+		}
+		else if (size < _ringTail)
+		{
+			outOffset = 0;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	else
+	{
+		//Wrapped around, free space is [head, tail). Never fill it completely, head == tail means empty.
+		if (head + size >= _ringTail)
+			return false;
+
+		outOffset = head;
+	}
+
+	_ringHead = outOffset + size;
+	return true;
+}
+
+VkDeviceSize UploadManager::allocate(VkDeviceSize size)
+{
+	VkDeviceSize offset = 0;
+	while (!try_allocate(size, offset))
+	{
+		if (_recording && _pending._bytes > 0)
+		{
+			flush();
+		}
+		else
+		{
+			//The oldest batch owns the tail of the ring, waiting on it frees the most space
+			VK_CHECK(vkWaitForFences(_device, 1, &_inFlight.front()._fence, true, UINT64_MAX));
+			complete_batch(_inFlight.front());
+			_inFlight.pop_front();
+		}
+	}
+	return offset;
+}
+
+void UploadManager::begin_batch()
+{
+	if (!_freeBatches.empty())
+	{
+		_pending = _freeBatches.back();
+		_freeBatches.pop_back();
+	}
+	else
+	{
+		_pending = UploadBatch{};
+
+		VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::command_buffer_allocate_info(_commandPool, 1);
+		VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &_pending._commandBuffer));
+
+		VkFenceCreateInfo fenceInfo = vkinit::fence_create_info();
+		VK_CHECK(vkCreateFence(_device, &fenceInfo, nullptr, &_pending._fence));
+	}
+
+	_pending._bytes = 0;
+	_pending._ringEnd = _ringHead;
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.pNext = nullptr;
+	beginInfo.pInheritanceInfo = nullptr;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	VK_CHECK(vkBeginCommandBuffer(_pending._commandBuffer, &beginInfo));
+
+	_recording = true;
+}
+
+void UploadManager::complete_batch(UploadBatch& batch)
+{
+	//Batches complete in submission order, so the tail just follows the last completed one
+	_ringTail = batch._ringEnd;
+
+	//Time is measured up to when the fence is seen signaled, polling makes it an upper bound
+	auto now = std::chrono::steady_clock::now();
+	auto busyStart = std::max(batch._submitTime, _busyUntil);
+	if (now > busyStart)
+	{
+		_stats.busySeconds += std::chrono::duration<double>(now - busyStart).count();
+	}
+	_busyUntil = now;
+
+	_stats.bytesUploaded += batch._bytes;
+
+	VK_CHECK(vkResetFences(_device, 1, &batch._fence));
+	_freeBatches.push_back(batch);
+}
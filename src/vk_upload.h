@@ -0,0 +1,78 @@
+#pragma once
+
+#include <vk_types.h>
+#include <vector>
+#include <deque>
+#include <chrono>
+
+struct UploadStats
+{
+	uint64_t bytesUploaded{ 0 };
+	uint32_t batchesSubmitted{ 0 };
+	//Time at least one batch was on the GPU, overlapping batches are counted once
+	double busySeconds{ 0.0 };
+
+	double get_bytes_per_second() const { return busySeconds > 0.0 ? bytesUploaded / busySeconds : 0.0; }
+};
+
+//Uploads data into GPU_ONLY buffers through a persistently mapped staging ring.
+//Copies are recorded into a batch and submitted together by flush(). Ring space of a batch is
+//reclaimed once its fence signals. Batches end with a barrier, so anything submitted later on the
+//same queue sees the data.
+class UploadManager
+{
+public:
+	void init(VkDevice device, VmaAllocator allocator, VkQueue queue, uint32_t queueFamily, VkDeviceSize stagingSize = 32 * 1024 * 1024);
+	void cleanup();
+
+	//Creates the destination buffer and records its copy. The data is consumed right away,
+	//the buffer is ready for queue work submitted after the next flush().
+	AllocatedBuffer upload_buffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage);
+
+	//Submits the recorded copies, if any
+	void flush();
+	//Reclaims ring space of the batches the GPU is done with, never blocks
+	void retire();
+	//flush() then wait for every batch to complete
+	void wait_idle();
+
+	const UploadStats& get_stats() const { return _stats; }
+
+private:
+	struct UploadBatch
+	{
+		VkCommandBuffer _commandBuffer{ VK_NULL_HANDLE };
+		VkFence _fence{ VK_NULL_HANDLE };
+		//Ring offset right after the last byte this batch uses
+		VkDeviceSize _ringEnd{ 0 };
+		VkDeviceSize _bytes{ 0 };
+		std::chrono::steady_clock::time_point _submitTime;
+	};
+
+	//Returns false when the ring has no room for size bytes right now
+	bool try_allocate(VkDeviceSize size, VkDeviceSize& outOffset);
+	//Flushes and waits for the oldest batches until size bytes fit
+	VkDeviceSize allocate(VkDeviceSize size);
+
+	void begin_batch();
+	void complete_batch(UploadBatch& batch);
+
+	VkDevice _device{ VK_NULL_HANDLE };
+	VmaAllocator _allocator{ nullptr };
+	VkQueue _queue{ VK_NULL_HANDLE };
+	VkCommandPool _commandPool{ VK_NULL_HANDLE };
+
+	AllocatedBuffer _stagingBuffer;
+	uint8_t* _stagingData{ nullptr };
+	VkDeviceSize _ringSize{ 0 };
+	VkDeviceSize _ringHead{ 0 };
+	VkDeviceSize _ringTail{ 0 };
+
+	bool _recording{ false };
+	UploadBatch _pending;
+	std::deque<UploadBatch> _inFlight;
+	std::vector<UploadBatch> _freeBatches;
+
+	UploadStats _stats;
+	std::chrono::steady_clock::time_point _busyUntil;
+};